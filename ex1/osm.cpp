@@ -1,104 +1,476 @@
 #include "osm.h"
-#include <sys/time.h>
+#include "osm_ext.h"
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <cmath>
+#include <vector>
+#include <algorithm>
 
-#define MICRO_TO_NANO 1000
 #define SEC_TO_NANO 1000000000
 #define FUNC_ERROR -1
 #define GROWTH_FACTOR 5
+#define DEFAULT_REPETITIONS 31
+#define DEFAULT_WARMUP 3
+#define CI_Z_SCORE 1.96
 
+/// Optimization barriers ///
+// make the compiler believe VALUE was read and changed, so operations on it can not be folded or removed
+#define OSM_KEEP(VALUE) asm volatile ("" : "+r" (VALUE))
+// forbid the compiler from moving memory accesses across this point
+#define OSM_CLOBBER() asm volatile ("" : : : "memory")
 
-double osm_operation_time(unsigned int iterations){
-  struct timeval startTime{},endTime{};
+unsigned int osmRepetitions = DEFAULT_REPETITIONS;
+unsigned int osmWarmup = DEFAULT_WARMUP;
+bool osmCountersEnabled = false;
 
-  if (iterations == 0)
-    return FUNC_ERROR;
 
-  // set start time
-  if (gettimeofday(&startTime, nullptr) == FUNC_ERROR )
-    return FUNC_ERROR;
+/// Hardware counters ///
 
-  // do iterations number of operations
-  int temp = 0;
-  for (int i=0; i< iterations ; i += GROWTH_FACTOR)
+typedef struct counter_config {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} counter_config;
+
+const counter_config COUNTER_CONFIGS[OSM_NUM_COUNTERS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"llc-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+// the counters of one measurement, totals of the measured repetitions
+typedef struct counter_set {
+  int fds[OSM_NUM_COUNTERS];
+  double totals[OSM_NUM_COUNTERS];
+  bool valid[OSM_NUM_COUNTERS];
+} counter_set;
+
+/**
+ * Open counter for the calling thread, counting the kernel too if we are allowed to.
+ * returns the file descriptor or FUNC_ERROR if the counter is not available
+ */
+int open_counter(osm_counter counter)
+{
+  struct perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = COUNTER_CONFIGS[counter].type;
+  attr.config = COUNTER_CONFIGS[counter].config;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd == FUNC_ERROR)
     {
-      temp += 1;
-      temp += 1;
-      temp += 1;
-      temp += 1;
-      temp += 1;
+      attr.exclude_kernel = 1;
+      fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+  return fd;
+}
+
+/**
+ * Read the counter, scaled up if the kernel multiplexed it. returns false if it can not be read
+ */
+bool read_counter(int fd, double *value)
+{
+  uint64_t data[3]; // value, time enabled, time running
+  if (fd == FUNC_ERROR || read(fd, data, sizeof(data)) != sizeof(data) || data[2] == 0)
+    return false;
+  *value = (double) data[0] * ((double) data[1] / (double) data[2]);
+  return true;
+}
+
+/**
+ * Open all the counters if enabled, the ones which are not available are marked invalid
+ */
+void open_counters(counter_set *counters, bool enabled)
+{
+  for (int i = 0; i < OSM_NUM_COUNTERS; i++)
+    {
+      counters->fds[i] = enabled ? open_counter((osm_counter) i) : FUNC_ERROR;
+      counters->totals[i] = 0;
+      counters->valid[i] = counters->fds[i] != FUNC_ERROR;
     }
+}
 
-  // set end time
-  if (gettimeofday(&endTime, nullptr) == FUNC_ERROR)
-    return -1;
+void close_counters(counter_set *counters)
+{
+  for (int i = 0; i < OSM_NUM_COUNTERS; i++)
+    {
+      if (counters->fds[i] != FUNC_ERROR)
+        close(counters->fds[i]);
+    }
+}
 
-  double diffSec = (endTime.tv_sec - startTime.tv_sec) * SEC_TO_NANO;
-  double diffMicroSec =  (endTime.tv_usec - startTime.tv_usec) * MICRO_TO_NANO;
+int osm_set_counters(bool enabled)
+{
+  int available = 0;
+  for (int i = 0; i < OSM_NUM_COUNTERS; i++)
+    {
+      int fd = open_counter((osm_counter) i);
+      if (fd != FUNC_ERROR)
+        {
+          available++;
+          close(fd);
+        }
+    }
+  osmCountersEnabled = enabled;
+  return available;
+}
 
-  return (diffSec+diffMicroSec) / iterations;
+const char *osm_counter_name(osm_counter counter)
+{
+  return (counter < OSM_NUM_COUNTERS) ? COUNTER_CONFIGS[counter].name : "unknown";
 }
 
-void emptyFunc(){};
 
+/// Measurement core ///
 
-double osm_function_time(unsigned int iterations)
+/**
+ * Returns the current time in nanoseconds, or FUNC_ERROR
+ */
+double now_nano()
 {
-  struct timeval startTime{},endTime{};
+  struct timespec time{};
+  if (clock_gettime(CLOCK_MONOTONIC_RAW, &time) == FUNC_ERROR)
+    return FUNC_ERROR;
+  return (double) time.tv_sec * SEC_TO_NANO + (double) time.tv_nsec;
+}
 
-  if (iterations == 0)
+/**
+ * Runs kernel warmup + repetitions times, and fills samples with the time per operation of the measured runs.
+ * the counters which are open are summed over the measured runs
+ */
+int run_samples(osm_kernel kernel, void *arg, unsigned int iterations, std::vector<double> &samples,
+                counter_set *counters)
+{
+  double before[OSM_NUM_COUNTERS] = {}, after[OSM_NUM_COUNTERS] = {};
+  samples.clear();
+  for (unsigned int rep = 0; rep < osmWarmup + osmRepetitions; rep++)
+    {
+      for (int i = 0; i < OSM_NUM_COUNTERS; i++)
+        counters->valid[i] = counters->valid[i] && read_counter(counters->fds[i], &before[i]);
+
+      double start = now_nano();
+      OSM_CLOBBER();
+      kernel(iterations, arg);
+      OSM_CLOBBER();
+      double end = now_nano();
+      if (start == FUNC_ERROR || end == FUNC_ERROR)
+        return FUNC_ERROR;
+
+      for (int i = 0; i < OSM_NUM_COUNTERS; i++)
+        counters->valid[i] = counters->valid[i] && read_counter(counters->fds[i], &after[i]);
+
+      if (rep >= osmWarmup)
+        {
+          samples.push_back((end - start) / iterations);
+          for (int i = 0; i < OSM_NUM_COUNTERS; i++)
+            counters->totals[i] += after[i] - before[i];
+        }
+    }
+  return 0;
+}
+
+/**
+ * Returns the value at percentile (0-100) of sorted samples
+ */
+double percentile(const std::vector<double> &sorted, double percent)
+{
+  size_t index = (size_t) std::ceil(percent / 100 * sorted.size());
+  index = (index == 0) ? 0 : index - 1;
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+int osm_set_repetitions(unsigned int repetitions, unsigned int warmup)
+{
+  if (repetitions == 0)
     return FUNC_ERROR;
+  osmRepetitions = repetitions;
+  osmWarmup = warmup;
+  return 0;
+}
 
-  // set start time
-  if (gettimeofday(&startTime, nullptr) == FUNC_ERROR)
+int osm_measure(osm_kernel kernel, osm_kernel baseline, void *arg,
+                unsigned int iterations, osm_result *result)
+{
+  if (iterations == 0 || kernel == nullptr || result == nullptr)
     return FUNC_ERROR;
 
-  // Empty functions calls
-  for (int i=0; i< iterations ; i += GROWTH_FACTOR)
+  // the overhead of the loop itself, per operation
+  std::vector<double> samples;
+  double overhead = 0;
+  counter_set counters, baselineCounters;
+  open_counters(&counters, osmCountersEnabled);
+  open_counters(&baselineCounters, osmCountersEnabled && baseline != nullptr);
+  if (baseline != nullptr)
     {
-      emptyFunc();
-      emptyFunc();
-      emptyFunc();
-      emptyFunc();
-      emptyFunc();
+      if (run_samples(baseline, arg, iterations, samples, &baselineCounters) == FUNC_ERROR)
+        {
+          close_counters(&counters);
+          close_counters(&baselineCounters);
+          return FUNC_ERROR;
+        }
+      std::sort(samples.begin(), samples.end());
+      overhead = percentile(samples, 50);
     }
 
-  // set end time
-  if (gettimeofday(&endTime, nullptr) == FUNC_ERROR)
+  int ret = run_samples(kernel, arg, iterations, samples, &counters);
+  close_counters(&counters);
+  close_counters(&baselineCounters);
+  if (ret == FUNC_ERROR)
     return FUNC_ERROR;
+  for (double &sample : samples)
+    sample = std::max(0.0, sample - overhead);
+  std::sort(samples.begin(), samples.end());
+
+  double sum = 0, squares = 0;
+  for (double sample : samples)
+    sum += sample;
+  double mean = sum / samples.size();
+  for (double sample : samples)
+    squares += (sample - mean) * (sample - mean);
+
+  // distribution free confidence interval of the median, by the ranks of the order statistics
+  double n = samples.size();
+  double spread = CI_Z_SCORE * std::sqrt(n) / 2;
+  long low = std::max(0L, (long) std::floor(n / 2 - spread) - 1);
+  long high = std::min((long) n - 1, (long) std::ceil(n / 2 + spread));
 
-  double diffSec = (endTime.tv_sec - startTime.tv_sec) * SEC_TO_NANO;
-  double diffMicroSec =  (endTime.tv_usec - startTime.tv_usec) * MICRO_TO_NANO;
+  result->median = percentile(samples, 50);
+  result->mean = mean;
+  result->stddev = (samples.size() > 1) ? std::sqrt(squares / (n - 1)) : 0;
+  result->min = samples.front();
+  result->max = samples.back();
+  result->p90 = percentile(samples, 90);
+  result->p99 = percentile(samples, 99);
+  result->ci_low = samples[low];
+  result->ci_high = samples[high];
+  result->repetitions = osmRepetitions;
+  result->iterations = iterations;
 
-  return (diffSec+diffMicroSec) / iterations;
+  double operations = (double) osmRepetitions * iterations;
+  for (int i = 0; i < OSM_NUM_COUNTERS; i++)
+    {
+      double loopOverhead = (baseline != nullptr && baselineCounters.valid[i]) ?
+                            baselineCounters.totals[i] / operations : 0;
+      result->counters_valid[i] = counters.valid[i];
+      result->counters[i] = counters.valid[i] ? std::max(0.0, counters.totals[i] / operations - loopOverhead) : 0;
+    }
+  return 0;
 }
 
-double osm_syscall_time(unsigned int iterations)
+
+/// Parallel measurement ///
+
+typedef struct parallel_thread {
+  osm_stats_function stats;
+  unsigned int iterations;
+  int cpu;
+  std::atomic<int> *start;   // 0 - wait, 1 - measure, FUNC_ERROR - abort
+  osm_result result;
+  int ret;
+} parallel_thread;
+
+void *parallel_thread_routine(void *arg)
 {
-  struct timeval startTime{},endTime{};
+  auto context = (parallel_thread *) arg;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(context->cpu, &set);
+  context->ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
 
-  if (iterations == 0)
+  // all the threads start measuring together
+  while (context->start->load() == 0)
+    ;
+  if (context->start->load() == FUNC_ERROR)
+    context->ret = FUNC_ERROR;
+  if (context->ret == 0)
+    context->ret = context->stats(context->iterations, &context->result);
+  return nullptr;
+}
+
+/**
+ * Fills cpus with the first num_cpus cpus the calling thread may run on
+ */
+int default_cpus(unsigned int num_cpus, std::vector<int> &cpus)
+{
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == FUNC_ERROR)
+    return FUNC_ERROR;
+  for (int cpu = 0; cpu < CPU_SETSIZE && cpus.size() < num_cpus; cpu++)
+    {
+      if (CPU_ISSET(cpu, &allowed))
+        cpus.push_back(cpu);
+    }
+  return (cpus.size() == num_cpus) ? 0 : FUNC_ERROR;
+}
+
+int osm_parallel_stats(osm_stats_function stats, unsigned int iterations, const int *cpus,
+                       unsigned int num_cpus, osm_result *per_thread, double *aggregate_ops_per_sec)
+{
+  if (stats == nullptr || iterations == 0 || num_cpus == 0 || per_thread == nullptr)
     return FUNC_ERROR;
 
-  // set start time
-  if (gettimeofday(&startTime, nullptr) == FUNC_ERROR)
+  std::vector<int> cpuList;
+  if (cpus != nullptr)
+    cpuList.assign(cpus, cpus + num_cpus);
+  else if (default_cpus(num_cpus, cpuList) == FUNC_ERROR)
     return FUNC_ERROR;
 
-  // do iterations number of sys.calls
-  for (int i=0; i< iterations ; i += GROWTH_FACTOR)
+  std::atomic<int> start(0);
+  std::vector<parallel_thread> contexts(num_cpus);
+  std::vector<pthread_t> threads(num_cpus);
+  unsigned int created = 0;
+  int ret = 0;
+  for (; created < num_cpus; created++)
+    {
+      contexts[created] = {stats, iterations, cpuList[created], &start, osm_result{}, 0};
+      if (pthread_create(&threads[created], nullptr, parallel_thread_routine, &contexts[created]))
+        break;
+    }
+
+  // if a thread could not be created the others are released without measuring
+  if (created < num_cpus)
+    ret = FUNC_ERROR;
+  start = (ret == 0) ? 1 : FUNC_ERROR;
+  for (unsigned int i = 0; i < created; i++)
+    pthread_join(threads[i], nullptr);
+
+  double aggregate = 0;
+  for (unsigned int i = 0; i < created; i++)
+    {
+      if (contexts[i].ret != 0)
+        ret = FUNC_ERROR;
+      per_thread[i] = contexts[i].result;
+      if (contexts[i].result.median > 0)
+        aggregate += SEC_TO_NANO / contexts[i].result.median;
+    }
+  if (aggregate_ops_per_sec != nullptr)
+    *aggregate_ops_per_sec = aggregate;
+  return ret;
+}
+
+
+/// Kernels ///
+// every kernel runs GROWTH_FACTOR operations per loop iteration, its baseline runs the same loop without them
+
+void empty_loop_kernel(unsigned int iterations, void *arg)
+{
+  for (unsigned int i = 0; i < iterations; i += GROWTH_FACTOR)
+    {
+      OSM_KEEP(i);
+    }
+}
+
+void operation_kernel(unsigned int iterations, void *arg)
+{
+  int temp = 0;
+  for (unsigned int i = 0; i < iterations; i += GROWTH_FACTOR)
+    {
+      temp += 1;
+      OSM_KEEP(temp);
+      temp += 1;
+      OSM_KEEP(temp);
+      temp += 1;
+      OSM_KEEP(temp);
+      temp += 1;
+      OSM_KEEP(temp);
+      temp += 1;
+      OSM_KEEP(temp);
+      OSM_KEEP(i);
+    }
+}
+
+__attribute__((noinline)) void emptyFunc()
+{
+  OSM_CLOBBER();
+}
+
+void function_kernel(unsigned int iterations, void *arg)
+{
+  for (unsigned int i = 0; i < iterations; i += GROWTH_FACTOR)
+    {
+      emptyFunc();
+      emptyFunc();
+      emptyFunc();
+      emptyFunc();
+      emptyFunc();
+      OSM_KEEP(i);
+    }
+}
+
+void syscall_kernel(unsigned int iterations, void *arg)
+{
+  for (unsigned int i = 0; i < iterations; i += GROWTH_FACTOR)
     {
       OSM_NULLSYSCALL;
       OSM_NULLSYSCALL;
       OSM_NULLSYSCALL;
       OSM_NULLSYSCALL;
       OSM_NULLSYSCALL;
+      OSM_KEEP(i);
     }
+}
+
+
+/// osm API ///
+
+/**
+ * Round iterations up to a multiple of GROWTH_FACTOR, which is the number of operations the kernels run
+ */
+unsigned int round_iterations(unsigned int iterations)
+{
+  return ((iterations + GROWTH_FACTOR - 1) / GROWTH_FACTOR) * GROWTH_FACTOR;
+}
+
+int osm_operation_stats(unsigned int iterations, osm_result *result)
+{
+  if (iterations == 0)
+    return FUNC_ERROR;
+  return osm_measure(operation_kernel, empty_loop_kernel, nullptr, round_iterations(iterations), result);
+}
+
+int osm_function_stats(unsigned int iterations, osm_result *result)
+{
+  if (iterations == 0)
+    return FUNC_ERROR;
+  return osm_measure(function_kernel, empty_loop_kernel, nullptr, round_iterations(iterations), result);
+}
 
-  // set end time
-  if (gettimeofday(&endTime, nullptr) == FUNC_ERROR)
+int osm_syscall_stats(unsigned int iterations, osm_result *result)
+{
+  if (iterations == 0)
+    return FUNC_ERROR;
+  return osm_measure(syscall_kernel, empty_loop_kernel, nullptr, round_iterations(iterations), result);
+}
+
+double osm_operation_time(unsigned int iterations)
+{
+  osm_result result{};
+  if (osm_operation_stats(iterations, &result) == FUNC_ERROR)
     return FUNC_ERROR;
+  return result.median;
+}
 
-  double diffSec = (endTime.tv_sec - startTime.tv_sec) * SEC_TO_NANO;
-  double diffMicroSec =  (endTime.tv_usec - startTime.tv_usec) * MICRO_TO_NANO;
+double osm_function_time(unsigned int iterations)
+{
+  osm_result result{};
+  if (osm_function_stats(iterations, &result) == FUNC_ERROR)
+    return FUNC_ERROR;
+  return result.median;
+}
 
-  return (diffSec+diffMicroSec) / iterations;
-}
\ No newline at end of file
+double osm_syscall_time(unsigned int iterations)
+{
+  osm_result result{};
+  if (osm_syscall_stats(iterations, &result) == FUNC_ERROR)
+    return FUNC_ERROR;
+  return result.median;
+}
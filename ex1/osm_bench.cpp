@@ -0,0 +1,169 @@
+#include "osm.h"
+#include "osm_ext.h"
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define BANDWIDTH_BUFFER (256 * 1024 * 1024)
+#define CACHE_LINE 64
+
+/// Usage ///
+#define USAGE "usage: osm_bench [-c cpu list, e.g. 0-3,8] [-p] [measurement name substring]\n" \
+              "with -c every measurement runs at once on all the cpus in the list\n" \
+              "with -p hardware counters per operation are printed after the times (n/a if not available)"
+
+typedef struct measurement {
+  std::string name;
+  unsigned int iterations;
+  osm_stats_function stats;
+} measurement;
+
+/**
+ * Parse a cpu list such as "0-3,8", returns false if it is malformed
+ */
+bool parse_cpus(const char *list, std::vector<int> &cpus)
+{
+  std::string text = list;
+  size_t position = 0;
+  while (position < text.size())
+    {
+      size_t comma = text.find(',', position);
+      std::string range = text.substr(position, comma == std::string::npos ? std::string::npos : comma - position);
+      int first, last;
+      if (sscanf(range.c_str(), "%d-%d", &first, &last) != 2)
+        {
+          if (sscanf(range.c_str(), "%d", &first) != 1)
+            return false;
+          last = first;
+        }
+      if (first < 0 || last < first)
+        return false;
+      for (int cpu = first; cpu <= last; cpu++)
+        cpus.push_back(cpu);
+      position = (comma == std::string::npos) ? text.size() : comma + 1;
+    }
+  return !cpus.empty();
+}
+
+/**
+ * Print the counters per operation of result, if any were collected
+ */
+void print_counters(const osm_result &result)
+{
+  for (int i = 0; i < OSM_NUM_COUNTERS; i++)
+    {
+      if (result.counters_valid[i])
+        printf(" %s=%.2f", osm_counter_name((osm_counter) i), result.counters[i]);
+      else
+        printf(" %s=n/a", osm_counter_name((osm_counter) i));
+    }
+}
+
+/**
+ * Run the measurement on every cpu at once, print a line per thread and the aggregate throughput
+ */
+void run_parallel(const measurement &m, const std::vector<int> &cpus, bool counters)
+{
+  std::vector<osm_result> results(cpus.size());
+  double aggregate = 0;
+  if (osm_parallel_stats(m.stats, m.iterations, cpus.data(), cpus.size(), results.data(), &aggregate) != 0)
+    {
+      printf("%-16s failed\n", m.name.c_str());
+      return;
+    }
+  for (size_t i = 0; i < cpus.size(); i++)
+    {
+      printf("%-16s cpu %-4d %12.2f ns %16.0f ops/s", m.name.c_str(), cpus[i], results[i].median,
+             results[i].median > 0 ? 1e9 / results[i].median : 0);
+      if (counters)
+        print_counters(results[i]);
+      printf("\n");
+    }
+  printf("%-16s %-8s %15s %16.0f ops/s (%zu threads)\n", m.name.c_str(), "total", "", aggregate, cpus.size());
+}
+
+/**
+ * Run every measurement (whose name contains filter) and print its statistics, one line per measurement
+ */
+int main(int argc, char *argv[])
+{
+  std::vector<int> cpus;
+  bool counters = false;
+  int option;
+  while ((option = getopt(argc, argv, "c:ph")) != -1)
+    {
+      if (option == 'p')
+        {
+          counters = true;
+          if (osm_set_counters(true) == 0)
+            fprintf(stderr, "osm_bench: no counters are available on this machine\n");
+          continue;
+        }
+      if (option != 'c' || !parse_cpus(optarg, cpus))
+        {
+          fprintf(stderr, "%s\n", USAGE);
+          return 1;
+        }
+    }
+  if (argc - optind > 1)
+    {
+      fprintf(stderr, "%s\n", USAGE);
+      return 1;
+    }
+  const char *filter = (optind < argc) ? argv[optind] : "";
+
+  std::vector<measurement> measurements = {
+      {"operation", 1000000, osm_operation_stats},
+      {"function", 1000000, osm_function_stats},
+      {"syscall", 100000, osm_syscall_stats},
+      {"thread_switch", 20000, osm_thread_switch_stats},
+      {"process_switch", 20000, osm_process_switch_stats},
+      {"minor_fault", 4096, osm_minor_fault_stats},
+      {"major_fault", 1024, osm_major_fault_stats},
+      {"mutex", 1000000, osm_mutex_stats},
+      {"contended_mutex", 100000, osm_contended_mutex_stats},
+      {"futex_wake", 100000, osm_futex_wake_stats},
+      {"atomic", 1000000, osm_atomic_stats},
+      {"shared_atomic", 1000000, osm_shared_atomic_stats},
+      {"thread_create", 1000, osm_thread_create_stats},
+      {"fork", 200, osm_fork_stats},
+      {"fork_exec", 100, osm_fork_exec_stats},
+      {"l1_latency", 1000000, [] (unsigned int n, osm_result *r) { return osm_cache_latency_stats(n, 1, r); }},
+      {"l2_latency", 1000000, [] (unsigned int n, osm_result *r) { return osm_cache_latency_stats(n, 2, r); }},
+      {"l3_latency", 1000000, [] (unsigned int n, osm_result *r) { return osm_cache_latency_stats(n, 3, r); }},
+      {"dram_latency", 1000000, [] (unsigned int n, osm_result *r) { return osm_cache_latency_stats(n, 4, r); }},
+      {"bandwidth", 4000000, [] (unsigned int n, osm_result *r)
+        { return osm_memory_bandwidth_stats(n, BANDWIDTH_BUFFER, r); }},
+  };
+
+  if (cpus.empty())
+    printf("%-16s %12s %12s %12s %12s %25s\n", "name", "median(ns)", "mean(ns)", "p90(ns)", "p99(ns)", "95% ci of median(ns)");
+  for (const measurement &m : measurements)
+    {
+      if (m.name.find(filter) == std::string::npos)
+        continue;
+      if (!cpus.empty())
+        {
+          run_parallel(m, cpus, counters);
+          continue;
+        }
+
+      osm_result result{};
+      if (m.stats(m.iterations, &result) != 0)
+        {
+          printf("%-16s failed\n", m.name.c_str());
+          continue;
+        }
+      printf("%-16s %12.2f %12.2f %12.2f %12.2f %12.2f-%-12.2f", m.name.c_str(), result.median, result.mean,
+             result.p90, result.p99, result.ci_low, result.ci_high);
+      if (m.name == "bandwidth")
+        printf(" (%.2f GB/s)", CACHE_LINE / result.median);
+      if (counters)
+        print_counters(result);
+      printf("\n");
+    }
+  return 0;
+}
@@ -0,0 +1,139 @@
+#ifndef _OSM_EXT_H
+#define _OSM_EXT_H
+
+#include <cstddef>
+
+/// Extensions to the osm API ///
+
+/**
+ * Hardware / software counters collected with perf_event_open when enabled by osm_set_counters
+ */
+typedef enum osm_counter {
+  OSM_CYCLES,
+  OSM_INSTRUCTIONS,
+  OSM_LLC_MISSES,
+  OSM_BRANCH_MISSES,
+  OSM_CONTEXT_SWITCHES,
+  OSM_NUM_COUNTERS
+} osm_counter;
+
+// all times are in nanoseconds per operation
+typedef struct osm_result {
+  double median;
+  double mean;
+  double stddev;
+  double min;
+  double max;
+  double p90;
+  double p99;
+  double ci_low;      // 95% confidence interval of the median
+  double ci_high;
+  unsigned int repetitions;
+  unsigned int iterations; // operations per repetition
+  // mean count per operation over the measured repetitions (minus the timing loop), valid only if
+  // counters_valid is set - counters are off by default and may not be available (e.g. inside a VM)
+  double counters[OSM_NUM_COUNTERS];
+  bool counters_valid[OSM_NUM_COUNTERS];
+} osm_result;
+
+/**
+ * A measured kernel runs the operation exactly `iterations` times
+ */
+typedef void (*osm_kernel)(unsigned int iterations, void *arg);
+
+/**
+ * Set the number of measured repetitions and of discarded warmup repetitions
+ * (defaults: 31 and 3). returns -1 if repetitions is 0
+ */
+int osm_set_repetitions(unsigned int repetitions, unsigned int warmup);
+
+/**
+ * Enable or disable the collection of counters by every measurement (disabled by default).
+ * returns the number of counters which can be opened on this machine (0 if none)
+ */
+int osm_set_counters(bool enabled);
+
+/**
+ * Returns the name of counter
+ */
+const char *osm_counter_name(osm_counter counter);
+
+/**
+ * Measure kernel: run it repetitions times (after the warmup) with CLOCK_MONOTONIC_RAW,
+ * subtract the cost of the timing loop measured with baseline (may be nullptr),
+ * and fill result with the statistics of the time per operation.
+ * returns 0 on success, -1 on failure
+ */
+int osm_measure(osm_kernel kernel, osm_kernel baseline, void *arg,
+                unsigned int iterations, osm_result *result);
+
+/**
+ * A measurement with full statistics, e.g. osm_syscall_stats
+ */
+typedef int (*osm_stats_function)(unsigned int iterations, osm_result *result);
+
+/**
+ * Run the same measurement at once on num_cpus threads, thread i pinned to cpus[i]
+ * (if cpus is nullptr, the first num_cpus cpus the caller may run on).
+ * per_thread (num_cpus results) is filled with the result of every thread, and aggregate_ops_per_sec
+ * (may be nullptr) with the sum of the throughput of the threads (by their median time per operation).
+ * returns 0 on success, -1 if any of the threads failed
+ */
+int osm_parallel_stats(osm_stats_function stats, unsigned int iterations, const int *cpus,
+                       unsigned int num_cpus, osm_result *per_thread, double *aggregate_ops_per_sec);
+
+/// osm_*_time with full statistics, return 0 on success, -1 on failure ///
+int osm_operation_stats(unsigned int iterations, osm_result *result);
+int osm_function_stats(unsigned int iterations, osm_result *result);
+int osm_syscall_stats(unsigned int iterations, osm_result *result);
+
+
+/// System costs (osm_system.cpp) ///
+// every measurement has an osm_*_stats function and an osm_*_time wrapper which returns the median
+// time per operation in nanoseconds, or -1 on failure
+
+// context switch between two threads / processes pinned to the same cpu (pipe ping-pong)
+int osm_thread_switch_stats(unsigned int iterations, osm_result *result);
+int osm_process_switch_stats(unsigned int iterations, osm_result *result);
+double osm_thread_switch_time(unsigned int iterations);
+double osm_process_switch_time(unsigned int iterations);
+
+// first touch of an anonymous page / of a file page which is not in the page cache
+int osm_minor_fault_stats(unsigned int iterations, osm_result *result);
+int osm_major_fault_stats(unsigned int iterations, osm_result *result);
+double osm_minor_fault_time(unsigned int iterations);
+double osm_major_fault_time(unsigned int iterations);
+
+// lock + unlock of a pthread mutex, alone or against another thread, and a FUTEX_WAKE system call
+int osm_mutex_stats(unsigned int iterations, osm_result *result);
+int osm_contended_mutex_stats(unsigned int iterations, osm_result *result);
+int osm_futex_wake_stats(unsigned int iterations, osm_result *result);
+double osm_mutex_time(unsigned int iterations);
+double osm_contended_mutex_time(unsigned int iterations);
+double osm_futex_wake_time(unsigned int iterations);
+
+// creating a thread (clone) / process (fork, fork + exec of /bin/true) and waiting for it
+int osm_thread_create_stats(unsigned int iterations, osm_result *result);
+int osm_fork_stats(unsigned int iterations, osm_result *result);
+int osm_fork_exec_stats(unsigned int iterations, osm_result *result);
+double osm_thread_create_time(unsigned int iterations);
+double osm_fork_time(unsigned int iterations);
+double osm_fork_exec_time(unsigned int iterations);
+
+// latency of a dependent load, with a working set of bytes / that fits in the cache at level (1-3, 4 is DRAM)
+int osm_memory_latency_stats(unsigned int iterations, size_t bytes, osm_result *result);
+int osm_cache_latency_stats(unsigned int iterations, int level, osm_result *result);
+double osm_cache_latency_time(unsigned int iterations, int level);
+
+// atomic increment of a counter private to the thread / shared by all the threads (shows cache line
+// bouncing when run with osm_parallel_stats)
+int osm_atomic_stats(unsigned int iterations, osm_result *result);
+int osm_shared_atomic_stats(unsigned int iterations, osm_result *result);
+double osm_atomic_time(unsigned int iterations);
+double osm_shared_atomic_time(unsigned int iterations);
+
+// time to read one 64 byte cache line, streaming over a buffer of bytes (bandwidth is 64 / time GB/s)
+int osm_memory_bandwidth_stats(unsigned int iterations, size_t bytes, osm_result *result);
+double osm_memory_bandwidth_time(unsigned int iterations, size_t bytes);
+
+#endif //_OSM_EXT_H
@@ -0,0 +1,599 @@
+#include "osm_ext.h"
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#define FUNC_ERROR -1
+#define CACHE_LINE 64
+#define DRAM_WORKING_SET (256 * 1024 * 1024)
+#define DEFAULT_CACHE_SIZE (32 * 1024)
+#define EXEC_PATH "/bin/true"
+#define EXEC_FAILED 127 // the exit status of a child whose exec failed, as in the shell
+#define FAULT_FILE_TEMPLATE "osm_fault_file.XXXXXX"
+
+/// Optimization barriers (see osm.cpp) ///
+#define OSM_KEEP(VALUE) asm volatile ("" : "+r" (VALUE))
+#define OSM_CLOBBER() asm volatile ("" : : : "memory")
+
+
+/// Helpers ///
+
+/**
+ * Write / read a single byte, returns false on failure
+ */
+bool write_byte(int fd)
+{
+  char byte = 0;
+  return write(fd, &byte, 1) == 1;
+}
+
+bool read_byte(int fd)
+{
+  char byte;
+  return read(fd, &byte, 1) == 1;
+}
+
+/**
+ * Ping-pong partner: echo every byte from readFd to writeFd until readFd is closed
+ */
+void echo_loop(int readFd, int writeFd)
+{
+  while (read_byte(readFd) && write_byte(writeFd))
+    ;
+}
+
+typedef struct ping_pong {
+  int toPartner[2];
+  int fromPartner[2];
+} ping_pong;
+
+void *echo_thread(void *arg)
+{
+  auto pipes = (ping_pong *) arg;
+  echo_loop(pipes->toPartner[0], pipes->fromPartner[1]);
+  return nullptr;
+}
+
+void close_pipes(ping_pong *pipes)
+{
+  close(pipes->toPartner[0]);
+  close(pipes->toPartner[1]);
+  close(pipes->fromPartner[0]);
+  close(pipes->fromPartner[1]);
+}
+
+/**
+ * Pin the calling thread to cpu, saving its previous affinity in previous.
+ * fails without pinning when cpu is out of range, e.g. the -1 of a failed sched_getcpu (errno is kept)
+ */
+int pin_to_cpu(int cpu, cpu_set_t *previous)
+{
+  if (cpu < 0 || cpu >= CPU_SETSIZE)
+    return FUNC_ERROR;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (previous != nullptr && sched_getaffinity(0, sizeof(cpu_set_t), previous) == FUNC_ERROR)
+    return FUNC_ERROR;
+  return sched_setaffinity(0, sizeof(cpu_set_t), &set);
+}
+
+
+/// Context switch ///
+// one operation is one switch, a round trip through the pipes is two switches.
+// both sides are pinned to the same cpu so every message forces a switch
+
+void ping_pong_kernel(unsigned int iterations, void *arg)
+{
+  auto pipes = (ping_pong *) arg;
+  for (unsigned int i = 0; i < iterations; i += 2)
+    {
+      write_byte(pipes->toPartner[1]);
+      read_byte(pipes->fromPartner[0]);
+    }
+}
+
+int osm_thread_switch_stats(unsigned int iterations, osm_result *result)
+{
+  ping_pong pipes{};
+  cpu_set_t previous;
+  if (iterations == 0 || pipe(pipes.toPartner) == FUNC_ERROR)
+    return FUNC_ERROR;
+  if (pipe(pipes.fromPartner) == FUNC_ERROR)
+    {
+      close(pipes.toPartner[0]);
+      close(pipes.toPartner[1]);
+      return FUNC_ERROR;
+    }
+
+  // the partner thread inherits the affinity of its creator
+  int cpu = sched_getcpu();
+  pthread_t partner;
+  if (pin_to_cpu(cpu, &previous) == FUNC_ERROR)
+    {
+      close_pipes(&pipes);
+      return FUNC_ERROR;
+    }
+  if (pthread_create(&partner, nullptr, echo_thread, &pipes))
+    {
+      sched_setaffinity(0, sizeof(cpu_set_t), &previous);
+      close_pipes(&pipes);
+      return FUNC_ERROR;
+    }
+
+  int ret = osm_measure(ping_pong_kernel, nullptr, &pipes, iterations + iterations % 2, result);
+
+  close(pipes.toPartner[1]);
+  pthread_join(partner, nullptr);
+  close(pipes.toPartner[0]);
+  close(pipes.fromPartner[0]);
+  close(pipes.fromPartner[1]);
+  sched_setaffinity(0, sizeof(cpu_set_t), &previous);
+  return ret;
+}
+
+int osm_process_switch_stats(unsigned int iterations, osm_result *result)
+{
+  ping_pong pipes{};
+  cpu_set_t previous;
+  if (iterations == 0 || pipe(pipes.toPartner) == FUNC_ERROR)
+    return FUNC_ERROR;
+  if (pipe(pipes.fromPartner) == FUNC_ERROR)
+    {
+      close(pipes.toPartner[0]);
+      close(pipes.toPartner[1]);
+      return FUNC_ERROR;
+    }
+
+  int cpu = sched_getcpu();
+  pid_t partner = -1;
+  if (pin_to_cpu(cpu, &previous) == FUNC_ERROR)
+    {
+      close_pipes(&pipes);
+      return FUNC_ERROR;
+    }
+  if ((partner = fork()) == FUNC_ERROR)
+    {
+      sched_setaffinity(0, sizeof(cpu_set_t), &previous);
+      close_pipes(&pipes);
+      return FUNC_ERROR;
+    }
+  if (partner == 0)
+    {
+      close(pipes.toPartner[1]);
+      close(pipes.fromPartner[0]);
+      echo_loop(pipes.toPartner[0], pipes.fromPartner[1]);
+      _exit(EXIT_SUCCESS);
+    }
+  close(pipes.toPartner[0]);
+  close(pipes.fromPartner[1]);
+
+  int ret = osm_measure(ping_pong_kernel, nullptr, &pipes, iterations + iterations % 2, result);
+
+  close(pipes.toPartner[1]);
+  close(pipes.fromPartner[0]);
+  waitpid(partner, nullptr, 0);
+  sched_setaffinity(0, sizeof(cpu_set_t), &previous);
+  return ret;
+}
+
+
+/// Page faults ///
+// one operation is one fault, the baseline maps and unmaps the same region without touching it
+
+typedef struct fault_region {
+  int fd;           // FUNC_ERROR for anonymous memory
+  long pageSize;
+} fault_region;
+
+/**
+ * Map iterations pages, touch them if touch is set and unmap them
+ */
+void fault_pages(unsigned int iterations, fault_region *region, bool touch)
+{
+  size_t length = (size_t) iterations * region->pageSize;
+  char *memory;
+  if (region->fd == FUNC_ERROR)
+    memory = (char *) mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  else
+    {
+      // drop the file from the page cache so every touch reads from the disk
+      posix_fadvise(region->fd, 0, length, POSIX_FADV_DONTNEED);
+      memory = (char *) mmap(nullptr, length, PROT_READ, MAP_SHARED, region->fd, 0);
+    }
+  if (memory == MAP_FAILED)
+    return;
+  if (region->fd != FUNC_ERROR)
+    madvise(memory, length, MADV_RANDOM); // no read-ahead, one fault reads one page
+
+  if (touch)
+    {
+      char sum = 0;
+      for (size_t offset = 0; offset < length; offset += region->pageSize)
+        {
+          if (region->fd == FUNC_ERROR)
+            memory[offset] = 1;
+          else
+            sum += ((volatile char *) memory)[offset];
+        }
+      OSM_KEEP(sum);
+    }
+  munmap(memory, length);
+}
+
+void touch_kernel(unsigned int iterations, void *arg)
+{
+  fault_pages(iterations, (fault_region *) arg, true);
+}
+
+void map_kernel(unsigned int iterations, void *arg)
+{
+  fault_pages(iterations, (fault_region *) arg, false);
+}
+
+int osm_minor_fault_stats(unsigned int iterations, osm_result *result)
+{
+  if (iterations == 0)
+    return FUNC_ERROR;
+  fault_region region = {FUNC_ERROR, sysconf(_SC_PAGESIZE)};
+  return osm_measure(touch_kernel, map_kernel, &region, iterations, result);
+}
+
+int osm_major_fault_stats(unsigned int iterations, osm_result *result)
+{
+  if (iterations == 0)
+    return FUNC_ERROR;
+
+  // the file is created in the working directory, a tmpfs /tmp would never fault from disk
+  char path[] = FAULT_FILE_TEMPLATE;
+  fault_region region = {mkstemp(path), sysconf(_SC_PAGESIZE)};
+  if (region.fd == FUNC_ERROR)
+    return FUNC_ERROR;
+  unlink(path);
+
+  std::vector<char> page(region.pageSize, 1);
+  int ret = 0;
+  for (unsigned int i = 0; i < iterations && ret == 0; i++)
+    {
+      if (write(region.fd, page.data(), page.size()) != (ssize_t) page.size())
+        ret = FUNC_ERROR;
+    }
+  if (ret == 0 && fsync(region.fd) == FUNC_ERROR)
+    ret = FUNC_ERROR;
+  if (ret == 0)
+    ret = osm_measure(touch_kernel, map_kernel, &region, iterations, result);
+
+  close(region.fd);
+  return ret;
+}
+
+
+/// Mutex and futex ///
+// one operation is one lock and unlock
+
+typedef struct contention {
+  pthread_mutex_t mutex;
+  std::atomic<bool> stop;
+} contention;
+
+void mutex_kernel(unsigned int iterations, void *arg)
+{
+  auto mutex = (pthread_mutex_t *) arg;
+  for (unsigned int i = 0; i < iterations; i++)
+    {
+      pthread_mutex_lock(mutex);
+      OSM_CLOBBER();
+      pthread_mutex_unlock(mutex);
+    }
+}
+
+void *contending_thread(void *arg)
+{
+  auto state = (contention *) arg;
+  while (!state->stop.load(std::memory_order_relaxed))
+    {
+      pthread_mutex_lock(&state->mutex);
+      OSM_CLOBBER();
+      pthread_mutex_unlock(&state->mutex);
+    }
+  return nullptr;
+}
+
+void futex_wake_kernel(unsigned int iterations, void *arg)
+{
+  auto word = (int *) arg;
+  for (unsigned int i = 0; i < iterations; i++)
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+int osm_mutex_stats(unsigned int iterations, osm_result *result)
+{
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  if (iterations == 0)
+    return FUNC_ERROR;
+  int ret = osm_measure(mutex_kernel, nullptr, &mutex, iterations, result);
+  pthread_mutex_destroy(&mutex);
+  return ret;
+}
+
+int osm_contended_mutex_stats(unsigned int iterations, osm_result *result)
+{
+  if (iterations == 0)
+    return FUNC_ERROR;
+
+  contention state;
+  state.stop = false;
+  if (pthread_mutex_init(&state.mutex, nullptr))
+    return FUNC_ERROR;
+  pthread_t other;
+  if (pthread_create(&other, nullptr, contending_thread, &state))
+    {
+      pthread_mutex_destroy(&state.mutex);
+      return FUNC_ERROR;
+    }
+
+  int ret = osm_measure(mutex_kernel, nullptr, &state.mutex, iterations, result);
+
+  state.stop = true;
+  pthread_join(other, nullptr);
+  pthread_mutex_destroy(&state.mutex);
+  return ret;
+}
+
+int osm_futex_wake_stats(unsigned int iterations, osm_result *result)
+{
+  int word = 0;
+  if (iterations == 0)
+    return FUNC_ERROR;
+  return osm_measure(futex_wake_kernel, nullptr, &word, iterations, result);
+}
+
+
+/// Atomic counters ///
+// one operation is one atomic increment
+
+std::atomic<uint64_t> sharedCounter(0);
+
+void atomic_kernel(unsigned int iterations, void *arg)
+{
+  auto counter = (std::atomic<uint64_t> *) arg;
+  for (unsigned int i = 0; i < iterations; i++)
+    counter->fetch_add(1);
+}
+
+int osm_atomic_stats(unsigned int iterations, osm_result *result)
+{
+  // aligned to its own cache line so counters of different threads never share one
+  alignas(CACHE_LINE) std::atomic<uint64_t> counter(0);
+  if (iterations == 0)
+    return FUNC_ERROR;
+  return osm_measure(atomic_kernel, nullptr, &counter, iterations, result);
+}
+
+int osm_shared_atomic_stats(unsigned int iterations, osm_result *result)
+{
+  if (iterations == 0)
+    return FUNC_ERROR;
+  return osm_measure(atomic_kernel, nullptr, &sharedCounter, iterations, result);
+}
+
+
+/// Thread and process creation ///
+// one operation is one creation of a thread / process and waiting for it to exit
+
+void *exit_thread(void *arg)
+{
+  return nullptr;
+}
+
+void thread_create_kernel(unsigned int iterations, void *arg)
+{
+  pthread_t thread;
+  for (unsigned int i = 0; i < iterations; i++)
+    {
+      if (pthread_create(&thread, nullptr, exit_thread, nullptr) == 0)
+        pthread_join(thread, nullptr);
+    }
+}
+
+typedef struct fork_run {
+  bool exec;    // the child execs EXEC_PATH
+  bool failed;  // a fork failed or a child did not exit with 0 (e.g. its exec failed)
+} fork_run;
+
+void fork_kernel(unsigned int iterations, void *arg)
+{
+  auto run = (fork_run *) arg;
+  for (unsigned int i = 0; i < iterations; i++)
+    {
+      pid_t pid = fork();
+      if (pid == 0)
+        {
+          if (run->exec)
+            execl(EXEC_PATH, EXEC_PATH, (char *) nullptr);
+          _exit(run->exec ? EXEC_FAILED : EXIT_SUCCESS);
+        }
+      int status;
+      if (pid == FUNC_ERROR || waitpid(pid, &status, 0) == FUNC_ERROR || !WIFEXITED(status) ||
+          WEXITSTATUS(status) != EXIT_SUCCESS)
+        {
+          run->failed = true;
+          return;
+        }
+    }
+}
+
+int osm_thread_create_stats(unsigned int iterations, osm_result *result)
+{
+  if (iterations == 0)
+    return FUNC_ERROR;
+  return osm_measure(thread_create_kernel, nullptr, nullptr, iterations, result);
+}
+
+int osm_fork_stats(unsigned int iterations, osm_result *result)
+{
+  fork_run run = {false, false};
+  if (iterations == 0)
+    return FUNC_ERROR;
+  int ret = osm_measure(fork_kernel, nullptr, &run, iterations, result);
+  return run.failed ? FUNC_ERROR : ret;
+}
+
+int osm_fork_exec_stats(unsigned int iterations, osm_result *result)
+{
+  fork_run run = {true, false};
+  if (iterations == 0)
+    return FUNC_ERROR;
+  int ret = osm_measure(fork_kernel, nullptr, &run, iterations, result);
+  return run.failed ? FUNC_ERROR : ret;
+}
+
+
+/// Memory ///
+
+/**
+ * Returns the size in bytes of the data cache at level (1-3) or a size that only fits in DRAM (level 4)
+ */
+size_t working_set_for_level(int level)
+{
+  long size = 0;
+  if (level == 1)
+    size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+  else if (level == 2)
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  else if (level == 3)
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  else
+    return DRAM_WORKING_SET;
+
+  // half of the cache, so the working set is not evicted by the rest of the program
+  if (size <= 0)
+    size = DEFAULT_CACHE_SIZE << (3 * (level - 1));
+  return (size_t) size / 2;
+}
+
+void chase_kernel(unsigned int iterations, void *arg)
+{
+  void **node = (void **) arg;
+  for (unsigned int i = 0; i < iterations; i++)
+    {
+      node = (void **) *node;
+      OSM_KEEP(node);
+    }
+}
+
+int osm_memory_latency_stats(unsigned int iterations, size_t bytes, osm_result *result)
+{
+  size_t nodes = bytes / CACHE_LINE;
+  if (iterations == 0 || nodes < 2)
+    return FUNC_ERROR;
+
+  // one pointer per cache line, linked in a random cycle so the prefetcher can not guess the next line
+  char *memory = (char *) aligned_alloc(CACHE_LINE, nodes * CACHE_LINE);
+  if (memory == nullptr)
+    return FUNC_ERROR;
+  std::vector<size_t> order(nodes);
+  for (size_t i = 0; i < nodes; i++)
+    order[i] = i;
+  std::shuffle(order.begin() + 1, order.end(), std::mt19937_64(nodes));
+  for (size_t i = 0; i < nodes; i++)
+    *(void **) (memory + order[i] * CACHE_LINE) = memory + order[(i + 1) % nodes] * CACHE_LINE;
+
+  int ret = osm_measure(chase_kernel, nullptr, memory, iterations, result);
+  free(memory);
+  return ret;
+}
+
+int osm_cache_latency_stats(unsigned int iterations, int level, osm_result *result)
+{
+  if (level < 1 || level > 4)
+    return FUNC_ERROR;
+  return osm_memory_latency_stats(iterations, working_set_for_level(level), result);
+}
+
+typedef struct bandwidth_buffer {
+  uint64_t *words;
+  size_t lines;
+} bandwidth_buffer;
+
+void bandwidth_kernel(unsigned int iterations, void *arg)
+{
+  auto buffer = (bandwidth_buffer *) arg;
+  const size_t wordsPerLine = CACHE_LINE / sizeof(uint64_t);
+  uint64_t sum = 0;
+  size_t line = 0;
+  for (unsigned int i = 0; i < iterations; i++)
+    {
+      const uint64_t *words = buffer->words + line * wordsPerLine;
+      for (size_t j = 0; j < wordsPerLine; j++)
+        sum += words[j];
+      line = (line + 1 == buffer->lines) ? 0 : line + 1;
+    }
+  OSM_KEEP(sum);
+}
+
+int osm_memory_bandwidth_stats(unsigned int iterations, size_t bytes, osm_result *result)
+{
+  bandwidth_buffer buffer = {nullptr, bytes / CACHE_LINE};
+  if (iterations == 0 || buffer.lines == 0)
+    return FUNC_ERROR;
+  buffer.words = (uint64_t *) aligned_alloc(CACHE_LINE, buffer.lines * CACHE_LINE);
+  if (buffer.words == nullptr)
+    return FUNC_ERROR;
+  std::fill(buffer.words, buffer.words + buffer.lines * CACHE_LINE / sizeof(uint64_t), 1);
+
+  int ret = osm_measure(bandwidth_kernel, nullptr, &buffer, iterations, result);
+  free(buffer.words);
+  return ret;
+}
+
+
+/// osm_*_time wrappers - the median time per operation in nanoseconds, or -1 ///
+
+#define OSM_TIME_WRAPPER(NAME)                                   \
+  double osm_##NAME##_time(unsigned int iterations)              \
+  {                                                              \
+    osm_result result{};                                         \
+    if (osm_##NAME##_stats(iterations, &result) == FUNC_ERROR)   \
+      return FUNC_ERROR;                                         \
+    return result.median;                                        \
+  }
+
+OSM_TIME_WRAPPER(thread_switch)
+OSM_TIME_WRAPPER(process_switch)
+OSM_TIME_WRAPPER(minor_fault)
+OSM_TIME_WRAPPER(major_fault)
+OSM_TIME_WRAPPER(mutex)
+OSM_TIME_WRAPPER(contended_mutex)
+OSM_TIME_WRAPPER(futex_wake)
+OSM_TIME_WRAPPER(atomic)
+OSM_TIME_WRAPPER(shared_atomic)
+OSM_TIME_WRAPPER(thread_create)
+OSM_TIME_WRAPPER(fork)
+OSM_TIME_WRAPPER(fork_exec)
+
+double osm_cache_latency_time(unsigned int iterations, int level)
+{
+  osm_result result{};
+  if (osm_cache_latency_stats(iterations, level, &result) == FUNC_ERROR)
+    return FUNC_ERROR;
+  return result.median;
+}
+
+double osm_memory_bandwidth_time(unsigned int iterations, size_t bytes)
+{
+  osm_result result{};
+  if (osm_memory_bandwidth_stats(iterations, bytes, &result) == FUNC_ERROR)
+    return FUNC_ERROR;
+  return result.median;
+}
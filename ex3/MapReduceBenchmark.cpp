@@ -0,0 +1,272 @@
+#include "MapReduceFramework.h"
+#include "MapReduceFrameworkExt.h"
+#include "MapReduceJob.h"
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+/// Usage ///
+#define USAGE "usage: MapReduceBenchmark [-n records] [-e emits per record] [-k keys] [-t threads] [-r seed]"
+
+/// Defaults ///
+#define DEFAULT_RECORDS 200000
+#define DEFAULT_EMITS 8
+#define DEFAULT_KEYS 10000
+#define DEFAULT_THREADS 4
+#define DEFAULT_SEED 1
+#define KEY_MIXER 0x9E3779B97F4A7C15ULL
+
+/// Error MSG ///
+#define RESULT_ERR_MSG "MapReduceBenchmark error: the jobs computed different results"
+
+// the job: every record is a number, map emits (key, 1) for emits keys derived from it and reduce counts
+// the pairs of every key
+
+typedef struct BenchmarkConfig {
+    uint64_t records = DEFAULT_RECORDS;
+    int emits = DEFAULT_EMITS;
+    uint64_t keys = DEFAULT_KEYS;
+    int threads = DEFAULT_THREADS;
+    unsigned int seed = DEFAULT_SEED;
+} BenchmarkConfig;
+
+/**
+ * The j'th key emitted for record
+ */
+uint64_t RecordKey(uint64_t record, int j, uint64_t keys)
+{
+    return ((record + j) * KEY_MIXER >> 17) % keys;
+}
+
+
+/// MapReduceClient.h job ///
+
+class Number : public K1, public V1, public K2, public V2, public K3, public V3 {
+public:
+    explicit Number(uint64_t givenValue) : value(givenValue)
+    {}
+
+    bool operator<(const K1& other) const override
+    {
+        return value < static_cast<const Number&>(other).value;
+    }
+
+    bool operator<(const K2& other) const override
+    {
+        return value < static_cast<const Number&>(other).value;
+    }
+
+    bool operator<(const K3& other) const override
+    {
+        return value < static_cast<const Number&>(other).value;
+    }
+
+    uint64_t value;
+};
+
+size_t NumberHash(const K2* key)
+{
+    return std::hash<uint64_t>()(static_cast<const Number*>(key)->value);
+}
+
+bool NumberEqual(const K2* key1, const K2* key2)
+{
+    return static_cast<const Number*>(key1)->value == static_cast<const Number*>(key2)->value;
+}
+
+class CountClient : public MapReduceClient {
+public:
+    CountClient(int givenEmits, uint64_t givenKeys) : emits(givenEmits), keys(givenKeys)
+    {}
+
+    void map(const K1*, const V1* value, void* context) const override
+    {
+        uint64_t record = static_cast<const Number*>(value)->value;
+        for (int j = 0 ; j < emits ; j++)
+            emit2(new Number(RecordKey(record, j, keys)), new Number(1), context);
+    }
+
+    void reduce(const IntermediateVec* pairs, void* context) const override
+    {
+        uint64_t key = static_cast<const Number*>(pairs->at(0).first)->value, count = 0;
+        for (const IntermediatePair& pair : *pairs)
+        {
+            count += static_cast<const Number*>(pair.second)->value;
+            delete pair.first;
+            delete pair.second;
+        }
+        emit3(new Number(key), new Number(count), context);
+    }
+
+private:
+    int emits;
+    uint64_t keys;
+};
+
+
+/// MapReduceJob.h job ///
+
+struct CountMapper {
+    typedef uint64_t InputKey;
+    typedef uint64_t InputValue;
+    typedef uint64_t IntermediateKey;
+    typedef uint64_t IntermediateValue;
+
+    int emits;
+    uint64_t keys;
+
+    void operator()(const uint64_t&, const uint64_t& record, PairEmitter<uint64_t, uint64_t>& emit) const
+    {
+        for (int j = 0 ; j < emits ; j++)
+            emit(RecordKey(record, j, keys), (uint64_t) 1);
+    }
+};
+
+struct CountReducer {
+    typedef uint64_t OutputKey;
+    typedef uint64_t OutputValue;
+
+    void operator()(const std::pair<uint64_t, uint64_t>* begin, const std::pair<uint64_t, uint64_t>* end,
+                    PairEmitter<uint64_t, uint64_t>& emit) const
+    {
+        uint64_t count = 0;
+        for (const std::pair<uint64_t, uint64_t>* pair = begin ; pair != end ; pair++)
+            count += pair->second;
+        emit(begin->first, count);
+    }
+};
+
+typedef HashGrouping<std::hash<uint64_t>, std::equal_to<uint64_t>> CountHashGrouping;
+
+
+/**
+ * Run the job through startMapReduceJob (or startHashedMapReduceJob), returns the wall time in ms and fills
+ * counts (per key)
+ */
+double RunClientJob(const BenchmarkConfig& config, const std::vector<uint64_t>& records,
+                    std::vector<uint64_t>& counts, bool hashed)
+{
+    auto start = std::chrono::steady_clock::now();
+    CountClient client(config.emits, config.keys);
+    InputVec inputVec;
+    inputVec.reserve(records.size());
+    for (uint64_t record : records)
+        inputVec.push_back(InputPair(nullptr, new Number(record)));
+    OutputVec outputVec;
+
+    JobHandle job = hashed ? startHashedMapReduceJob(client, NumberHash, NumberEqual, inputVec, outputVec,
+                                                     config.threads)
+                           : startMapReduceJob(client, inputVec, outputVec, config.threads);
+    closeJobHandle(job);
+
+    for (OutputPair& pair : outputVec)
+    {
+        counts[static_cast<Number*>(pair.first)->value] = static_cast<Number*>(pair.second)->value;
+        delete pair.first;
+        delete pair.second;
+    }
+    for (InputPair& pair : inputVec)
+        delete pair.second;
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Run the job as a MapReduceJob grouped by Grouping, returns the wall time in ms and fills counts (per key)
+ */
+template <class Grouping>
+double RunTypedJob(const BenchmarkConfig& config, const std::vector<uint64_t>& records,
+                   std::vector<uint64_t>& counts)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::pair<uint64_t, uint64_t>> input;
+    input.reserve(records.size());
+    for (uint64_t i = 0 ; i < records.size() ; i++)
+        input.push_back(std::make_pair(i, records[i]));
+    std::vector<std::pair<uint64_t, uint64_t>> output;
+    {
+        MapReduceJob<CountMapper, CountReducer, Grouping> job(CountMapper{config.emits, config.keys},
+                                                              CountReducer(), input, output, config.threads);
+    }
+
+    for (const std::pair<uint64_t, uint64_t>& pair : output)
+        counts[pair.first] = pair.second;
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Start the job as a MapReduceJob grouped by Grouping and cancel it after delayMs, returns the time in ms from
+ * the cancellation until the job's threads are done
+ */
+template <class Grouping>
+double CancelTypedJob(const BenchmarkConfig& config, const std::vector<uint64_t>& records, double delayMs)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> input;
+    input.reserve(records.size());
+    for (uint64_t i = 0 ; i < records.size() ; i++)
+        input.push_back(std::make_pair(i, records[i]));
+    std::vector<std::pair<uint64_t, uint64_t>> output;
+
+    MapReduceJob<CountMapper, CountReducer, Grouping> job(CountMapper{config.emits, config.keys}, CountReducer(),
+                                                          input, output, config.threads);
+    usleep((useconds_t) (delayMs * 1000));
+    auto start = std::chrono::steady_clock::now();
+    job.Cancel();
+    job.Wait();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+int main(int argc, char* argv[])
+{
+    BenchmarkConfig config;
+    int option;
+    while ((option = getopt(argc, argv, "n:e:k:t:r:")) != -1)
+    {
+        switch (option)
+        {
+            case 'n': config.records = strtoull(optarg, nullptr, 10); break;
+            case 'e': config.emits = std::max(1, atoi(optarg)); break;
+            case 'k': config.keys = std::max(1ULL, strtoull(optarg, nullptr, 10)); break;
+            case 't': config.threads = std::max(1, atoi(optarg)); break;
+            case 'r': config.seed = (unsigned int) atoi(optarg); break;
+            default:
+                std::cerr << USAGE << std::endl;
+                return EXIT_FAILURE;
+        }
+    }
+
+    std::mt19937_64 rng(config.seed);
+    std::vector<uint64_t> records(config.records);
+    for (uint64_t& record : records)
+        record = rng();
+
+    std::vector<uint64_t> clientCounts(config.keys, 0), clientHashCounts(config.keys, 0);
+    std::vector<uint64_t> typedCounts(config.keys, 0), typedHashCounts(config.keys, 0);
+    double clientMs = RunClientJob(config, records, clientCounts, false);
+    double clientHashMs = RunClientJob(config, records, clientHashCounts, true);
+    double typedMs = RunTypedJob<SortedGrouping<std::less<uint64_t>>>(config, records, typedCounts);
+    double typedHashMs = RunTypedJob<CountHashGrouping>(config, records, typedHashCounts);
+    if (clientCounts != typedCounts || clientHashCounts != typedCounts || typedHashCounts != typedCounts)
+    {
+        std::cerr << RESULT_ERR_MSG << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // cancelled half way through
+    double cancelMs = CancelTypedJob<SortedGrouping<std::less<uint64_t>>>(config, records, typedMs / 2);
+    double cancelHashMs = CancelTypedJob<CountHashGrouping>(config, records, typedHashMs / 2);
+
+    double pairs = (double) config.records * config.emits;
+    printf("records=%lu pairs=%.0f keys=%lu threads=%d client_ms=%.1f client_hash_ms=%.1f typed_ms=%.1f "
+           "typed_hash_ms=%.1f client_ns_per_pair=%.1f typed_ns_per_pair=%.1f typed_hash_ns_per_pair=%.1f "
+           "speedup=%.2f cancel_ms=%.2f cancel_hash_ms=%.2f\n",
+           (unsigned long) config.records, pairs, (unsigned long) config.keys, config.threads, clientMs,
+           clientHashMs, typedMs, typedHashMs, clientMs * 1e6 / pairs, typedMs * 1e6 / pairs,
+           typedHashMs * 1e6 / pairs, clientMs / typedMs, cancelMs, cancelHashMs);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef MAPREDUCEFRAMEWORKEXT_H
+#define MAPREDUCEFRAMEWORKEXT_H
+
+#include "MapReduceFramework.h"
+#include <cstddef>
+
+/// Extensions to the MapReduceFramework API ///
+
+typedef size_t (*K2Hash)(const K2* key);
+typedef bool (*K2Equal)(const K2* key1, const K2* key2);
+typedef void (*IntermediateRelease)(K2* key, V2* value);
+
+/**
+ * Like startMapReduceJob, but intermediate pairs are grouped by hash instead of sorting: keys with equal hash
+ * and equal() are one group. reduce gets the groups in no particular order, and K2's operator< is never called.
+ * getJobState, waitForJob and closeJobHandle work on the returned job as usual. release is as in
+ * startReleasingMapReduceJob.
+ */
+JobHandle startHashedMapReduceJob(const MapReduceClient& client, K2Hash hash, K2Equal equal,
+                                  const InputVec& inputVec, OutputVec& outputVec, int multiThreadLevel,
+                                  IntermediateRelease release = nullptr);
+/**
+ * Like startMapReduceJob, but if the job is cancelled every intermediate pair it drops without reducing is passed
+ * to release, e.g. to delete the key and value which were given to emit2. Jobs started without a release leave
+ * the dropped pairs to the client.
+ */
+JobHandle startReleasingMapReduceJob(const MapReduceClient& client, IntermediateRelease release,
+                                     const InputVec& inputVec, OutputVec& outputVec, int multiThreadLevel);
+/**
+ * Stop job as soon as possible, from any thread: the job's threads stop mapping, shuffling or reducing within an
+ * input pair, a group or a few thousand intermediate pairs. Pairs that were emitted but not reduced yet are
+ * dropped without being passed to reduce, and to the job's release if it has one. outputVec gets the pairs
+ * emitted by the reduce calls which completed, so a job cancelled during the reduce phase returns partial output.
+ * Has no effect once the job is done. waitForJob and closeJobHandle must still be called, they return as soon as
+ * the threads stop.
+ */
+void cancelJob(JobHandle job);
+
+#endif //MAPREDUCEFRAMEWORKEXT_H
@@ -0,0 +1,788 @@
+#ifndef MAP_REDUCE_JOB_H
+#define MAP_REDUCE_JOB_H
+
+/// INCLUDE ///
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "MapReduceFramework.h"
+
+/// System Error MSG
+#define JOB_PTHREAD_CREATE_ERR_MSG "system error: system failed to create pthread"
+#define JOB_PTHREAD_JOIN_ERR_MSG "system error: system failed to join pthread"
+#define JOB_MUTEX_LOCK_ERR_MSG "system error: system failed to lock mutex"
+#define JOB_MUTEX_UNLOCK_ERR_MSG "system error: system failed to unlock mutex"
+#define JOB_COND_ERR_MSG "system error: system failed to use condition variable"
+
+/// Hash Grouping Constants
+#define HASH_MIXER 0x9E3779B97F4A7C15ULL // spreads client hashes (e.g. the identity of std::hash) over all the bits
+#define MIN_TABLE_BITS 4
+#define MIN_TABLE_SLOTS (1 << MIN_TABLE_BITS)
+
+/// Cancellation
+#define CANCEL_CHECK_PAIRS 4096 // loops over intermediate pairs check for cancellation once per this many pairs
+#define SORT_RUN_PAIRS (1 << 16) // pairs are sorted in runs of this many pairs, merged by one thread
+#define SORT_BLOCK_PAIRS (1 << 13) // a run is sorted in blocks of this many pairs (about 1ms), merged in place
+
+
+/**
+ * Appends the pairs emitted by one thread to its vector, keys and values are stored by value
+ */
+template <class Key, class Value>
+class PairEmitter
+{
+public:
+    explicit PairEmitter(std::vector<std::pair<Key, Value>>& givenPairs) : pairs(givenPairs)
+    {}
+
+    template <class K, class V>
+    void operator()(K&& key, V&& value)
+    {
+        pairs.emplace_back(std::forward<K>(key), std::forward<V>(value));
+    }
+
+private:
+    std::vector<std::pair<Key, Value>>& pairs;
+};
+
+
+/**
+ * Group intermediate pairs by sorting (the default): every thread sorts its pairs with Compare and one thread
+ * merges them, so the reducer sees the keys in order
+ */
+template <class Compare>
+struct SortedGrouping
+{
+    Compare compare;
+};
+
+/**
+ * Group intermediate pairs by hashing, for reducers which do not need the keys in order: every thread partitions
+ * its pairs by Hash and every partition is grouped by one thread in an open addressing table using Equal, in
+ * linear time and without comparing keys for order
+ */
+template <class Hash, class Equal>
+struct HashGrouping
+{
+    Hash hash;
+    Equal equal;
+};
+
+
+/**
+ * A statically typed MapReduce job: keys and values are stored by value in contiguous vectors, intermediate keys
+ * are grouped by Grouping and the client is called directly, without virtual calls or a heap allocation per
+ * pair. Every thread maps input pairs, the pairs are grouped by key (see SortedGrouping and HashGrouping) and
+ * every thread reduces groups.
+ *
+ * Mapper defines InputKey, InputValue, IntermediateKey, IntermediateValue and
+ *     void operator()(const InputKey&, const InputValue&, PairEmitter<IntermediateKey, IntermediateValue>&) const
+ * Reducer defines OutputKey, OutputValue and
+ *     void operator()(const IntermediatePair* begin, const IntermediatePair* end,
+ *                     PairEmitter<OutputKey, OutputValue>&) const
+ * which gets the pairs [begin, end) of one key.
+ *
+ * The job starts on construction, input and output must outlive it and output is filled when the reduce phase
+ * ends. The destructor waits for the job, Cancel stops it early and passes every intermediate pair it drops
+ * without reducing to releasePair (if given), e.g. to free the pair's key and value.
+ */
+template <class Mapper, class Reducer,
+          class Grouping = SortedGrouping<std::less<typename Mapper::IntermediateKey>>>
+class MapReduceJob
+{
+public:
+    typedef typename Mapper::InputKey InputKey;
+    typedef typename Mapper::InputValue InputValue;
+    typedef typename Mapper::IntermediateKey IntermediateKey;
+    typedef typename Mapper::IntermediateValue IntermediateValue;
+    typedef typename Reducer::OutputKey OutputKey;
+    typedef typename Reducer::OutputValue OutputValue;
+    typedef std::pair<InputKey, InputValue> InputPair;
+    typedef std::pair<IntermediateKey, IntermediateValue> IntermediatePair;
+    typedef std::pair<OutputKey, OutputValue> OutputPair;
+    typedef std::function<void(const IntermediatePair&)> PairRelease;
+
+    MapReduceJob(const Mapper& givenMapper, const Reducer& givenReducer, const std::vector<InputPair>& inputVec,
+                 std::vector<OutputPair>& outputVec, int multiThreadLevel,
+                 const Grouping& givenGrouping = Grouping(), const PairRelease& givenReleasePair = PairRelease()):
+            mapper(givenMapper),
+            reducer(givenReducer),
+            grouping(givenGrouping),
+            releasePair(givenReleasePair),
+            inputVector(inputVec),
+            outputVector(outputVec),
+            threadsContexts(multiThreadLevel),
+            stage(MAP_STAGE),
+            mappingAtomicCounter(0),
+            mappedCounter(0),
+            intermediaryPairsCounter(0),
+            shuffledCounter(0),
+            reducingAtomicCounter(0),
+            reducedCounter(0),
+            cancelled(false),
+            arrivedThreads(0),
+            generation(0),
+            joined(false),
+            phaseMutex(PTHREAD_MUTEX_INITIALIZER),
+            joinMutex(PTHREAD_MUTEX_INITIALIZER),
+            phaseCond(PTHREAD_COND_INITIALIZER)
+    {
+        for (int i = 0 ; i < multiThreadLevel ; i++)
+        {
+            threadsContexts[i].job = this;
+            threadsContexts[i].id = i;
+            if (pthread_create(&threadsContexts[i].thread, nullptr, ThreadStartRoutine, &threadsContexts[i]))
+            {
+                std::cerr << JOB_PTHREAD_CREATE_ERR_MSG << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    MapReduceJob(const MapReduceJob&) = delete;
+    MapReduceJob& operator=(const MapReduceJob&) = delete;
+
+    ~MapReduceJob()
+    {
+        Wait();
+        pthread_cond_destroy(&phaseCond);
+        pthread_mutex_destroy(&phaseMutex);
+        pthread_mutex_destroy(&joinMutex);
+    }
+
+    /**
+     * Block until the job is done, may be called any number of times from any thread
+     */
+    void Wait()
+    {
+        Lock(joinMutex);
+        if (!joined)
+        {
+            for (ThreadContext& threadContext : threadsContexts)
+            {
+                if (pthread_join(threadContext.thread, nullptr))
+                {
+                    std::cerr << JOB_PTHREAD_JOIN_ERR_MSG << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            joined = true;
+        }
+        Unlock(joinMutex);
+    }
+
+    /**
+     * Stop the job as soon as possible, may be called any number of times from any thread. The threads stop at
+     * their next check (every input pair, group or CANCEL_CHECK_PAIRS intermediate pairs) and release all the
+     * intermediate pairs which were not reduced yet, through releasePair. output gets the pairs of the reduce
+     * calls which completed, so a job cancelled during the reduce phase returns partial output. Has no effect
+     * once the output is filled. Wait (or the destructor) still joins the threads.
+     */
+    void Cancel()
+    {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the current stage and the percentage of it which is done
+     */
+    JobState State() const
+    {
+        JobState state;
+        state.stage = stage.load();
+
+        size_t done = mappedCounter, total = inputVector.size();
+        if (state.stage == SHUFFLE_STAGE)
+        {
+            done = shuffledCounter;
+            total = intermediaryPairsCounter;
+        }
+        else if (state.stage == REDUCE_STAGE)
+        {
+            done = reducedCounter;
+            total = intermediaryPairsCounter;
+        }
+        state.percentage = (total == 0) ? 100 : ((float) done / (float) total) * 100;
+        return state;
+    }
+
+private:
+    typedef std::pair<const IntermediatePair*, const IntermediatePair*> Group;
+
+    typedef struct ThreadContext {
+        MapReduceJob* job{};
+        int id{};
+        pthread_t thread{};
+        std::vector<IntermediatePair> intermediatePairs;             // pairs emitted by the thread's map calls
+        std::vector<std::vector<IntermediatePair>> partitionedPairs; // with HashGrouping, by partition
+        std::vector<std::vector<size_t>> partitionedHashes;          // and the mixed hash of every pair
+        std::vector<OutputPair> outputPairs;                         // pairs emitted by the thread's reduce calls
+    } ThreadContext;
+
+    /// a slot of a partition's open addressing table
+    typedef struct TableSlot {
+        size_t hash;
+        size_t group; // group index + 1, 0 for an empty slot
+    } TableSlot;
+
+    /// a sorted run of a thread's intermediatePairs, [head, end) are not merged yet
+    typedef struct SortedRun {
+        IntermediatePair* head;
+        IntermediatePair* end;
+    } SortedRun;
+
+    static void* ThreadStartRoutine(void* arg)
+    {
+        auto threadContext = (ThreadContext*) arg;
+        threadContext->job->Run(*threadContext);
+        return nullptr;
+    }
+
+    static void Lock(pthread_mutex_t& mutex)
+    {
+        if (pthread_mutex_lock(&mutex))
+        {
+            std::cerr << JOB_MUTEX_LOCK_ERR_MSG << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    static void Unlock(pthread_mutex_t& mutex)
+    {
+        if (pthread_mutex_unlock(&mutex))
+        {
+            std::cerr << JOB_MUTEX_UNLOCK_ERR_MSG << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bool Cancelled() const
+    {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Wait until all the threads arrive, the last one to arrive runs lastAction before releasing the others
+     */
+    template <class Action>
+    void SyncThreads(Action lastAction)
+    {
+        Lock(phaseMutex);
+        if (++arrivedThreads == (int) threadsContexts.size())
+        {
+            lastAction();
+            arrivedThreads = 0;
+            generation++;
+            if (pthread_cond_broadcast(&phaseCond))
+            {
+                std::cerr << JOB_COND_ERR_MSG << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        else
+        {
+            for (size_t arrivedGeneration = generation ; arrivedGeneration == generation ; )
+            {
+                if (pthread_cond_wait(&phaseCond, &phaseMutex))
+                {
+                    std::cerr << JOB_COND_ERR_MSG << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        Unlock(phaseMutex);
+    }
+
+    void Run(ThreadContext& threadContext)
+    {
+        /// Map phase
+        PairEmitter<IntermediateKey, IntermediateValue> emitIntermediate(threadContext.intermediatePairs);
+        size_t inputSize = inputVector.size();
+        for (size_t i = mappingAtomicCounter++ ; i < inputSize && !Cancelled() ; i = mappingAtomicCounter++)
+        {
+            mapper(inputVector[i].first, inputVector[i].second, emitIntermediate);
+            mappedCounter++;
+        }
+
+        /// Shuffle phase - fills groups
+        GroupPhase(threadContext, grouping);
+
+        /// Reduce phase
+        PairEmitter<OutputKey, OutputValue> emitOutput(threadContext.outputPairs);
+        // a group is taken only if not cancelled, so every group before reducingAtomicCounter is reduced
+        size_t groupsNum = groups.size();
+        while (!Cancelled())
+        {
+            size_t i = reducingAtomicCounter++;
+            if (i >= groupsNum)
+                break;
+            reducer(groups[i].first, groups[i].second, emitOutput);
+            reducedCounter += groups[i].second - groups[i].first;
+        }
+
+        /// Output - the last thread to finish reducing gathers the output of all the threads, even if cancelled
+        SyncThreads([this]()
+        {
+            for (ThreadContext& context : threadsContexts)
+            {
+                outputVector.insert(outputVector.end(), std::make_move_iterator(context.outputPairs.begin()),
+                                    std::make_move_iterator(context.outputPairs.end()));
+                std::vector<OutputPair>().swap(context.outputPairs);
+            }
+            if (Cancelled())
+                ReleasePairs();
+        });
+    }
+
+    /**
+     * Release every intermediate pair the job holds, once it is cancelled. Every pair which was not passed to
+     * reduce is in exactly one of: a thread's intermediatePairs or partitionedPairs, shuffledPairs before the
+     * reduce stage and the groups which were not taken in the reduce stage (a cancelled merge releases the pairs
+     * it did not merge itself)
+     */
+    void ReleasePairs()
+    {
+        for (ThreadContext& threadContext : threadsContexts)
+        {
+            ReleaseRange(threadContext.intermediatePairs.data(),
+                         threadContext.intermediatePairs.data() + threadContext.intermediatePairs.size());
+            for (const std::vector<IntermediatePair>& partition : threadContext.partitionedPairs)
+                ReleaseRange(partition.data(), partition.data() + partition.size());
+            std::vector<IntermediatePair>().swap(threadContext.intermediatePairs);
+            std::vector<std::vector<IntermediatePair>>().swap(threadContext.partitionedPairs);
+            std::vector<std::vector<size_t>>().swap(threadContext.partitionedHashes);
+        }
+        if (stage == REDUCE_STAGE)
+        {
+            for (size_t i = std::min(reducingAtomicCounter.load(), groups.size()) ; i < groups.size() ; i++)
+                ReleaseRange(groups[i].first, groups[i].second);
+        }
+        else
+        {
+            for (const std::vector<IntermediatePair>& partition : shuffledPairs)
+                ReleaseRange(partition.data(), partition.data() + partition.size());
+        }
+        std::vector<std::vector<IntermediatePair>>().swap(shuffledPairs);
+        std::vector<std::vector<size_t>>().swap(partitionsGroupEnds);
+        std::vector<Group>().swap(groups);
+    }
+
+    void ReleaseRange(const IntermediatePair* begin, const IntermediatePair* end)
+    {
+        if (!releasePair)
+            return;
+        for (const IntermediatePair* pair = begin ; pair != end ; pair++)
+            releasePair(*pair);
+    }
+
+    /**
+     * Starts the shuffle stage once every thread is done mapping
+     */
+    void StartShuffle()
+    {
+        size_t pairs = 0;
+        for (const ThreadContext& threadContext : threadsContexts)
+            pairs += threadContext.intermediatePairs.size();
+        for (const ThreadContext& threadContext : threadsContexts)
+        {
+            for (const std::vector<IntermediatePair>& partition : threadContext.partitionedPairs)
+                pairs += partition.size();
+        }
+        intermediaryPairsCounter = pairs;
+        stage = SHUFFLE_STAGE;
+    }
+
+    /**
+     * Lists the groups of every shuffled partition and starts the reduce stage
+     */
+    void StartReduce(const std::vector<std::vector<size_t>>& partitionsGroupEnds)
+    {
+        for (size_t p = 0 ; p < shuffledPairs.size() ; p++)
+        {
+            const IntermediatePair* pairs = shuffledPairs[p].data();
+            size_t groupBegin = 0;
+            for (size_t groupEnd : partitionsGroupEnds[p])
+            {
+                groups.push_back(Group(pairs + groupBegin, pairs + groupEnd));
+                groupBegin = groupEnd;
+            }
+        }
+        stage = REDUCE_STAGE;
+    }
+
+
+    /// Sorted grouping ///
+
+    template <class Compare>
+    void GroupPhase(ThreadContext& threadContext, const SortedGrouping<Compare>& sortedGrouping)
+    {
+        const Compare& compare = sortedGrouping.compare;
+        SortPairs(compare, threadContext.intermediatePairs);
+
+        // the last thread to finish sorting merges
+        SyncThreads([this, &compare]()
+        {
+            if (Cancelled())
+            {
+                ReleasePairs();
+                return;
+            }
+            StartShuffle();
+            std::vector<std::vector<size_t>> groupEnds(1);
+            shuffledPairs.resize(1);
+            MergeSorted(compare, shuffledPairs[0], groupEnds[0]);
+            if (Cancelled())
+            {
+                ReleasePairs();
+                return;
+            }
+            StartReduce(groupEnds);
+        });
+    }
+
+    /**
+     * Sort pairs by key in runs of SORT_RUN_PAIRS pairs (which MergeSorted merges). Every run is sorted in blocks
+     * of SORT_BLOCK_PAIRS pairs which are then merged in place, level by level, so once cancelled the sort stops
+     * within a block or a merge and leaves the pairs unsorted
+     */
+    template <class Compare>
+    void SortPairs(const Compare& compare, std::vector<IntermediatePair>& pairs)
+    {
+        auto pairCompare = [&compare](const IntermediatePair& pair1, const IntermediatePair& pair2)
+                           { return compare(pair1.first, pair2.first); };
+        auto first = pairs.begin();
+        size_t size = pairs.size();
+        for (size_t run = 0 ; run < size ; run += SORT_RUN_PAIRS)
+        {
+            size_t runEnd = std::min(size, run + SORT_RUN_PAIRS);
+            for (size_t block = run ; block < runEnd ; block += SORT_BLOCK_PAIRS)
+            {
+                if (Cancelled())
+                    return;
+                std::sort(first + block, first + std::min(runEnd, block + SORT_BLOCK_PAIRS), pairCompare);
+            }
+            for (size_t width = SORT_BLOCK_PAIRS ; run + width < runEnd ; width *= 2)
+            {
+                for (size_t left = run ; left + width < runEnd ; left += 2 * width)
+                {
+                    if (Cancelled())
+                        return;
+                    std::inplace_merge(first + left, first + left + width,
+                                       first + std::min(runEnd, left + 2 * width), pairCompare);
+                }
+            }
+        }
+    }
+
+    /**
+     * Restore the order of heap (a heap of runs with the smallest head key on top) after its top run advanced
+     */
+    template <class Compare>
+    static void SiftDown(std::vector<SortedRun>& heap, const Compare& compare)
+    {
+        size_t size = heap.size();
+        if (size == 0)
+            return;
+        SortedRun top = heap[0];
+        size_t i = 0;
+        for (size_t child = 1 ; child < size ; child = 2 * i + 1)
+        {
+            if (child + 1 < size && compare(heap[child + 1].head->first, heap[child].head->first))
+                child++;
+            if (!compare(heap[child].head->first, top.head->first))
+                break;
+            heap[i] = heap[child];
+            i = child;
+        }
+        heap[i] = top;
+    }
+
+    /**
+     * Move the pairs of the smallest key in heap to merged, returns false if cancelled before the group is done
+     * (checked every CANCEL_CHECK_PAIRS merged pairs)
+     */
+    template <class Compare>
+    bool MergeGroup(const Compare& compare, std::vector<SortedRun>& heap, std::vector<IntermediatePair>& merged)
+    {
+        // the pairs with the smallest key are at the heads of the runs on top of the heap
+        size_t groupBegin = merged.size();
+        merged.push_back(std::move(*heap[0].head++));
+        const IntermediateKey& key = merged[groupBegin].first;
+        while (true)
+        {
+            SortedRun& run = heap[0];
+            while (run.head != run.end && !compare(key, run.head->first))
+            {
+                merged.push_back(std::move(*run.head++));
+                if (merged.size() % CANCEL_CHECK_PAIRS == 0 && Cancelled())
+                    return false;
+            }
+            if (run.head == run.end)
+            {
+                run = heap.back();
+                heap.pop_back();
+            }
+            SiftDown(heap, compare);
+            if (heap.empty() || compare(key, heap[0].head->first))
+                return true;
+        }
+    }
+
+    /**
+     * Merge the sorted runs of all the threads' intermediatePairs into merged, where every key is one group
+     * ending at groupEnds, and free them. Once cancelled it stops within a group or CANCEL_CHECK_PAIRS pairs and
+     * releases the pairs which were not merged right there, the merged ones are released with shuffledPairs
+     */
+    template <class Compare>
+    void MergeSorted(const Compare& compare, std::vector<IntermediatePair>& merged, std::vector<size_t>& groupEnds)
+    {
+        // merged never reallocates, so the key of the current group can be read from it
+        merged.reserve(intermediaryPairsCounter);
+
+        // a heap of the runs which are not done, the one whose head has the smallest key on top
+        std::vector<SortedRun> heap;
+        for (ThreadContext& threadContext : threadsContexts)
+        {
+            IntermediatePair* pairs = threadContext.intermediatePairs.data();
+            size_t size = threadContext.intermediatePairs.size();
+            for (size_t begin = 0 ; begin < size ; begin += SORT_RUN_PAIRS)
+                heap.push_back(SortedRun{pairs + begin, pairs + std::min(size, begin + SORT_RUN_PAIRS)});
+        }
+        std::make_heap(heap.begin(), heap.end(), [&compare](const SortedRun& run1, const SortedRun& run2)
+                       { return compare(run2.head->first, run1.head->first); });
+
+        while (!heap.empty() && !Cancelled() && MergeGroup(compare, heap, merged))
+        {
+            groupEnds.push_back(merged.size());
+            shuffledCounter = merged.size();
+        }
+
+        for (const SortedRun& run : heap)
+            ReleaseRange(run.head, run.end);
+        for (ThreadContext& threadContext : threadsContexts)
+            std::vector<IntermediatePair>().swap(threadContext.intermediatePairs);
+    }
+
+
+    /// Hash grouping ///
+
+    template <class Hash, class Equal>
+    void GroupPhase(ThreadContext& threadContext, const HashGrouping<Hash, Equal>& hashGrouping)
+    {
+        // partition the thread's pairs, there is a partition for every thread
+        size_t partitions = threadsContexts.size();
+        threadContext.partitionedPairs.resize(partitions);
+        threadContext.partitionedHashes.resize(partitions);
+        std::vector<IntermediatePair>& threadPairs = threadContext.intermediatePairs;
+        size_t partitioned = 0;
+        for ( ; partitioned < threadPairs.size() ; partitioned++)
+        {
+            if (partitioned % CANCEL_CHECK_PAIRS == 0 && Cancelled())
+                break;
+            IntermediatePair& pair = threadPairs[partitioned];
+            size_t hash = (size_t) (hashGrouping.hash(pair.first) * HASH_MIXER);
+            size_t partition = (hash >> (sizeof(size_t) * CHAR_BIT / 2)) % partitions;
+            threadContext.partitionedPairs[partition].push_back(std::move(pair));
+            threadContext.partitionedHashes[partition].push_back(hash);
+        }
+        // once cancelled the pairs which were not partitioned stay
+        if (partitioned == threadPairs.size())
+            std::vector<IntermediatePair>().swap(threadPairs);
+        else
+            threadPairs.erase(threadPairs.begin(), threadPairs.begin() + partitioned);
+
+        SyncThreads([this]()
+        {
+            if (Cancelled())
+            {
+                ReleasePairs();
+                return;
+            }
+            StartShuffle();
+            shuffledPairs.resize(threadsContexts.size());
+            partitionsGroupEnds.resize(threadsContexts.size());
+        });
+
+        // every thread groups the partition of its id, from all the threads
+        if (!Cancelled())
+            GroupPartition(threadContext.id, hashGrouping.equal);
+
+        SyncThreads([this]()
+        {
+            if (Cancelled())
+            {
+                ReleasePairs();
+                return;
+            }
+            for (ThreadContext& context : threadsContexts)
+            {
+                std::vector<std::vector<IntermediatePair>>().swap(context.partitionedPairs);
+                std::vector<std::vector<size_t>>().swap(context.partitionedHashes);
+            }
+            StartReduce(partitionsGroupEnds);
+            std::vector<std::vector<size_t>>().swap(partitionsGroupEnds);
+        });
+    }
+
+    /**
+     * Returns the slot of group (found by its hash) in table
+     */
+    static size_t FindSlot(const std::vector<TableSlot>& table, int slotShift, size_t hash, size_t group)
+    {
+        size_t slot = hash >> slotShift;
+        while (table[slot].group != group)
+            slot = (slot + 1) & (table.size() - 1);
+        return slot;
+    }
+
+    /**
+     * Double table and reinsert its groups by their stored hashes
+     */
+    static void GrowTable(std::vector<TableSlot>& table, int& slotShift)
+    {
+        std::vector<TableSlot> grown(2 * table.size(), TableSlot{0, 0});
+        slotShift--;
+        for (const TableSlot& entry : table)
+        {
+            if (entry.group == 0)
+                continue;
+            size_t slot = entry.hash >> slotShift;
+            while (grown[slot].group != 0)
+                slot = (slot + 1) & (grown.size() - 1);
+            grown[slot] = entry;
+        }
+        table.swap(grown);
+    }
+
+    /**
+     * Group the pairs of partition (from every thread) into shuffledPairs[partition], with an open addressing
+     * table from key to group: a first pass numbers the groups and counts their pairs, a second one moves every
+     * pair to its group and releases the partition. Leaves the partition ungrouped once cancelled
+     */
+    template <class Equal>
+    void GroupPartition(size_t partition, const Equal& equal)
+    {
+        size_t pairs = 0;
+        for (const ThreadContext& threadContext : threadsContexts)
+            pairs += threadContext.partitionedPairs[partition].size();
+
+        // at most half full, grown with the number of groups, slots are taken from the high bits of the hash
+        int slotShift = sizeof(size_t) * CHAR_BIT - MIN_TABLE_BITS;
+        std::vector<TableSlot> table(MIN_TABLE_SLOTS, TableSlot{0, 0});
+
+        std::vector<IntermediatePair*> sources;     // every pair of the partition
+        std::vector<size_t> pairGroups;             // and its group
+        std::vector<const IntermediateKey*> groupKeys;
+        std::vector<size_t> groupSizes;
+        sources.reserve(pairs);
+        pairGroups.reserve(pairs);
+
+        /// 1. find the group of every pair
+        for (ThreadContext& threadContext : threadsContexts)
+        {
+            std::vector<IntermediatePair>& threadPairs = threadContext.partitionedPairs[partition];
+            const std::vector<size_t>& threadHashes = threadContext.partitionedHashes[partition];
+            for (size_t i = 0 ; i < threadPairs.size() ; i++)
+            {
+                if (i % CANCEL_CHECK_PAIRS == 0 && Cancelled())
+                    return;
+                size_t hash = threadHashes[i];
+                size_t slot = hash >> slotShift;
+                while (table[slot].group != 0 &&
+                       !(table[slot].hash == hash && equal(*groupKeys[table[slot].group - 1], threadPairs[i].first)))
+                {
+                    slot = (slot + 1) & (table.size() - 1);
+                }
+                if (table[slot].group == 0)
+                {
+                    groupKeys.push_back(&threadPairs[i].first);
+                    groupSizes.push_back(0);
+                    table[slot] = TableSlot{hash, groupKeys.size()};
+                    if (2 * groupKeys.size() > table.size())
+                    {
+                        GrowTable(table, slotShift);
+                        slot = FindSlot(table, slotShift, hash, groupKeys.size());
+                    }
+                }
+                size_t group = table[slot].group - 1;
+                groupSizes[group]++;
+                sources.push_back(&threadPairs[i]);
+                pairGroups.push_back(group);
+            }
+        }
+        std::vector<TableSlot>().swap(table);
+
+        /// 2. order the pairs by group (a counting sort of their indices) and move them
+        std::vector<size_t> groupEnds(groupSizes.size());
+        std::vector<size_t> groupNext(groupSizes.size());
+        size_t end = 0;
+        for (size_t group = 0 ; group < groupSizes.size() ; group++)
+        {
+            groupNext[group] = end;
+            end += groupSizes[group];
+            groupEnds[group] = end;
+        }
+        std::vector<size_t> order(pairs);
+        for (size_t i = 0 ; i < pairs ; i++)
+            order[groupNext[pairGroups[i]]++] = i;
+
+        std::vector<IntermediatePair>& grouped = shuffledPairs[partition];
+        grouped.reserve(pairs);
+        for (size_t i : order)
+        {
+            if (grouped.size() % CANCEL_CHECK_PAIRS == 0 && Cancelled())
+            {
+                // move the pairs back, so the partition holds all of them
+                for (size_t j = 0 ; j < grouped.size() ; j++)
+                    *sources[order[j]] = std::move(grouped[j]);
+                grouped.clear();
+                return;
+            }
+            grouped.push_back(std::move(*sources[i]));
+        }
+        for (ThreadContext& threadContext : threadsContexts)
+        {
+            std::vector<IntermediatePair>().swap(threadContext.partitionedPairs[partition]);
+            std::vector<size_t>().swap(threadContext.partitionedHashes[partition]);
+        }
+
+        partitionsGroupEnds[partition].swap(groupEnds);
+        shuffledCounter += pairs;
+    }
+
+    Mapper mapper;
+    Reducer reducer;
+    Grouping grouping;
+    PairRelease releasePair;
+    const std::vector<InputPair>& inputVector;
+    std::vector<OutputPair>& outputVector;
+    std::vector<ThreadContext> threadsContexts;
+    std::vector<std::vector<IntermediatePair>> shuffledPairs; // the intermediate pairs by partition, grouped by key
+    std::vector<std::vector<size_t>> partitionsGroupEnds;     // with HashGrouping, the groups of every partition
+    std::vector<Group> groups;                                // all the groups, for the reduce phase
+
+    std::atomic<stage_t> stage;
+    std::atomic<size_t> mappingAtomicCounter;     // next input pair to map
+    std::atomic<size_t> mappedCounter;
+    std::atomic<size_t> intermediaryPairsCounter; // set when the map phase is over
+    std::atomic<size_t> shuffledCounter;
+    std::atomic<size_t> reducingAtomicCounter;    // next group to reduce
+    std::atomic<size_t> reducedCounter;           // in pairs
+    std::atomic<bool> cancelled;
+    int arrivedThreads;                           // these two are guarded by phaseMutex, see SyncThreads
+    size_t generation;
+    bool joined;                                  // guarded by joinMutex
+    pthread_mutex_t phaseMutex;
+    pthread_mutex_t joinMutex;
+    pthread_cond_t phaseCond;
+};
+
+#endif //MAP_REDUCE_JOB_H
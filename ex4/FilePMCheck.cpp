@@ -0,0 +1,169 @@
+#include "VirtualMemory.h"
+#include "VirtualMemoryExt.h"
+#include "PhysicalMemory.h"
+#include "FilePhysicalMemory.h"
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+/// Usage ///
+#define USAGE "usage: FilePMCheck [ram file] [swap file]"
+
+/// Defaults ///
+#define DEFAULT_RAM_PATH "FilePMCheck.ram"
+#define DEFAULT_SWAP_PATH "FilePMCheck.swap"
+#define VM_CHECK_WRITES 20000
+#define PAGE_PERMUTATION 0x9E3779B97F4A7C15ULL // odd, so multiplying by it permutes the pages
+
+/// Patterns ///
+#define EVICTED_PATTERN 1
+#define RAM_PATTERN 2
+#define VM_PATTERN 3
+
+/// Error MSG ///
+#define OPEN_ERR_MSG "FilePMCheck error: failed to open the ram and swap files"
+
+/**
+ * The value a pattern puts at an address, different for every pattern and (nearly) every address
+ */
+word_t PatternValue(int pattern, uint64_t address)
+{
+    return (word_t) ((address + 1) * 2654435761ULL + pattern * 40503ULL);
+}
+
+/**
+ * The page frame f is evicted to, distinct for every frame
+ */
+uint64_t EvictedPage(uint64_t frame)
+{
+    return (frame * PAGE_PERMUTATION) % NUM_PAGES;
+}
+
+void OpenFiles(const char* ramPath, const char* swapPath, bool keepSwap)
+{
+    if (!PMopenFiles(ramPath, swapPath, keepSwap))
+    {
+        std::cerr << OPEN_ERR_MSG << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Count the words of frame which differ from pattern (pattern 0 expects zeros) for the words of page
+ */
+uint64_t CheckFrame(uint64_t frame, int pattern, uint64_t page)
+{
+    uint64_t mismatches = 0;
+    for (uint64_t i = 0 ; i < PAGE_SIZE ; i++)
+    {
+        word_t value;
+        PMread(frame * PAGE_SIZE + i, &value);
+        word_t expected = pattern ? PatternValue(pattern, page * PAGE_SIZE + i) : 0;
+        if (value != expected)
+            mismatches++;
+    }
+    return mismatches;
+}
+
+/**
+ * Evict every frame to its own page, refill the RAM, reopen the files with keepSwap and check that the RAM
+ * file kept the refilled words and the swap file every evicted page, then that reopening without keepSwap
+ * empties the swap
+ */
+uint64_t CheckFiles(const char* ramPath, const char* swapPath)
+{
+    OpenFiles(ramPath, swapPath, false);
+    for (uint64_t frame = 0 ; frame < NUM_FRAMES ; frame++)
+    {
+        for (uint64_t i = 0 ; i < PAGE_SIZE ; i++)
+            PMwrite(frame * PAGE_SIZE + i, PatternValue(EVICTED_PATTERN, EvictedPage(frame) * PAGE_SIZE + i));
+        PMevict(frame, EvictedPage(frame));
+    }
+    for (uint64_t address = 0 ; address < RAM_SIZE ; address++)
+        PMwrite(address, PatternValue(RAM_PATTERN, address));
+    PMcloseFiles();
+
+    OpenFiles(ramPath, swapPath, true);
+    uint64_t ramMismatches = 0;
+    for (uint64_t frame = 0 ; frame < NUM_FRAMES ; frame++)
+        ramMismatches += CheckFrame(frame, RAM_PATTERN, frame);
+
+    uint64_t swapMismatches = 0;
+    for (uint64_t frame = 0 ; frame < NUM_FRAMES ; frame++)
+    {
+        PMrestore(frame, EvictedPage(frame));
+        swapMismatches += CheckFrame(frame, EVICTED_PATTERN, EvictedPage(frame));
+    }
+
+    // a page which was never evicted is restored as zeros
+    if (NUM_FRAMES < NUM_PAGES)
+    {
+        PMrestore(0, EvictedPage(NUM_FRAMES));
+        swapMismatches += CheckFrame(0, 0, 0);
+    }
+    PMcloseFiles();
+
+    OpenFiles(ramPath, swapPath, false);
+    PMrestore(0, EvictedPage(0));
+    uint64_t truncateMismatches = CheckFrame(0, 0, 0);
+    PMcloseFiles();
+
+    printf("files ram_words=%lu ram_mismatches=%lu swap_pages=%lu swap_mismatches=%lu truncate_mismatches=%lu\n",
+           (unsigned long) RAM_SIZE, (unsigned long) ramMismatches, (unsigned long) NUM_FRAMES,
+           (unsigned long) swapMismatches, (unsigned long) truncateMismatches);
+    return ramMismatches + swapMismatches + truncateMismatches;
+}
+
+/**
+ * Write random virtual addresses, VMsync, reopen the files with keepSwap and read them back through a new tree
+ */
+uint64_t CheckVirtualMemory(const char* ramPath, const char* swapPath)
+{
+    std::mt19937_64 rng(VM_PATTERN);
+    std::uniform_int_distribution<uint64_t> anyAddress(0, VIRTUAL_MEMORY_SIZE - 1);
+    std::vector<uint64_t> addresses(VM_CHECK_WRITES);
+    for (uint64_t& address : addresses)
+        address = anyAddress(rng);
+
+    OpenFiles(ramPath, swapPath, false);
+    VMinitialize();
+    for (uint64_t address : addresses)
+        VMwrite(address, PatternValue(VM_PATTERN, address));
+    VMsync();
+    PMcloseFiles();
+
+    OpenFiles(ramPath, swapPath, true);
+    VMinitialize();
+    uint64_t mismatches = 0;
+    for (uint64_t address : addresses)
+    {
+        word_t value;
+        VMread(address, &value);
+        if (value != PatternValue(VM_PATTERN, address))
+            mismatches++;
+    }
+    PMcloseFiles();
+
+    printf("vm addresses=%zu mismatches=%lu\n", addresses.size(), (unsigned long) mismatches);
+    return mismatches;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc > 3)
+    {
+        std::cerr << USAGE << std::endl;
+        return EXIT_FAILURE;
+    }
+    const char* ramPath = (argc > 1) ? argv[1] : DEFAULT_RAM_PATH;
+    const char* swapPath = (argc > 2) ? argv[2] : DEFAULT_SWAP_PATH;
+
+    uint64_t mismatches = CheckFiles(ramPath, swapPath) + CheckVirtualMemory(ramPath, swapPath);
+    unlink(ramPath);
+    unlink(swapPath);
+    return mismatches ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,154 @@
+#include "PhysicalMemory.h"
+#include "FilePhysicalMemory.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+/// Error MSG ///
+#define ADDRESS_ERR_MSG "PhysicalMemory error: address out of range"
+#define OPEN_ERR_MSG "system error: system failed to open the physical memory files"
+#define SWAP_WRITE_ERR_MSG "system error: system failed to write to the swap file"
+#define SWAP_READ_ERR_MSG "system error: system failed to read from the swap file"
+
+#define FILE_PERMISSIONS 0644
+#define PAGE_BYTES (PAGE_SIZE * sizeof(word_t))
+#define RAM_BYTES (RAM_SIZE * sizeof(word_t))
+
+/// State ///
+// PMevict / PMrestore are serialized by the VirtualMemory tree lock, PMread / PMwrite only touch the mapping
+word_t* RAM = nullptr;
+int ramFd = -1;
+int swapFd = -1;
+PMFileStats fileStats;
+
+/**
+ * Open the default files on first use
+ */
+void InitializeFiles()
+{
+    if (RAM != nullptr)
+        return;
+    if (!PMopenFiles(PM_DEFAULT_RAM_PATH, PM_DEFAULT_SWAP_PATH, false))
+    {
+        std::cerr << OPEN_ERR_MSG << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void CheckAddress(uint64_t physicalAddress)
+{
+    if (physicalAddress >= RAM_SIZE)
+    {
+        std::cerr << ADDRESS_ERR_MSG << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/// PhysicalMemory.h ///
+
+void PMread(uint64_t physicalAddress, word_t* value)
+{
+    InitializeFiles();
+    CheckAddress(physicalAddress);
+    *value = RAM[physicalAddress];
+}
+
+void PMwrite(uint64_t physicalAddress, word_t value)
+{
+    InitializeFiles();
+    CheckAddress(physicalAddress);
+    RAM[physicalAddress] = value;
+}
+
+void PMevict(uint64_t frameIndex, uint64_t evictedPageIndex)
+{
+    InitializeFiles();
+    CheckAddress(frameIndex * PAGE_SIZE);
+    const char* frame = (const char*) (RAM + frameIndex * PAGE_SIZE);
+    off_t offset = (off_t) (evictedPageIndex * PAGE_BYTES);
+    for (size_t written = 0 ; written < PAGE_BYTES ; )
+    {
+        ssize_t bytes = pwrite(swapFd, frame + written, PAGE_BYTES - written, offset + written);
+        if (bytes < 0)
+        {
+            std::cerr << SWAP_WRITE_ERR_MSG << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        written += bytes;
+    }
+    fileStats.evicts++;
+    fileStats.bytesWritten += PAGE_BYTES;
+}
+
+void PMrestore(uint64_t frameIndex, uint64_t restoredPageIndex)
+{
+    InitializeFiles();
+    CheckAddress(frameIndex * PAGE_SIZE);
+    char* frame = (char*) (RAM + frameIndex * PAGE_SIZE);
+    off_t offset = (off_t) (restoredPageIndex * PAGE_BYTES);
+    size_t read = 0;
+    while (read < PAGE_BYTES)
+    {
+        ssize_t bytes = pread(swapFd, frame + read, PAGE_BYTES - read, offset + read);
+        if (bytes < 0)
+        {
+            std::cerr << SWAP_READ_ERR_MSG << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (bytes == 0)
+            break;
+        read += bytes;
+    }
+    // past the end of the swap file, the page was never evicted
+    memset(frame + read, 0, PAGE_BYTES - read);
+    fileStats.restores++;
+    fileStats.bytesRead += PAGE_BYTES;
+}
+
+
+/// FilePhysicalMemory.h ///
+
+int PMopenFiles(const char* ramPath, const char* swapPath, bool keepSwap)
+{
+    PMcloseFiles();
+
+    ramFd = open(ramPath, O_RDWR | O_CREAT, FILE_PERMISSIONS);
+    swapFd = open(swapPath, O_RDWR | O_CREAT | (keepSwap ? 0 : O_TRUNC), FILE_PERMISSIONS);
+    if (ramFd < 0 || swapFd < 0 || ftruncate(ramFd, RAM_BYTES) < 0)
+    {
+        PMcloseFiles();
+        return 0;
+    }
+
+    void* ram = mmap(nullptr, RAM_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, ramFd, 0);
+    if (ram == MAP_FAILED)
+    {
+        PMcloseFiles();
+        return 0;
+    }
+    RAM = (word_t*) ram;
+    fileStats = PMFileStats();
+    return 1;
+}
+
+void PMcloseFiles()
+{
+    if (RAM != nullptr)
+        munmap(RAM, RAM_BYTES);
+    if (ramFd >= 0)
+        close(ramFd);
+    if (swapFd >= 0)
+        close(swapFd);
+    RAM = nullptr;
+    ramFd = -1;
+    swapFd = -1;
+}
+
+void PMgetFileStats(PMFileStats* stats)
+{
+    *stats = fileStats;
+}
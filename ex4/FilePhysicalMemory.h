@@ -0,0 +1,38 @@
+#ifndef FILE_PHYSICAL_MEMORY_H
+#define FILE_PHYSICAL_MEMORY_H
+
+#include "MemoryConstants.h"
+
+/// File backed PhysicalMemory backend ///
+// implements PMread / PMwrite / PMevict / PMrestore (PhysicalMemory.h) with the RAM in a shared mapping of a
+// file and the backing store in a sparse swap file, where page p lives at offset p * PAGE_SIZE words.
+// neither is limited by the memory of the process, and the swap file outlives it.
+// link it instead of PhysicalMemory.cpp.
+
+#define PM_DEFAULT_RAM_PATH "PhysicalMemory.ram"
+#define PM_DEFAULT_SWAP_PATH "PhysicalMemory.swap"
+
+typedef struct PMFileStats {
+    uint64_t evicts;
+    uint64_t restores;
+    uint64_t bytesWritten; // to the swap file
+    uint64_t bytesRead;    // from the swap file, holes included
+} PMFileStats;
+
+/**
+ * Map ramPath (resized to RAM_SIZE words) as the RAM and use swapPath as the backing store, creating both as
+ * needed. With keepSwap the pages already in swapPath are restored as they were saved (see VMsync), otherwise
+ * it is truncated. Pages which were never evicted are restored as zeros.
+ * when it is not called, the first PM operation opens PM_DEFAULT_RAM_PATH and PM_DEFAULT_SWAP_PATH
+ * @return 1 on success, 0 if a file could not be opened or mapped
+ */
+int PMopenFiles(const char* ramPath, const char* swapPath, bool keepSwap);
+
+/**
+ * Unmap the RAM and close both files
+ */
+void PMcloseFiles();
+
+void PMgetFileStats(PMFileStats* stats);
+
+#endif //FILE_PHYSICAL_MEMORY_H
@@ -0,0 +1,135 @@
+#include "PhysicalMemory.h"
+#include "InstrumentedPhysicalMemory.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <cstdlib>
+#include <iostream>
+
+/// Error MSG ///
+#define ADDRESS_ERR_MSG "PhysicalMemory error: address out of range"
+#define EVICT_ERR_MSG "PhysicalMemory error: evicted page is already in the backing store"
+
+/// Default Latencies (ns) ///
+#define DEFAULT_READ_LATENCY 100
+#define DEFAULT_WRITE_LATENCY 100
+#define DEFAULT_EVICT_LATENCY 10000
+#define DEFAULT_RESTORE_LATENCY 10000
+
+typedef std::vector<word_t> page_t;
+
+/// State ///
+// the RAM is only resized by PMreset, PMevict / PMrestore are serialized by the VirtualMemory tree lock,
+// PMread / PMwrite may run concurrently so the counters are atomic
+std::vector<word_t> RAM;
+std::unordered_map<uint64_t, page_t> backingStore;
+std::atomic<uint64_t> readCounter(0);
+std::atomic<uint64_t> writeCounter(0);
+uint64_t evictCounter = 0;
+uint64_t restoreCounter = 0;
+uint64_t emptyRestoreCounter = 0;
+PMLatencies pmLatencies = {DEFAULT_READ_LATENCY, DEFAULT_WRITE_LATENCY,
+                           DEFAULT_EVICT_LATENCY, DEFAULT_RESTORE_LATENCY};
+
+/**
+ * Allocate the RAM on first use
+ */
+void InitializeRAM()
+{
+    if (RAM.empty())
+        RAM.resize(RAM_SIZE, 0);
+}
+
+void CheckAddress(uint64_t physicalAddress)
+{
+    if (physicalAddress >= RAM_SIZE)
+    {
+        std::cerr << ADDRESS_ERR_MSG << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/// PhysicalMemory.h ///
+
+void PMread(uint64_t physicalAddress, word_t* value)
+{
+    InitializeRAM();
+    CheckAddress(physicalAddress);
+    readCounter.fetch_add(1, std::memory_order_relaxed);
+    *value = RAM[physicalAddress];
+}
+
+void PMwrite(uint64_t physicalAddress, word_t value)
+{
+    InitializeRAM();
+    CheckAddress(physicalAddress);
+    writeCounter.fetch_add(1, std::memory_order_relaxed);
+    RAM[physicalAddress] = value;
+}
+
+void PMevict(uint64_t frameIndex, uint64_t evictedPageIndex)
+{
+    InitializeRAM();
+    CheckAddress(frameIndex * PAGE_SIZE);
+    if (backingStore.find(evictedPageIndex) != backingStore.end())
+    {
+        std::cerr << EVICT_ERR_MSG << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    evictCounter++;
+    backingStore[evictedPageIndex] = page_t(RAM.begin() + frameIndex * PAGE_SIZE,
+                                            RAM.begin() + (frameIndex + 1) * PAGE_SIZE);
+}
+
+void PMrestore(uint64_t frameIndex, uint64_t restoredPageIndex)
+{
+    InitializeRAM();
+    CheckAddress(frameIndex * PAGE_SIZE);
+    auto page = backingStore.find(restoredPageIndex);
+    if (page == backingStore.end())
+    {
+        emptyRestoreCounter++;
+        return;
+    }
+    restoreCounter++;
+    std::copy(page->second.begin(), page->second.end(), RAM.begin() + frameIndex * PAGE_SIZE);
+    backingStore.erase(page);
+}
+
+
+/// InstrumentedPhysicalMemory.h ///
+
+void PMreset()
+{
+    RAM.assign(RAM_SIZE, 0);
+    backingStore.clear();
+    readCounter = 0;
+    writeCounter = 0;
+    evictCounter = 0;
+    restoreCounter = 0;
+    emptyRestoreCounter = 0;
+}
+
+void PMsetLatencies(const PMLatencies* latencies)
+{
+    pmLatencies = *latencies;
+}
+
+void PMgetCounters(PMCounters* counters)
+{
+    counters->reads = readCounter.load();
+    counters->writes = writeCounter.load();
+    counters->evicts = evictCounter;
+    counters->restores = restoreCounter;
+    counters->emptyRestores = emptyRestoreCounter;
+}
+
+double PMsimulatedTime()
+{
+    PMCounters counters;
+    PMgetCounters(&counters);
+    return counters.reads * pmLatencies.read + counters.writes * pmLatencies.write +
+           counters.evicts * pmLatencies.evict + counters.restores * pmLatencies.restore;
+}
@@ -0,0 +1,42 @@
+#ifndef INSTRUMENTED_PHYSICAL_MEMORY_H
+#define INSTRUMENTED_PHYSICAL_MEMORY_H
+
+#include "MemoryConstants.h"
+
+/// Instrumented PhysicalMemory backend ///
+// implements PMread / PMwrite / PMevict / PMrestore (PhysicalMemory.h) and counts every operation.
+// link it instead of PhysicalMemory.cpp.
+
+typedef struct PMCounters {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t evicts;
+    uint64_t restores;       // restores of pages found in the backing store
+    uint64_t emptyRestores;  // restores of pages which were never evicted (nothing to copy)
+} PMCounters;
+
+/**
+ * Latency charged for every operation, in nanoseconds
+ */
+typedef struct PMLatencies {
+    double read;
+    double write;
+    double evict;
+    double restore;
+} PMLatencies;
+
+/**
+ * Clear the RAM, the backing store and the counters
+ */
+void PMreset();
+
+void PMsetLatencies(const PMLatencies* latencies);
+
+void PMgetCounters(PMCounters* counters);
+
+/**
+ * Returns the simulated time (in nanoseconds) of the operations counted since the last PMreset
+ */
+double PMsimulatedTime();
+
+#endif //INSTRUMENTED_PHYSICAL_MEMORY_H
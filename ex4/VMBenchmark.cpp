@@ -0,0 +1,347 @@
+#include "VirtualMemory.h"
+#include "VirtualMemoryExt.h"
+#include "InstrumentedPhysicalMemory.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+
+/// Usage ///
+#define USAGE "usage: VMBenchmark [-w sequential|random|zipf|loop|trace] [-n accesses] [-t threads]\n" \
+              "                   [-W write percentage] [-s zipf skew] [-l loop pages] [-f trace file]\n" \
+              "                   [-L read,write,evict,restore latencies in ns] [-r seed] [-p (read-ahead)]\n" \
+              "                   [-z compressed swap cache bytes] [-v (verify)]\n" \
+              "trace file lines: <r|w> <virtual address>"
+
+/// Defaults ///
+#define DEFAULT_ACCESSES 100000
+#define DEFAULT_WRITE_PERCENTAGE 50
+#define DEFAULT_ZIPF_SKEW 0.99
+#define DEFAULT_SEED 1
+#define PAGE_PERMUTATION 0x9E3779B97F4A7C15ULL // odd, so multiplying by it permutes the pages
+
+/// Error MSG ///
+#define TRACE_ERR_MSG "VMBenchmark error: failed to read trace file"
+#define ARGUMENT_ERR_MSG "VMBenchmark error: invalid argument"
+#define PTHREAD_CREATE_ERR_MSG "system error: system failed to create pthread"
+#define PTHREAD_JOIN_ERR_MSG "system error: system failed to join pthread"
+
+typedef struct Access {
+    uint64_t address;
+    bool write;
+} Access;
+
+typedef struct BenchmarkConfig {
+    std::string workload = "sequential";
+    uint64_t accesses = DEFAULT_ACCESSES;
+    int threads = 1;
+    int writePercentage = DEFAULT_WRITE_PERCENTAGE;
+    double zipfSkew = DEFAULT_ZIPF_SKEW;
+    uint64_t loopPages = 2 * NUM_FRAMES;
+    std::string traceFile;
+    PMLatencies latencies = {100, 100, 10000, 10000};
+    unsigned int seed = DEFAULT_SEED;
+    bool prefetch = false;
+    uint64_t swapCache = 0;
+    bool verify = false;
+} BenchmarkConfig;
+
+typedef struct ThreadArgs {
+    const std::vector<Access>* accesses;
+    size_t begin;
+    size_t end;
+    int thread;
+    int threads;
+    bool verify;
+    std::unordered_map<uint64_t, word_t> written; // the last value this thread wrote to each of its addresses
+    uint64_t checked;
+    uint64_t mismatches;
+} ThreadArgs;
+
+
+/**
+ * Draws pages from a zipf distribution over all the virtual pages
+ */
+class ZipfGenerator {
+public:
+    ZipfGenerator(double skew) : cdf(NUM_PAGES)
+    {
+        double sum = 0;
+        for (uint64_t i = 0 ; i < NUM_PAGES ; i++)
+        {
+            sum += 1.0 / std::pow((double) (i + 1), skew);
+            cdf[i] = sum;
+        }
+        for (double& value : cdf)
+            value /= sum;
+    }
+
+    // the rank is permuted so hot pages are spread over the tree instead of sharing tables
+    uint64_t operator()(std::mt19937_64& rng)
+    {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        uint64_t rank = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return (rank * PAGE_PERMUTATION) % NUM_PAGES;
+    }
+
+private:
+    std::vector<double> cdf;
+};
+
+
+/**
+ * Load a recorded trace, every line is "r <address>" or "w <address>" (decimal or 0x hex)
+ */
+std::vector<Access> LoadTrace(const std::string& path)
+{
+    std::ifstream trace(path);
+    if (!trace)
+    {
+        std::cerr << TRACE_ERR_MSG << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<Access> accesses;
+    std::string type, address;
+    while (trace >> type >> address)
+    {
+        Access access = {strtoull(address.c_str(), nullptr, 0) % VIRTUAL_MEMORY_SIZE, type == "w"};
+        accesses.push_back(access);
+    }
+    return accesses;
+}
+
+/**
+ * Generate the accesses of a synthetic workload
+ */
+std::vector<Access> GenerateWorkload(const BenchmarkConfig& config)
+{
+    if (config.workload == "trace")
+        return LoadTrace(config.traceFile);
+
+    std::mt19937_64 rng(config.seed);
+    std::uniform_int_distribution<int> percentage(0, 99);
+    std::uniform_int_distribution<uint64_t> page(0, NUM_PAGES - 1);
+    std::uniform_int_distribution<uint64_t> offset(0, PAGE_SIZE - 1);
+    ZipfGenerator* zipf = (config.workload == "zipf") ? new ZipfGenerator(config.zipfSkew) : nullptr;
+
+    std::vector<Access> accesses(config.accesses);
+    for (uint64_t i = 0 ; i < config.accesses ; i++)
+    {
+        uint64_t address;
+        if (config.workload == "sequential")
+            address = i % VIRTUAL_MEMORY_SIZE;
+        else if (config.workload == "random")
+            address = page(rng) * PAGE_SIZE + offset(rng);
+        else if (config.workload == "zipf")
+            address = (*zipf)(rng) * PAGE_SIZE + offset(rng);
+        else if (config.workload == "loop")
+            address = i % (config.loopPages * PAGE_SIZE) % VIRTUAL_MEMORY_SIZE;
+        else
+        {
+            std::cerr << ARGUMENT_ERR_MSG << std::endl << USAGE << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        accesses[i].address = address;
+        accesses[i].write = percentage(rng) < config.writePercentage;
+    }
+    delete zipf;
+    return accesses;
+}
+
+
+/**
+ * Move an address to the nearest one owned by the given thread, in verify mode thread t only touches the
+ * addresses equal to t modulo the number of threads, so the threads share pages and tables but never words
+ */
+uint64_t OwnedAddress(uint64_t address, int thread, int threads)
+{
+    uint64_t owned = address - address % threads + thread;
+    return owned < VIRTUAL_MEMORY_SIZE ? owned : owned - threads;
+}
+
+/**
+ * Read address and compare it with the value this thread last wrote there.
+ * a word which was never written is read but not checked, a page restored before its first eviction keeps
+ * whatever its frame held
+ */
+void VerifyRead(ThreadArgs* args, uint64_t address)
+{
+    word_t value;
+    VMread(address, &value);
+    auto written = args->written.find(address);
+    if (written == args->written.end())
+        return;
+    args->checked++;
+    if (value != written->second)
+        args->mismatches++;
+}
+
+void* RunAccesses(void* arg)
+{
+    auto args = (ThreadArgs*) arg;
+    word_t value;
+    for (size_t i = args->begin ; i < args->end ; i++)
+    {
+        const Access& access = (*args->accesses)[i];
+        if (!args->verify)
+        {
+            if (access.write)
+                VMwrite(access.address, (word_t) i);
+            else
+                VMread(access.address, &value);
+            continue;
+        }
+
+        uint64_t address = OwnedAddress(access.address, args->thread, args->threads);
+        if (access.write)
+        {
+            VMwrite(address, (word_t) (i + 1));
+            args->written[address] = (word_t) (i + 1);
+        }
+        else
+            VerifyRead(args, address);
+    }
+
+    // read back everything this thread wrote while the other threads keep faulting and evicting
+    if (args->verify)
+    {
+        for (const auto& written : args->written)
+            VerifyRead(args, written.first);
+    }
+    return nullptr;
+}
+
+/**
+ * Replay the accesses, split between config.threads threads, and print a report line.
+ * returns the number of values which did not read back as written (always 0 without verify)
+ */
+uint64_t RunBenchmark(const BenchmarkConfig& config, const std::vector<Access>& accesses)
+{
+    PMreset();
+    PMsetLatencies(&config.latencies);
+    VMinitialize();
+    VMsetPrefetch(config.prefetch);
+    VMsetSwapCache(config.swapCache);
+
+    std::vector<pthread_t> threads(config.threads);
+    std::vector<ThreadArgs> threadArgs(config.threads);
+    size_t chunk = (accesses.size() + config.threads - 1) / config.threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0 ; i < config.threads ; i++)
+    {
+        threadArgs[i].accesses = &accesses;
+        threadArgs[i].begin = std::min(accesses.size(), i * chunk);
+        threadArgs[i].end = std::min(accesses.size(), (i + 1) * chunk);
+        threadArgs[i].thread = i;
+        threadArgs[i].threads = config.threads;
+        threadArgs[i].verify = config.verify;
+        threadArgs[i].checked = 0;
+        threadArgs[i].mismatches = 0;
+        if (pthread_create(&threads[i], nullptr, RunAccesses, &threadArgs[i]))
+        {
+            std::cerr << PTHREAD_CREATE_ERR_MSG << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0 ; i < config.threads ; i++)
+    {
+        if (pthread_join(threads[i], nullptr))
+        {
+            std::cerr << PTHREAD_JOIN_ERR_MSG << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    double wallNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    PMCounters counters;
+    PMgetCounters(&counters);
+    PrefetchStats prefetch;
+    VMgetPrefetchStats(&prefetch);
+    SwapCacheStats swapCache;
+    VMgetSwapCacheStats(&swapCache);
+    double swapRestores = (swapCache.hits + swapCache.misses) ? (double) (swapCache.hits + swapCache.misses) : 1;
+    double simulatedNs = PMsimulatedTime();
+    double n = accesses.empty() ? 1 : (double) accesses.size();
+
+    printf("workload=%s accesses=%zu threads=%d pm_reads=%lu pm_writes=%lu pm_evicts=%lu pm_restores=%lu "
+           "pm_empty_restores=%lu pm_ops_per_access=%.2f simulated_ns=%.0f simulated_ns_per_access=%.1f "
+           "wall_ns_per_access=%.1f accesses_per_sec=%.0f prefetch_issued=%lu prefetch_hits=%lu prefetch_wasted=%lu "
+           "swap_cache_stored=%lu swap_cache_rejected=%lu swap_cache_writebacks=%lu swap_cache_hits=%lu "
+           "swap_cache_misses=%lu swap_cache_hit_rate=%.3f swap_cache_bytes=%lu swap_cache_saved_bytes=%lu\n",
+           config.workload.c_str(), accesses.size(), config.threads,
+           (unsigned long) counters.reads, (unsigned long) counters.writes, (unsigned long) counters.evicts,
+           (unsigned long) counters.restores, (unsigned long) counters.emptyRestores,
+           (counters.reads + counters.writes + counters.evicts + counters.restores) / n,
+           simulatedNs, simulatedNs / n, wallNs / n, n * 1e9 / wallNs,
+           (unsigned long) prefetch.issued, (unsigned long) prefetch.hits, (unsigned long) prefetch.wasted,
+           (unsigned long) swapCache.stored, (unsigned long) swapCache.rejected, (unsigned long) swapCache.writebacks,
+           (unsigned long) swapCache.hits, (unsigned long) swapCache.misses, swapCache.hits / swapRestores,
+           (unsigned long) swapCache.bytes, (unsigned long) swapCache.savedBytes);
+
+    uint64_t checked = 0, mismatches = 0;
+    for (const ThreadArgs& args : threadArgs)
+    {
+        checked += args.checked;
+        mismatches += args.mismatches;
+    }
+    if (config.verify)
+        printf("verify threads=%d checked=%lu mismatches=%lu\n", config.threads,
+               (unsigned long) checked, (unsigned long) mismatches);
+    return mismatches;
+}
+
+
+/**
+ * Parse "read,write,evict,restore" latencies
+ */
+void ParseLatencies(const char* arg, PMLatencies* latencies)
+{
+    if (sscanf(arg, "%lf,%lf,%lf,%lf", &latencies->read, &latencies->write,
+               &latencies->evict, &latencies->restore) != 4)
+    {
+        std::cerr << ARGUMENT_ERR_MSG << std::endl << USAGE << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkConfig config;
+    int option;
+    while ((option = getopt(argc, argv, "w:n:t:W:s:l:f:L:r:pz:v")) != -1)
+    {
+        switch (option)
+        {
+            case 'w': config.workload = optarg; break;
+            case 'n': config.accesses = strtoull(optarg, nullptr, 10); break;
+            case 't': config.threads = std::max(1, atoi(optarg)); break;
+            case 'W': config.writePercentage = atoi(optarg); break;
+            case 's': config.zipfSkew = atof(optarg); break;
+            case 'l': config.loopPages = std::max(1ULL, strtoull(optarg, nullptr, 10)); break;
+            case 'f': config.traceFile = optarg; config.workload = "trace"; break;
+            case 'L': ParseLatencies(optarg, &config.latencies); break;
+            case 'r': config.seed = (unsigned int) atoi(optarg); break;
+            case 'p': config.prefetch = true; break;
+            case 'z': config.swapCache = strtoull(optarg, nullptr, 10); break;
+            case 'v': config.verify = true; break;
+            default:
+                std::cerr << USAGE << std::endl;
+                return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<Access> accesses = GenerateWorkload(config);
+    return RunBenchmark(config, accesses) ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,85 @@
+#ifndef VM_GEOMETRY_H
+#define VM_GEOMETRY_H
+
+#include "MemoryConstants.h"
+#include <type_traits>
+
+/// Compile-time VirtualMemory geometry ///
+// VMGeometry describes the layout of a virtual memory as a type, so every width, mask and shift is a
+// compile-time constant and the address split is unrolled per depth. VirtualMemoryEngine.h is the virtual
+// memory of a geometry, VirtualMemory.cpp is the engine of DefaultGeometry.
+
+/**
+ * Geometry of a virtual memory, in words: pages (and tables) of 2^OffsetWidth words, a virtual address space of
+ * 2^VirtualAddressWidth words and a physical memory of 2^PhysicalAddressWidth words.
+ */
+template <int OffsetWidth, int VirtualAddressWidth, int PhysicalAddressWidth>
+struct VMGeometry {
+    static_assert(OffsetWidth > 0 && VirtualAddressWidth > OffsetWidth && PhysicalAddressWidth > OffsetWidth,
+                  "the address spaces must be larger than a page");
+    static_assert(PhysicalAddressWidth - OffsetWidth < (int) WORD_WIDTH - 1,
+                  "every frame index must fit in a table entry");
+    static_assert(VirtualAddressWidth < 64, "virtual addresses are 64 bit");
+
+    static constexpr int offsetWidth = OffsetWidth;
+    static constexpr uint64_t pageSize = 1ULL << OffsetWidth;
+    static constexpr uint64_t offsetMask = pageSize - 1;
+    static constexpr int tablesDepth = (VirtualAddressWidth - OffsetWidth + OffsetWidth - 1) / OffsetWidth;
+    static constexpr uint64_t virtualMemorySize = 1ULL << VirtualAddressWidth;
+    static constexpr uint64_t ramSize = 1ULL << PhysicalAddressWidth;
+    static constexpr uint64_t numFrames = ramSize / pageSize;
+    static constexpr uint64_t numPages = virtualMemorySize / pageSize;
+
+    static constexpr uint64_t Offset(uint64_t virtualAddress)
+    {
+        return virtualAddress & offsetMask;
+    }
+
+    static constexpr uint64_t Page(uint64_t virtualAddress)
+    {
+        return virtualAddress >> OffsetWidth;
+    }
+
+    /**
+     * Returns the index into the table at depth Depth (the root table is at depth 0) on the walk to page
+     */
+    template <int Depth>
+    static constexpr uint64_t TableIndex(uint64_t page)
+    {
+        return (page >> (OffsetWidth * (tablesDepth - 1 - Depth))) & offsetMask;
+    }
+
+    /**
+     * Fill treeDepthsAddress[0 .. tablesDepth) with the table index of every depth, unrolled
+     */
+    static void Split(uint64_t page, uint64_t* treeDepthsAddress)
+    {
+        SplitFrom(page, treeDepthsAddress, std::integral_constant<int, 0>());
+    }
+
+private:
+    template <int Depth>
+    static void SplitFrom(uint64_t page, uint64_t* treeDepthsAddress, std::integral_constant<int, Depth>)
+    {
+        treeDepthsAddress[Depth] = TableIndex<Depth>(page);
+        SplitFrom(page, treeDepthsAddress, std::integral_constant<int, Depth + 1>());
+    }
+
+    static void SplitFrom(uint64_t, uint64_t*, std::integral_constant<int, tablesDepth>)
+    {
+    }
+};
+
+template <int O, int V, int P> constexpr int VMGeometry<O, V, P>::offsetWidth;
+template <int O, int V, int P> constexpr uint64_t VMGeometry<O, V, P>::pageSize;
+template <int O, int V, int P> constexpr uint64_t VMGeometry<O, V, P>::offsetMask;
+template <int O, int V, int P> constexpr int VMGeometry<O, V, P>::tablesDepth;
+template <int O, int V, int P> constexpr uint64_t VMGeometry<O, V, P>::virtualMemorySize;
+template <int O, int V, int P> constexpr uint64_t VMGeometry<O, V, P>::ramSize;
+template <int O, int V, int P> constexpr uint64_t VMGeometry<O, V, P>::numFrames;
+template <int O, int V, int P> constexpr uint64_t VMGeometry<O, V, P>::numPages;
+
+/// The geometry of MemoryConstants.h ///
+typedef VMGeometry<OFFSET_WIDTH, VIRTUAL_ADDRESS_WIDTH, PHYSICAL_ADDRESS_WIDTH> DefaultGeometry;
+
+#endif //VM_GEOMETRY_H
@@ -0,0 +1,160 @@
+#include "VirtualMemoryEngine.h"
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+/// Usage ///
+#define USAGE "usage: VMGeometryBenchmark [-n accesses] [-t translations] [-z swap cache bytes] [-r seed]"
+
+/// Defaults ///
+#define DEFAULT_ACCESSES 200000
+#define DEFAULT_TRANSLATIONS 1000000
+#define DEFAULT_SEED 1
+
+/// Error MSG ///
+#define MISMATCH_ERR_MSG "VMGeometryBenchmark error: reads did not return the values written"
+
+/// Geometries ///
+// an engine of every geometry below is alive at the same time, each over its own ArrayPhysicalMemory
+typedef VMGeometry<8, 32, 16> ThreeLevel256;  // 3 levels of 256 word pages, 256 frames
+typedef VMGeometry<10, 30, 18> TwoLevel1K;    // 2 levels of 1K word pages, 256 frames
+
+typedef struct GeometryBenchmarkConfig {
+    uint64_t accesses = DEFAULT_ACCESSES;
+    uint64_t translations = DEFAULT_TRANSLATIONS;
+    uint64_t swapCacheBytes = 0;
+    unsigned int seed = DEFAULT_SEED;
+} GeometryBenchmarkConfig;
+
+volatile uint64_t sink; // keeps the measured translations from being optimized away
+
+
+/**
+ * The value the benchmark writes at virtualAddress
+ */
+word_t ValueAt(uint64_t virtualAddress, unsigned int seed)
+{
+    return (word_t) (virtualAddress * 2654435761ULL + seed);
+}
+
+/**
+ * Read every written address back through engine, returns the number of mismatching reads
+ */
+template <class Engine>
+uint64_t CheckWritten(Engine& engine, const std::vector<uint64_t>& written, unsigned int seed)
+{
+    uint64_t mismatches = 0;
+    for (uint64_t address : written)
+    {
+        word_t value = 0;
+        engine.Read(address, &value);
+        if (value != ValueAt(address, seed))
+            mismatches++;
+    }
+    return mismatches;
+}
+
+/**
+ * Run one geometry and print a report line:
+ * random writes over twice as many pages as there are frames (every other access faults and evicts), the
+ * written addresses read back, and resident translations over a quarter of the frames worth of pages.
+ * Returns the written addresses so they can be checked again once the other engines ran.
+ */
+template <class Geometry>
+std::vector<uint64_t> RunGeometry(const char* name,
+                                  VirtualMemoryEngine<Geometry, ArrayPhysicalMemory<Geometry>>& engine,
+                                  const GeometryBenchmarkConfig& config)
+{
+    engine.Initialize();
+    engine.SetSwapCache(config.swapCacheBytes);
+    std::mt19937_64 rng(config.seed);
+
+    uint64_t workingSetWords = 2 * Geometry::numFrames * Geometry::pageSize;
+    std::uniform_int_distribution<uint64_t> workingSetAddress(0, workingSetWords - 1);
+    std::vector<uint64_t> written(config.accesses);
+    for (uint64_t& address : written)
+        address = workingSetAddress(rng);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t address : written)
+        engine.Write(address, ValueAt(address, config.seed));
+    double writeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    uint64_t evicts = engine.PhysicalMemory().Evicts();
+
+    uint64_t mismatches = CheckWritten(engine, written, config.seed);
+
+    // the resident set: consecutive pages, they share most tables
+    uint64_t residentWords = Geometry::numFrames / 4 * Geometry::pageSize;
+    word_t value = 0;
+    for (uint64_t address = 0 ; address < residentWords ; address += Geometry::pageSize)
+        engine.Read(address, &value);
+
+    std::uniform_int_distribution<uint64_t> residentAddress(0, residentWords - 1);
+    std::vector<uint64_t> translations(config.translations);
+    for (uint64_t& address : translations)
+        address = residentAddress(rng);
+
+    uint64_t sum = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t address : translations)
+    {
+        engine.Read(address, &value);
+        sum += (uint64_t) value;
+    }
+    double residentNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    sink = sum;
+
+    SwapCacheStats swapCache;
+    engine.GetSwapCacheStats(&swapCache);
+    double accesses = written.empty() ? 1 : (double) written.size();
+    double residentReads = translations.empty() ? 1 : (double) translations.size();
+    printf("geometry=%s depth=%d page_words=%lu frames=%lu accesses=%zu evictions=%lu swap_cache_hits=%lu "
+           "ns_per_access=%.0f resident_ns_per_read=%.2f mismatches=%lu\n",
+           name, Geometry::tablesDepth, (unsigned long) Geometry::pageSize, (unsigned long) Geometry::numFrames,
+           written.size(), (unsigned long) evicts, (unsigned long) swapCache.hits, writeNs / accesses,
+           residentNs / residentReads, (unsigned long) mismatches);
+    return written;
+}
+
+
+int main(int argc, char* argv[])
+{
+    GeometryBenchmarkConfig config;
+    int option;
+    while ((option = getopt(argc, argv, "n:t:z:r:")) != -1)
+    {
+        switch (option)
+        {
+            case 'n': config.accesses = strtoull(optarg, nullptr, 10); break;
+            case 't': config.translations = strtoull(optarg, nullptr, 10); break;
+            case 'z': config.swapCacheBytes = strtoull(optarg, nullptr, 10); break;
+            case 'r': config.seed = (unsigned int) atoi(optarg); break;
+            default:
+                std::cerr << USAGE << std::endl;
+                return EXIT_FAILURE;
+        }
+    }
+
+    VirtualMemoryEngine<DefaultGeometry, ArrayPhysicalMemory<DefaultGeometry>> defaultEngine;
+    VirtualMemoryEngine<ThreeLevel256, ArrayPhysicalMemory<ThreeLevel256>> threeLevelEngine;
+    VirtualMemoryEngine<TwoLevel1K, ArrayPhysicalMemory<TwoLevel1K>> twoLevelEngine;
+    std::vector<uint64_t> defaultWritten = RunGeometry("default", defaultEngine, config);
+    std::vector<uint64_t> threeLevelWritten = RunGeometry("3level-256", threeLevelEngine, config);
+    std::vector<uint64_t> twoLevelWritten = RunGeometry("2level-1K", twoLevelEngine, config);
+
+    // every engine still holds its own pages after the others ran
+    uint64_t mismatches = CheckWritten(defaultEngine, defaultWritten, config.seed) +
+                          CheckWritten(threeLevelEngine, threeLevelWritten, config.seed) +
+                          CheckWritten(twoLevelEngine, twoLevelWritten, config.seed);
+    printf("coexisting engines rechecked: mismatches=%lu\n", (unsigned long) mismatches);
+    if (mismatches != 0)
+    {
+        std::cerr << MISMATCH_ERR_MSG << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
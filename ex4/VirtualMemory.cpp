@@ -1,277 +1,116 @@
 #include "VirtualMemory.h"
+#include "VirtualMemoryExt.h"
 #include "PhysicalMemory.h"
+#include "VirtualMemoryEngine.h"
 
-/// Methods ////
-
- /**
-  * Returns the Offset from the VirtualAddress
-  */
-uint64_t GetOffset(uint64_t virtualAddress)
-{
-    uint64_t temp (1 << OFFSET_WIDTH);
-    return virtualAddress & (temp - 1);
-}
-
+/// Physical Memory ///
+// the engine behind the API works on the PhysicalMemory linked into the process
 
 /**
- * Checks if the currentTable is empty by checking if all the frame cells with zero Value
+ * Forwards the engine's physical memory accesses to PMread / PMwrite / PMevict / PMrestore
  */
-bool CheckFrameEmpty(word_t currentTable)
-{
-    word_t childrenValue;
-    for (int i = 0; i < PAGE_SIZE ; i++)
+class LinkedPhysicalMemory {
+public:
+    void Read(uint64_t physicalAddress, word_t* value) const
     {
-        PMread(currentTable * PAGE_SIZE + i,&childrenValue);
-        if (childrenValue != 0)
-            return false;
+        PMread(physicalAddress, value);
     }
-    return true;
-}
 
-/**
-     * Checks if the cyclic distance between page and address is greater then current maximal distance,
-     * if so we will updated the parameters of current maximal distance frame.
- */
-void CheckCyclicDistance(uint64_t addressWithoutOffset,word_t currentFrame,uint64_t currentFrameAddress,uint64_t* currentMaxDistance,
-                         word_t* maxDistanceFrame,uint64_t* maxDistanceAddress,uint64_t* maxDistanceParentAddress,
-                         uint64_t currentFrameParentAddress)
-{
-    uint64_t cyclicDistance = (currentFrameAddress > addressWithoutOffset) ?
-                              currentFrameAddress - addressWithoutOffset :
-                              addressWithoutOffset - currentFrameAddress;
-    uint64_t compare = NUM_PAGES - cyclicDistance;
-    uint64_t minDistance = (cyclicDistance > compare) ? compare : cyclicDistance;
-    if (minDistance > *currentMaxDistance)
+    void Write(uint64_t physicalAddress, word_t value)
     {
-        *currentMaxDistance = minDistance;
-        *maxDistanceFrame = currentFrame;
-        *maxDistanceAddress = currentFrameAddress;
-        *maxDistanceParentAddress = currentFrameParentAddress;
+        PMwrite(physicalAddress, value);
     }
-}
 
-/**
- * This function runs on the frame table searching for an available frame,
- * if found a frame which all children's are 0 - return it
- */
-word_t TraversTree(uint64_t addressWithoutOffset,
-                   word_t currentFrame,
-                   uint64_t currentFrameParentAddress,
-                   uint64_t currentFrameAddress,
-                   word_t parentOfLookingFrame,
-                   int *maximalFrameIndex,
-                   int currentDepth,
-                   uint64_t* currentMaxDistance,
-                   word_t* maxDistanceFrame,
-                   uint64_t* maxDistanceAddress,
-                   uint64_t* maxDistanceParentAddress)
-{
-    /// 1. if recursive call is on leaf - check the cyclic distance from the leaf to address
-    if (currentDepth == TABLES_DEPTH)
+    void Evict(uint64_t frameIndex, uint64_t evictedPageIndex)
     {
-        CheckCyclicDistance(addressWithoutOffset,currentFrame,currentFrameAddress,currentMaxDistance,maxDistanceFrame,
-                            maxDistanceAddress,maxDistanceParentAddress,currentFrameParentAddress);
-        return 0;
+        PMevict(frameIndex, evictedPageIndex);
     }
 
-    /// 2. if found a frame that all of it children's are 0, reset the values of children's and return it
-    if (CheckFrameEmpty(currentFrame)  && currentFrame != parentOfLookingFrame)
+    void Restore(uint64_t frameIndex, uint64_t restoredPageIndex)
     {
-        PMwrite(currentFrameParentAddress ,0);
-        return currentFrame;
+        PMrestore(frameIndex, restoredPageIndex);
     }
+};
 
-    /// 3. run TraversTree on every children found that his value is not 0
-    word_t childrenValue;
-    for (int i = 0; i < PAGE_SIZE ; i++)
-    {
-        PMread(currentFrame * PAGE_SIZE + i,&childrenValue);
-        if (childrenValue != 0)
-        {
-            /// 3.1 if found a frame with bigger value then current maximal frame index, update it
-            if (childrenValue > *maximalFrameIndex)
-                *maximalFrameIndex = childrenValue;
+/// Virtual Memory State ///
+// the VirtualMemory of MemoryConstants.h, every function below forwards to it
+VirtualMemoryEngine<DefaultGeometry, LinkedPhysicalMemory> virtualMemory;
 
-            /// 3.2 run the recursive call
-            word_t frameFoundBySearch = TraversTree(addressWithoutOffset,
-                                                    childrenValue,
-                                                 currentFrame * PAGE_SIZE + i,
-                                                 (currentFrameAddress << OFFSET_WIDTH) + i,
-                                                    parentOfLookingFrame,
-                                                    maximalFrameIndex,
-                                                 currentDepth + 1,
-                                                    currentMaxDistance,
-                                                    maxDistanceFrame,
-                                                    maxDistanceAddress,
-                                                    maxDistanceParentAddress);
+/// API ////
 
-            /// 3.3 if found an available frame, return it
-            if(frameFoundBySearch != 0)
-                return frameFoundBySearch;
-        }
-    }
-    return 0;
+/**
+ * Initialize the virtual memory.
+ * will fill everet page of the frame with 0
+ */
+void VMinitialize()
+{
+    virtualMemory.Initialize();
 }
 
 /**
- * This functions search for an available frame by using the TraversTree function.
- * it will return a frame by this priority:
- * empty frame -> maximal frame smaller than available number of frames -> most distinct frame
- * @param parentOfLookingFrame - we will use this parameter to make sure that we wont replace the parent frame
+ * Enable or disable sequential read-ahead on page faults (disabled by default)
  */
-word_t FindAvailableFrame(uint64_t addressWithoutOffset, word_t parentOfLookingFrame)
+void VMsetPrefetch(bool enabled)
 {
-    /// 0. initialise all variables that will be given as reference to TraversTree
-    uint64_t maxDistance = 0;
-    word_t maxDistanceFrame = 0;
-    uint64_t maxDistanceAddress = 0;
-    uint64_t maxDistanceParentAddress = 0;
-    int maximalFrameIndex = 0;
-
-    /// 1 run the search algorithm on tree
-    word_t FrameFound = TraversTree(addressWithoutOffset,
-                                    0,
-                                    0,
-                                    0,
-                                    parentOfLookingFrame,
-                                    &maximalFrameIndex,
-                                    0,
-                                    &maxDistance,
-                                    &maxDistanceFrame,
-                                    &maxDistanceAddress,
-                                    &maxDistanceParentAddress);
-
-    /// 2. FrameFound will be different then 0 if TraversTree found a frame that all of it children are 0
-    if (FrameFound != 0)
-        return FrameFound;
-
-    /// 3. Otherwise check if the maximal frame index found is smaller then possible NUM_FRAMES
-    else if (maximalFrameIndex + 1 < NUM_FRAMES)
-        return maximalFrameIndex + 1;
-
-    /// 4. If none of the above - evict the most distinct frame and return it
-    else
-    {
-        PMevict(maxDistanceFrame,maxDistanceAddress);
-        PMwrite(maxDistanceParentAddress,0);
-        return maxDistanceFrame;
-    }
-
+    virtualMemory.SetPrefetch(enabled);
 }
 
 /**
- * This function Splits the addressWithoutOffset bits into threeDepthAddress as instructions of the
- * path of the VirtualMemory address
+ * Set the size of the compressed swap cache pool, 0 disables it
  */
-void SplitAddress(uint64_t addressWithoutOffset,uint64_t* treeDepthsAddress)
+void VMsetSwapCache(uint64_t poolBytes)
 {
-    uint64_t addressWithoutOffsetToSplit = addressWithoutOffset;
-
-    // 2.2.2 for TABLES_DEPTH number of times - set the i depth address to the i cell of treeDepthsAddress array
-    for (uint64_t i = 0 ; i < TABLES_DEPTH ; i++)
-    {
-        treeDepthsAddress[TABLES_DEPTH - i - 1] = addressWithoutOffsetToSplit & (PAGE_SIZE - 1);
-        addressWithoutOffsetToSplit = addressWithoutOffsetToSplit >> OFFSET_WIDTH;
-    }
+    virtualMemory.SetSwapCache(poolBytes);
 }
 
 /**
- * This function Reset Frame by changing all the values to zero
+ * Unmap every page which holds an address in [virtualAddress, virtualAddress + length) and discard its content
  */
-void ResetFrame(word_t frame)
+int VMfree(uint64_t virtualAddress, uint64_t length)
 {
-    for (uint64_t j = 0 ; j < PAGE_SIZE ; j++)
-    {
-        PMwrite(frame * PAGE_SIZE + j,0);
-    }
+    return virtualMemory.Free(virtualAddress, length) ? 1 : 0;
 }
 
 /**
- * During translation of virtual address to physical one,
- * Whenever we encounter an empty frame -  we will create a new frame for it.
- * @param ind - the index of the empty frame from the treeDepthsAddress array
+ * Map the block of PAGE_SIZE^levels pages containing virtualAddress as one huge mapping
  */
-word_t FaultPageHandler(uint64_t addressWithoutOffset,word_t parentFrameAddress,uint64_t treeDepthsAddress[],
-                        word_t currentFrameAddress, int ind)
+int VMmapHuge(uint64_t virtualAddress, int levels)
 {
-    word_t frameFound = FindAvailableFrame(addressWithoutOffset, parentFrameAddress);
-
-    if (ind == TABLES_DEPTH-1)
-        PMrestore(frameFound,addressWithoutOffset);
-    else
-        ResetFrame(frameFound);
-
-    PMwrite(parentFrameAddress * PAGE_SIZE + treeDepthsAddress[ind], frameFound);
-    currentFrameAddress = frameFound;
-    return currentFrameAddress;
+    return virtualMemory.MapHuge(virtualAddress, levels) ? 1 : 0;
 }
 
-
 /**
- * this function find a PhysicalMemory Address for a specific VirtualAddress
+ * Copy the prefetch statistics into stats
  */
-uint64_t FindPhysicalAddress(uint64_t virtualAddress)
+void VMgetPrefetchStats(PrefetchStats* stats)
 {
-    /// 1. Get the offset
-    uint64_t offset = GetOffset(virtualAddress);
-
-    /// 2. split address to tree depths instructions
-    uint64_t treeDepthsAddress[TABLES_DEPTH];
-    uint64_t addressWithoutOffset = virtualAddress >> OFFSET_WIDTH; // bit manipulation to get address without offset
-    SplitAddress(addressWithoutOffset,treeDepthsAddress);
-
-    /// 3. Get physical address of the virtual one
-    word_t currentFrameAddress = 0 ;
-    for (int i =0 ; i < TABLES_DEPTH ; i++ )
-    {
-        word_t parentFrameAddress = currentFrameAddress;
-        PMread(currentFrameAddress * PAGE_SIZE + treeDepthsAddress[i], &currentFrameAddress);
-        if (currentFrameAddress == 0)
-        {
-            // Handle empty frame found
-            currentFrameAddress = FaultPageHandler(addressWithoutOffset,parentFrameAddress,
-                                                   treeDepthsAddress,currentFrameAddress,i);
-        }
-    }
-    return currentFrameAddress * PAGE_SIZE + offset;
+    virtualMemory.GetPrefetchStats(stats);
 }
 
-
-/// API ////
+/**
+ * Evict the tree and the swap cache to the backing store
+ */
+void VMsync()
+{
+    virtualMemory.Sync();
+}
 
 /**
- * Initialize the virtual memory.
- * will fill everet page of the frame with 0
+ * Copy the swap cache statistics into stats
  */
-void VMinitialize()
+void VMgetSwapCacheStats(SwapCacheStats* stats)
 {
-    for (uint64_t i = 0 ; i < PAGE_SIZE ; i++)
-    {
-        PMwrite(i,0);
-    }
+    virtualMemory.GetSwapCacheStats(stats);
 }
 
 
 int VMread(uint64_t virtualAddress, word_t* value)
 {
-    if (virtualAddress >= VIRTUAL_MEMORY_SIZE)
-        return 0;
-
-    uint64_t physicalAddress = FindPhysicalAddress(virtualAddress);
-
-    PMread(physicalAddress , value);
-    return 1;
+    return virtualMemory.Read(virtualAddress, value) ? 1 : 0;
 }
 
 
 int VMwrite(uint64_t virtualAddress, word_t value)
 {
-    if (virtualAddress >= VIRTUAL_MEMORY_SIZE)
-        return 0;
-
-    uint64_t physicalAddress = FindPhysicalAddress(virtualAddress);
-
-    PMwrite(physicalAddress , value);
-    return 1;
+    return virtualMemory.Write(virtualAddress, value) ? 1 : 0;
 }
-
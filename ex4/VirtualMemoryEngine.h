@@ -0,0 +1,1104 @@
+#ifndef VIRTUAL_MEMORY_ENGINE_H
+#define VIRTUAL_MEMORY_ENGINE_H
+
+#include "MemoryConstants.h"
+#include "VirtualMemoryExt.h"
+#include "VMGeometry.h"
+#include <pthread.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+/// VirtualMemory engine ///
+// VirtualMemoryEngine<Geometry, Memory> is the virtual memory: the walk, the faults, the eviction and every
+// VirtualMemoryExt.h extension (huge mappings, read-ahead, the swap cache, VMfree, VMsync), with the geometry's
+// widths as compile-time constants. VirtualMemory.cpp is one static instance of it (DefaultGeometry over the
+// linked PhysicalMemory), engines of other geometries can live next to it, each over its own physical memory.
+
+/// System Error MSG ///
+#define RWLOCK_INIT_ERR_MSG "system error: system failed to initialize rwlock"
+#define RWLOCK_RDLOCK_ERR_MSG "system error: system failed to lock rwlock for reading"
+#define RWLOCK_WRLOCK_ERR_MSG "system error: system failed to lock rwlock for writing"
+#define RWLOCK_UNLOCK_ERR_MSG "system error: system failed to unlock rwlock"
+
+/// Prefetch Constants ///
+#define PREFETCH_MIN_WINDOW 1
+#define PREFETCH_MAX_WINDOW 16
+
+/// Huge Mapping Constants ///
+// a table entry with HUGE_ENTRY_FLAG set maps a block of contiguous frames instead of pointing to a table
+#define HUGE_ENTRY_FLAG ((word_t) 1 << (WORD_WIDTH - 2))
+#define HUGE_FRAME_MASK (HUGE_ENTRY_FLAG - 1)
+
+
+/**
+ * Physical memory owned by one engine: the RAM is a vector of words and evicted pages are kept in a map
+ * (same semantics as PMread / PMwrite / PMevict / PMrestore: restoring a page which was never evicted leaves
+ * the frame as it is)
+ */
+template <class Geometry>
+class ArrayPhysicalMemory {
+public:
+    ArrayPhysicalMemory() : ram(Geometry::ramSize, 0), evicts(0), restores(0)
+    {
+    }
+
+    void Read(uint64_t physicalAddress, word_t* value) const
+    {
+        *value = ram[physicalAddress];
+    }
+
+    void Write(uint64_t physicalAddress, word_t value)
+    {
+        ram[physicalAddress] = value;
+    }
+
+    void Evict(uint64_t frameIndex, uint64_t evictedPageIndex)
+    {
+        auto frame = ram.begin() + frameIndex * Geometry::pageSize;
+        backingStore[evictedPageIndex].assign(frame, frame + Geometry::pageSize);
+        evicts++;
+    }
+
+    void Restore(uint64_t frameIndex, uint64_t restoredPageIndex)
+    {
+        auto page = backingStore.find(restoredPageIndex);
+        if (page == backingStore.end())
+            return;
+        std::copy(page->second.begin(), page->second.end(), ram.begin() + frameIndex * Geometry::pageSize);
+        backingStore.erase(page);
+        restores++;
+    }
+
+    uint64_t Evicts() const
+    {
+        return evicts;
+    }
+
+    uint64_t Restores() const
+    {
+        return restores;
+    }
+
+private:
+    std::vector<word_t> ram;
+    std::unordered_map<uint64_t, std::vector<word_t>> backingStore;
+    uint64_t evicts;
+    uint64_t restores;
+};
+
+
+/**
+ * Hierarchical page table virtual memory for Geometry on top of Memory, which provides
+ *     void Read(uint64_t physicalAddress, word_t* value) const
+ *     void Write(uint64_t physicalAddress, word_t value)
+ *     void Evict(uint64_t frameIndex, uint64_t evictedPageIndex)
+ *     void Restore(uint64_t frameIndex, uint64_t restoredPageIndex)
+ * Faults take, by this priority, an empty table, an unused frame or the frame of the page with the largest
+ * cyclic distance from the faulting page. The public functions are the VirtualMemory.h / VirtualMemoryExt.h API
+ * of this engine and are thread safe (see vmLock). An engine keeps two flags per frame, so engines of large
+ * geometries belong in static storage or on the heap.
+ */
+template <class Geometry, class Memory>
+class VirtualMemoryEngine {
+public:
+    explicit VirtualMemoryEngine(const Memory& givenMemory = Memory()) :
+            memory(givenMemory),
+            prefetchEnabled(false),
+            prefetchWindow(PREFETCH_MIN_WINDOW),
+            expectedFaultPage(noPage),
+            framePrefetched(),
+            prefetchStats(),
+            swapCacheCapacity(0),
+            swapCacheStats(),
+            frameUsed()
+    {
+        if (pthread_rwlock_init(&vmLock, nullptr))
+        {
+            std::cerr << RWLOCK_INIT_ERR_MSG << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    VirtualMemoryEngine(const VirtualMemoryEngine&) = delete;
+    VirtualMemoryEngine& operator=(const VirtualMemoryEngine&) = delete;
+
+    ~VirtualMemoryEngine()
+    {
+        pthread_rwlock_destroy(&vmLock);
+    }
+
+    /**
+     * Initialize the virtual memory.
+     * will fill everet page of the frame with 0
+     */
+    void Initialize()
+    {
+        LockTree(true);
+        ResetFrame(0);
+
+        // reset the prefetch state
+        for (uint64_t i = 0 ; i < Geometry::numFrames ; i++)
+        {
+            framePrefetched[i] = false;
+        }
+        prefetchWindow = PREFETCH_MIN_WINDOW;
+        expectedFaultPage = noPage;
+        prefetchStats = PrefetchStats();
+
+        // drop the swap cache, it belongs to the previous tree
+        swapCache.clear();
+        swapCacheOrder.clear();
+        swapCacheStats = SwapCacheStats();
+        UnlockTree();
+    }
+
+    bool Read(uint64_t virtualAddress, word_t* value)
+    {
+        if (virtualAddress >= Geometry::virtualMemorySize)
+            return false;
+
+        uint64_t physicalAddress = LockAndTranslate(virtualAddress);
+        memory.Read(physicalAddress, value);
+        UnlockTree();
+        return true;
+    }
+
+    bool Write(uint64_t virtualAddress, word_t value)
+    {
+        if (virtualAddress >= Geometry::virtualMemorySize)
+            return false;
+
+        uint64_t physicalAddress = LockAndTranslate(virtualAddress);
+        memory.Write(physicalAddress, value);
+        UnlockTree();
+        return true;
+    }
+
+    /**
+     * Enable or disable sequential read-ahead on page faults (disabled by default)
+     */
+    void SetPrefetch(bool enabled)
+    {
+        LockTree(true);
+        prefetchEnabled = enabled;
+        UnlockTree();
+    }
+
+    /**
+     * Copy the prefetch statistics into stats.
+     * they only change under the exclusive lock (during faults), so the shared lock gives a consistent copy
+     * without stalling translations
+     */
+    void GetPrefetchStats(PrefetchStats* stats)
+    {
+        LockTree(false);
+        *stats = prefetchStats;
+        stats->window = prefetchWindow;
+        UnlockTree();
+    }
+
+    /**
+     * Set the size of the compressed swap cache pool, 0 disables it
+     */
+    void SetSwapCache(uint64_t poolBytes)
+    {
+        LockTree(true);
+        swapCacheCapacity = poolBytes;
+        UnlockTree();
+    }
+
+    /**
+     * Copy the swap cache statistics into stats (under the shared lock, like GetPrefetchStats)
+     */
+    void GetSwapCacheStats(SwapCacheStats* stats)
+    {
+        LockTree(false);
+        *stats = swapCacheStats;
+        UnlockTree();
+    }
+
+    /**
+     * Map the block of pageSize^levels pages containing virtualAddress as one huge mapping
+     */
+    bool MapHuge(uint64_t virtualAddress, int levels)
+    {
+        if (virtualAddress >= Geometry::virtualMemorySize || levels < 1 || levels > Geometry::tablesDepth - 1)
+            return false;
+
+        LockTree(true);
+        bool mapped = MapHugeBlock(Geometry::Page(virtualAddress), levels);
+        UnlockTree();
+        return mapped;
+    }
+
+    /**
+     * Unmap every page which holds an address in [virtualAddress, virtualAddress + length) and discard its content
+     */
+    bool Free(uint64_t virtualAddress, uint64_t length)
+    {
+        if (virtualAddress >= Geometry::virtualMemorySize || length > Geometry::virtualMemorySize - virtualAddress)
+            return false;
+        if (length == 0)
+            return true;
+
+        uint64_t firstPage = Geometry::Page(virtualAddress);
+        uint64_t lastPage = Geometry::Page(virtualAddress + length - 1);
+        uint64_t rootPages = HugeBlockPages(0);
+
+        LockTree(true);
+        for (uint64_t i = firstPage / rootPages ; i <= lastPage / rootPages ; i++)
+        {
+            FreeEntry(i,0,i * rootPages,firstPage,lastPage);
+        }
+
+        // freed pages waiting in the swap cache are dropped too
+        for (auto entry = swapCache.begin() ; entry != swapCache.end() ; )
+        {
+            auto next = std::next(entry);
+            if (entry->first >= firstPage && entry->first <= lastPage)
+                RemoveFromSwapCache(entry);
+            entry = next;
+        }
+        UnlockTree();
+        return true;
+    }
+
+    /**
+     * Evict the tree and the swap cache to the backing store
+     */
+    void Sync()
+    {
+        LockTree(true);
+        for (uint64_t i = 0 ; i < Geometry::pageSize ; i++)
+        {
+            EvictEntry(i,0,i * HugeBlockPages(0));
+        }
+
+        // every frame but the root is free now, pooled pages are staged through frame 1
+        while (!swapCacheOrder.empty())
+        {
+            auto oldest = swapCache.find(swapCacheOrder.front());
+            DecompressPage(oldest->second.runs, 1);
+            memory.Evict(1,oldest->first);
+            RemoveFromSwapCache(oldest);
+            swapCacheStats.writebacks++;
+        }
+        expectedFaultPage = noPage;
+        UnlockTree();
+    }
+
+    /**
+     * The physical memory, e.g. for its counters. only safe to use while no other thread uses the engine
+     */
+    const Memory& PhysicalMemory() const
+    {
+        return memory;
+    }
+
+private:
+    static constexpr uint64_t noPage = Geometry::numPages;
+    static constexpr uint64_t pageBytes = Geometry::pageSize * sizeof(word_t);
+
+    /// Swap Cache State ///
+    // evicted pages are kept delta + run length encoded (pairs of a run length and the difference between
+    // consecutive words), in first in first out order for write back
+    typedef struct SwapCacheEntry {
+        std::vector<word_t> runs;
+        std::list<uint64_t>::iterator order;
+    } SwapCacheEntry;
+
+    typedef typename std::unordered_map<uint64_t, SwapCacheEntry>::iterator SwapCacheIterator;
+
+    /**
+     * Lock the virtual memory tree, shared for translations of resident pages or exclusive for faults
+     */
+    void LockTree(bool exclusive)
+    {
+        if (exclusive && pthread_rwlock_wrlock(&vmLock))
+        {
+            std::cerr << RWLOCK_WRLOCK_ERR_MSG << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (!exclusive && pthread_rwlock_rdlock(&vmLock))
+        {
+            std::cerr << RWLOCK_RDLOCK_ERR_MSG << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    void UnlockTree()
+    {
+        if (pthread_rwlock_unlock(&vmLock))
+        {
+            std::cerr << RWLOCK_UNLOCK_ERR_MSG << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /**
+     * Returns true if the table entry maps a huge block
+     */
+    static bool IsHugeEntry(word_t entry)
+    {
+        return (entry & HUGE_ENTRY_FLAG) != 0;
+    }
+
+    /**
+     * Returns the number of pages mapped by a huge entry found in a table at the given depth
+     * (the root table is at depth 0)
+     */
+    static uint64_t HugeBlockPages(int depth)
+    {
+        return (uint64_t) 1 << (Geometry::offsetWidth * (Geometry::tablesDepth - 1 - depth));
+    }
+
+    /**
+     * Returns the frame holding the page inside the huge block mapped by entry (found at the given depth)
+     */
+    static word_t HugeBlockFrame(word_t entry, uint64_t addressWithoutOffset, int depth)
+    {
+        return (entry & HUGE_FRAME_MASK) + (word_t) (addressWithoutOffset & (HugeBlockPages(depth) - 1));
+    }
+
+    /**
+     * Checks if the currentTable is empty by checking if all the frame cells with zero Value
+     */
+    bool CheckFrameEmpty(word_t currentTable) const
+    {
+        word_t childrenValue;
+        for (uint64_t i = 0; i < Geometry::pageSize ; i++)
+        {
+            memory.Read(currentTable * Geometry::pageSize + i,&childrenValue);
+            if (childrenValue != 0)
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * Returns the cyclic distance between two pages
+     */
+    static uint64_t CyclicDistance(uint64_t page1, uint64_t page2)
+    {
+        uint64_t cyclicDistance = (page1 > page2) ? page1 - page2 : page2 - page1;
+        uint64_t compare = Geometry::numPages - cyclicDistance;
+        return (cyclicDistance > compare) ? compare : cyclicDistance;
+    }
+
+    /**
+     * Checks if the cyclic distance between page and address is greater then current maximal distance,
+     * if so we will updated the parameters of current maximal distance frame.
+     * a huge mapping covers numPages pages starting at currentFrameAddress, its distance is the distance
+     * of its closest page.
+     */
+    static void CheckCyclicDistance(uint64_t addressWithoutOffset,word_t currentFrame,uint64_t currentFrameAddress,
+                                    uint64_t* currentMaxDistance,word_t* maxDistanceFrame,
+                                    uint64_t* maxDistanceAddress,uint64_t* maxDistanceParentAddress,
+                                    uint64_t currentFrameParentAddress, uint64_t numPages, uint64_t* maxDistancePages)
+    {
+        uint64_t lastPage = currentFrameAddress + numPages - 1;
+        uint64_t minDistance = 0;
+        if (addressWithoutOffset < currentFrameAddress || addressWithoutOffset > lastPage)
+        {
+            uint64_t firstDistance = CyclicDistance(currentFrameAddress, addressWithoutOffset);
+            uint64_t lastDistance = CyclicDistance(lastPage, addressWithoutOffset);
+            minDistance = (firstDistance > lastDistance) ? lastDistance : firstDistance;
+        }
+        if (minDistance > *currentMaxDistance)
+        {
+            *currentMaxDistance = minDistance;
+            *maxDistanceFrame = currentFrame;
+            *maxDistanceAddress = currentFrameAddress;
+            *maxDistanceParentAddress = currentFrameParentAddress;
+            *maxDistancePages = numPages;
+        }
+    }
+
+    /**
+     * This function runs on the frame table searching for an available frame,
+     * if found a frame which all children's are 0 - return it.
+     * Every frame it visits is marked in frameUsed, so when no empty table is found frameUsed holds all used frames
+     */
+    word_t TraversTree(uint64_t addressWithoutOffset,
+                       word_t currentFrame,
+                       uint64_t currentFrameParentAddress,
+                       uint64_t currentFrameAddress,
+                       word_t parentOfLookingFrame,
+                       int currentDepth,
+                       uint64_t* currentMaxDistance,
+                       word_t* maxDistanceFrame,
+                       uint64_t* maxDistanceAddress,
+                       uint64_t* maxDistanceParentAddress,
+                       uint64_t* maxDistancePages)
+    {
+        frameUsed[currentFrame] = true;
+
+        /// 1. if recursive call is on leaf - check the cyclic distance from the leaf to address
+        if (currentDepth == Geometry::tablesDepth)
+        {
+            CheckCyclicDistance(addressWithoutOffset,currentFrame,currentFrameAddress,currentMaxDistance,
+                                maxDistanceFrame,maxDistanceAddress,maxDistanceParentAddress,
+                                currentFrameParentAddress,1,maxDistancePages);
+            return 0;
+        }
+
+        /// 2. if found a frame that all of it children's are 0, reset the values of children's and return it
+        if (CheckFrameEmpty(currentFrame)  && currentFrame != parentOfLookingFrame)
+        {
+            memory.Write(currentFrameParentAddress ,0);
+            return currentFrame;
+        }
+
+        /// 3. run TraversTree on every children found that his value is not 0
+        word_t childrenValue;
+        for (uint64_t i = 0; i < Geometry::pageSize ; i++)
+        {
+            memory.Read(currentFrame * Geometry::pageSize + i,&childrenValue);
+            if (childrenValue == 0)
+                continue;
+
+            /// 3.1 a huge mapping is a leaf spanning several contiguous frames
+            if (IsHugeEntry(childrenValue))
+            {
+                word_t baseFrame = childrenValue & HUGE_FRAME_MASK;
+                uint64_t numPages = HugeBlockPages(currentDepth);
+                // a mapped block always fits in the physical memory, the bound only spells it out for the compiler
+                for (uint64_t j = 0 ; j < numPages && baseFrame + j < Geometry::numFrames ; j++)
+                    frameUsed[baseFrame + j] = true;
+
+                CheckCyclicDistance(addressWithoutOffset,baseFrame,
+                                    ((currentFrameAddress << Geometry::offsetWidth) + i) * numPages,
+                                    currentMaxDistance,maxDistanceFrame,maxDistanceAddress,maxDistanceParentAddress,
+                                    currentFrame * Geometry::pageSize + i,numPages,maxDistancePages);
+                continue;
+            }
+
+            /// 3.2 run the recursive call
+            word_t frameFoundBySearch = TraversTree(addressWithoutOffset,
+                                                    childrenValue,
+                                                    currentFrame * Geometry::pageSize + i,
+                                                    (currentFrameAddress << Geometry::offsetWidth) + i,
+                                                    parentOfLookingFrame,
+                                                    currentDepth + 1,
+                                                    currentMaxDistance,
+                                                    maxDistanceFrame,
+                                                    maxDistanceAddress,
+                                                    maxDistanceParentAddress,
+                                                    maxDistancePages);
+
+            /// 3.3 if found an available frame, return it
+            if(frameFoundBySearch != 0)
+                return frameFoundBySearch;
+        }
+        return 0;
+    }
+
+    /**
+     * Called whenever a frame which holds a page is evicted or repurposed.
+     * if the page was prefetched and never used, count it as wasted and shrink the prefetch window
+     */
+    void ReleasePrefetchedFrame(word_t frame)
+    {
+        if (!framePrefetched[frame])
+            return;
+
+        framePrefetched[frame] = false;
+        prefetchStats.wasted++;
+        prefetchWindow = (prefetchWindow / 2 > PREFETCH_MIN_WINDOW) ? prefetchWindow / 2 : PREFETCH_MIN_WINDOW;
+    }
+
+    /**
+     * Encode the page in frame as runs of equal differences between consecutive words.
+     * Returns false if the encoding is not smaller than the page
+     */
+    bool CompressPage(word_t frame, std::vector<word_t>& runs) const
+    {
+        uint64_t previous = 0;
+        for (uint64_t i = 0 ; i < Geometry::pageSize ; i++)
+        {
+            word_t value;
+            memory.Read(frame * Geometry::pageSize + i, &value);
+            word_t delta = (word_t) ((uint64_t) value - previous);
+            previous = (uint64_t) value;
+
+            if (!runs.empty() && runs.back() == delta)
+            {
+                runs[runs.size() - 2]++;
+                continue;
+            }
+            if ((runs.size() + 2) * sizeof(word_t) >= pageBytes)
+                return false;
+            runs.push_back(1);
+            runs.push_back(delta);
+        }
+        return true;
+    }
+
+    void DecompressPage(const std::vector<word_t>& runs, word_t frame)
+    {
+        uint64_t value = 0, address = frame * Geometry::pageSize;
+        for (size_t i = 0 ; i < runs.size() ; i += 2)
+        {
+            for (word_t j = 0 ; j < runs[i] ; j++)
+            {
+                value += (uint64_t) runs[i + 1];
+                memory.Write(address++, (word_t) value);
+            }
+        }
+    }
+
+    void RemoveFromSwapCache(SwapCacheIterator entry)
+    {
+        swapCacheStats.bytes -= entry->second.runs.size() * sizeof(word_t);
+        swapCacheStats.savedBytes -= pageBytes - entry->second.runs.size() * sizeof(word_t);
+        swapCacheStats.pages--;
+        swapCacheOrder.erase(entry->second.order);
+        swapCache.erase(entry);
+    }
+
+    /**
+     * Evict the page in frame: into the swap cache when it is enabled and the page compresses, otherwise to the
+     * backing store. The oldest pooled pages which do not fit anymore go to the backing store through frame,
+     * whose content is already compressed by then.
+     */
+    void SwapOut(word_t frame, uint64_t page)
+    {
+        if (swapCacheCapacity == 0)
+        {
+            memory.Evict(frame,page);
+            return;
+        }
+
+        std::vector<word_t> runs;
+        uint64_t bytes = 0;
+        if (CompressPage(frame, runs))
+            bytes = runs.size() * sizeof(word_t);
+        if (bytes == 0 || bytes > swapCacheCapacity)
+        {
+            swapCacheStats.rejected++;
+            memory.Evict(frame,page);
+            return;
+        }
+
+        while (swapCacheStats.bytes + bytes > swapCacheCapacity)
+        {
+            auto oldest = swapCache.find(swapCacheOrder.front());
+            DecompressPage(oldest->second.runs, frame);
+            memory.Evict(frame,oldest->first);
+            RemoveFromSwapCache(oldest);
+            swapCacheStats.writebacks++;
+        }
+
+        swapCacheOrder.push_back(page);
+        SwapCacheEntry& entry = swapCache[page];
+        entry.runs.swap(runs);
+        entry.order = std::prev(swapCacheOrder.end());
+        swapCacheStats.stored++;
+        swapCacheStats.pages++;
+        swapCacheStats.bytes += bytes;
+        swapCacheStats.savedBytes += pageBytes - bytes;
+    }
+
+    /**
+     * Restore page into frame, from the swap cache if it holds the page and from the backing store otherwise
+     */
+    void SwapIn(word_t frame, uint64_t page)
+    {
+        auto entry = swapCache.find(page);
+        if (entry != swapCache.end())
+        {
+            DecompressPage(entry->second.runs, frame);
+            RemoveFromSwapCache(entry);
+            swapCacheStats.hits++;
+            return;
+        }
+
+        memory.Restore(frame,page);
+        if (swapCacheCapacity != 0)
+            swapCacheStats.misses++;
+    }
+
+    /**
+     * Evict numPages pages stored in consecutive frames starting at frame, and unlink them from their parent
+     */
+    void EvictPages(word_t frame, uint64_t page, uint64_t numPages, uint64_t parentAddress)
+    {
+        for (uint64_t j = 0 ; j < numPages ; j++)
+        {
+            ReleasePrefetchedFrame(frame + j);
+            SwapOut(frame + j,page + j);
+        }
+        memory.Write(parentAddress,0);
+    }
+
+    /**
+     * Runs TraversTree from the root with fresh frameUsed marks.
+     * Returns an empty table (already unlinked from its parent) or 0, in which case frameUsed is complete and
+     * the max* parameters describe the most distinct page (maxDistanceFrame is 0 if there is nothing to evict)
+     */
+    word_t ScanTree(uint64_t addressWithoutOffset, word_t parentOfLookingFrame, word_t* maxDistanceFrame,
+                    uint64_t* maxDistanceAddress, uint64_t* maxDistanceParentAddress, uint64_t* maxDistancePages)
+    {
+        uint64_t maxDistance = 0;
+        *maxDistanceFrame = 0;
+        *maxDistanceAddress = 0;
+        *maxDistanceParentAddress = 0;
+        *maxDistancePages = 0;
+        for (uint64_t i = 0 ; i < Geometry::numFrames ; i++)
+            frameUsed[i] = false;
+
+        return TraversTree(addressWithoutOffset,
+                           0,
+                           0,
+                           0,
+                           parentOfLookingFrame,
+                           0,
+                           &maxDistance,
+                           maxDistanceFrame,
+                           maxDistanceAddress,
+                           maxDistanceParentAddress,
+                           maxDistancePages);
+    }
+
+    /**
+     * Returns the first frame of numFrames consecutive unused frames according to frameUsed, or 0 if there are
+     * none
+     */
+    word_t FindUnusedFrames(uint64_t numFrames) const
+    {
+        uint64_t runLength = 0;
+        for (uint64_t i = 1 ; i < Geometry::numFrames ; i++)
+        {
+            runLength = frameUsed[i] ? 0 : runLength + 1;
+            if (runLength == numFrames)
+                return (word_t) (i + 1 - numFrames);
+        }
+        return 0;
+    }
+
+    /**
+     * This functions search for an available frame by using the TraversTree function.
+     * it will return a frame by this priority:
+     * empty frame -> unused frame -> most distinct frame
+     * (without huge mappings the used frames are always 0..max, so the unused frame is the maximal frame + 1)
+     * @param parentOfLookingFrame - we will use this parameter to make sure that we wont replace the parent frame
+     * @param allowEviction - if false, return 0 instead of evicting a page (used by the prefetcher)
+     */
+    word_t FindAvailableFrame(uint64_t addressWithoutOffset, word_t parentOfLookingFrame, bool allowEviction = true)
+    {
+        /// 0. initialise all variables that will be given as reference to TraversTree
+        word_t maxDistanceFrame = 0;
+        uint64_t maxDistanceAddress = 0;
+        uint64_t maxDistanceParentAddress = 0;
+        uint64_t maxDistancePages = 0;
+
+        /// 1 run the search algorithm on tree
+        word_t FrameFound = ScanTree(addressWithoutOffset, parentOfLookingFrame, &maxDistanceFrame,
+                                     &maxDistanceAddress, &maxDistanceParentAddress, &maxDistancePages);
+
+        /// 2. FrameFound will be different then 0 if TraversTree found a frame that all of it children are 0
+        if (FrameFound != 0)
+            return FrameFound;
+
+        /// 3. Otherwise check if there is a frame the tree does not use
+        FrameFound = FindUnusedFrames(1);
+        if (FrameFound != 0)
+            return FrameFound;
+
+        /// 4. If none of the above - evict the most distinct page (or huge mapping) and return its first frame,
+        /// the rest of the frames of a huge mapping become unused
+        if (!allowEviction)
+            return 0;
+
+        EvictPages(maxDistanceFrame,maxDistanceAddress,maxDistancePages,maxDistanceParentAddress);
+        return maxDistanceFrame;
+    }
+
+    /**
+     * This function Reset Frame by changing all the values to zero
+     */
+    void ResetFrame(word_t frame)
+    {
+        for (uint64_t j = 0 ; j < Geometry::pageSize ; j++)
+        {
+            memory.Write(frame * Geometry::pageSize + j,0);
+        }
+    }
+
+    /**
+     * Maps the page into the tree ahead of time, using only frames that are free (no eviction).
+     * Returns false if the page could not be prefetched because there are no free frames left.
+     */
+    bool PrefetchPage(uint64_t page)
+    {
+        uint64_t treeDepthsAddress[Geometry::tablesDepth];
+        Geometry::Split(page,treeDepthsAddress);
+
+        word_t currentFrameAddress = 0;
+        for (int i = 0 ; i < Geometry::tablesDepth ; i++)
+        {
+            word_t parentFrameAddress = currentFrameAddress;
+            memory.Read(currentFrameAddress * Geometry::pageSize + treeDepthsAddress[i], &currentFrameAddress);
+            // page is part of a resident huge mapping
+            if (IsHugeEntry(currentFrameAddress))
+                return true;
+
+            // table (or the page itself) is already resident
+            if (currentFrameAddress != 0)
+                continue;
+
+            currentFrameAddress = FindAvailableFrame(page, parentFrameAddress, false);
+            if (currentFrameAddress == 0)
+                return false;
+
+            if (i == Geometry::tablesDepth - 1)
+            {
+                SwapIn(currentFrameAddress,page);
+                framePrefetched[currentFrameAddress] = true;
+                prefetchStats.issued++;
+            }
+            else
+                ResetFrame(currentFrameAddress);
+
+            memory.Write(parentFrameAddress * Geometry::pageSize + treeDepthsAddress[i], currentFrameAddress);
+        }
+        return true;
+    }
+
+    /**
+     * Detects a sequential fault stream and restores the next prefetchWindow pages after the faulting one.
+     * every sequential fault doubles the window, wasted prefetches halve it (see ReleasePrefetchedFrame)
+     */
+    void ReadAhead(uint64_t faultPage)
+    {
+        if (faultPage != expectedFaultPage)
+        {
+            expectedFaultPage = faultPage + 1;
+            return;
+        }
+
+        prefetchStats.sequentialFaults++;
+        uint64_t page = faultPage + 1;
+        for (uint64_t i = 0 ; i < prefetchWindow && page < Geometry::numPages ; i++, page++)
+        {
+            if (!PrefetchPage(page))
+                break;
+        }
+        expectedFaultPage = page;
+        prefetchWindow = (prefetchWindow * 2 < PREFETCH_MAX_WINDOW) ? prefetchWindow * 2 : PREFETCH_MAX_WINDOW;
+    }
+
+    /**
+     * During translation of virtual address to physical one,
+     * Whenever we encounter an empty frame -  we will create a new frame for it.
+     * @param ind - the index of the empty frame from the treeDepthsAddress array
+     */
+    word_t FaultPageHandler(uint64_t addressWithoutOffset,word_t parentFrameAddress,uint64_t treeDepthsAddress[],
+                            int ind)
+    {
+        word_t frameFound = FindAvailableFrame(addressWithoutOffset, parentFrameAddress);
+
+        if (ind == Geometry::tablesDepth - 1)
+            SwapIn(frameFound,addressWithoutOffset);
+        else
+            ResetFrame(frameFound);
+
+        memory.Write(parentFrameAddress * Geometry::pageSize + treeDepthsAddress[ind], frameFound);
+
+        if (ind == Geometry::tablesDepth - 1 && prefetchEnabled)
+            ReadAhead(addressWithoutOffset);
+
+        return frameFound;
+    }
+
+    /**
+     * this function find a PhysicalMemory Address for a specific VirtualAddress, faulting in every table and the
+     * page which are not resident. the tree must be locked exclusive
+     */
+    uint64_t FindPhysicalAddress(uint64_t virtualAddress)
+    {
+        /// 1. split address to tree depths instructions
+        uint64_t treeDepthsAddress[Geometry::tablesDepth];
+        uint64_t addressWithoutOffset = Geometry::Page(virtualAddress);
+        Geometry::Split(addressWithoutOffset,treeDepthsAddress);
+
+        /// 2. Get physical address of the virtual one
+        word_t currentFrameAddress = 0 ;
+        for (int i = 0 ; i < Geometry::tablesDepth ; i++)
+        {
+            word_t parentFrameAddress = currentFrameAddress;
+            memory.Read(currentFrameAddress * Geometry::pageSize + treeDepthsAddress[i], &currentFrameAddress);
+            // a huge mapping ends the walk early
+            if (IsHugeEntry(currentFrameAddress))
+                return HugeBlockFrame(currentFrameAddress,addressWithoutOffset,i) * Geometry::pageSize +
+                       Geometry::Offset(virtualAddress);
+
+            if (currentFrameAddress == 0)
+            {
+                // Handle empty frame found
+                currentFrameAddress = FaultPageHandler(addressWithoutOffset,parentFrameAddress,treeDepthsAddress,i);
+            }
+            else if (i == Geometry::tablesDepth - 1 && framePrefetched[currentFrameAddress])
+            {
+                // first use of a prefetched page
+                framePrefetched[currentFrameAddress] = false;
+                prefetchStats.hits++;
+            }
+        }
+        return currentFrameAddress * Geometry::pageSize + Geometry::Offset(virtualAddress);
+    }
+
+    /**
+     * Translate virtual address without faulting, the tree must be locked (at least shared).
+     * Returns false if any table or the page itself is not resident, or if the page is a prefetched page
+     * that was not used yet (its first use updates the prefetch state, so it has to go through FindPhysicalAddress)
+     */
+    bool FindResidentAddress(uint64_t virtualAddress, uint64_t* physicalAddress) const
+    {
+        uint64_t treeDepthsAddress[Geometry::tablesDepth];
+        Geometry::Split(Geometry::Page(virtualAddress),treeDepthsAddress);
+
+        word_t currentFrameAddress = 0;
+        for (int i = 0 ; i < Geometry::tablesDepth ; i++)
+        {
+            memory.Read(currentFrameAddress * Geometry::pageSize + treeDepthsAddress[i], &currentFrameAddress);
+            if (IsHugeEntry(currentFrameAddress))
+            {
+                currentFrameAddress = HugeBlockFrame(currentFrameAddress,Geometry::Page(virtualAddress),i);
+                *physicalAddress = currentFrameAddress * Geometry::pageSize + Geometry::Offset(virtualAddress);
+                return true;
+            }
+            if (currentFrameAddress == 0)
+                return false;
+        }
+        if (framePrefetched[currentFrameAddress])
+            return false;
+
+        *physicalAddress = currentFrameAddress * Geometry::pageSize + Geometry::Offset(virtualAddress);
+        return true;
+    }
+
+    /**
+     * Evict every page mapped under the table entry at parentAddress (found at the given depth) and unlink it.
+     * the tables of the subtree are simply dropped, the allocator sees their frames as unused
+     * @param page - the first page mapped by the entry
+     */
+    void EvictSubtree(uint64_t parentAddress, int depth, uint64_t page)
+    {
+        word_t entry;
+        memory.Read(parentAddress,&entry);
+        if (entry == 0)
+            return;
+
+        if (IsHugeEntry(entry) || depth == Geometry::tablesDepth - 1)
+        {
+            uint64_t numPages = IsHugeEntry(entry) ? HugeBlockPages(depth) : 1;
+            EvictPages(entry & HUGE_FRAME_MASK,page,numPages,parentAddress);
+            return;
+        }
+
+        for (uint64_t i = 0 ; i < Geometry::pageSize ; i++)
+        {
+            EvictSubtree(entry * Geometry::pageSize + i,depth + 1,page + i * HugeBlockPages(depth + 1));
+        }
+        memory.Write(parentAddress,0);
+    }
+
+    /**
+     * Map the huge block of pageSize^levels pages containing addressWithoutOffset to consecutive frames,
+     * the tree must be locked exclusive. pages of the block that were already mapped are evicted and restored
+     * into the block. Returns false if no run of free frames could be made large enough.
+     */
+    bool MapHugeBlock(uint64_t addressWithoutOffset, int levels)
+    {
+        int depth = Geometry::tablesDepth - 1 - levels;
+        uint64_t numPages = HugeBlockPages(depth);
+        uint64_t firstPage = addressWithoutOffset & ~(numPages - 1);
+
+        uint64_t treeDepthsAddress[Geometry::tablesDepth];
+        Geometry::Split(addressWithoutOffset,treeDepthsAddress);
+
+        /// 1. walk (and create) the tables down to the table which will hold the huge entry
+        word_t currentFrameAddress = 0;
+        for (int i = 0 ; i < depth ; i++)
+        {
+            word_t parentFrameAddress = currentFrameAddress;
+            memory.Read(currentFrameAddress * Geometry::pageSize + treeDepthsAddress[i], &currentFrameAddress);
+            if (IsHugeEntry(currentFrameAddress))
+                return false;
+            if (currentFrameAddress == 0)
+                currentFrameAddress = FaultPageHandler(addressWithoutOffset,parentFrameAddress,treeDepthsAddress,i);
+        }
+        word_t tableFrame = currentFrameAddress;
+        uint64_t entryAddress = tableFrame * Geometry::pageSize + treeDepthsAddress[depth];
+
+        word_t entry;
+        memory.Read(entryAddress,&entry);
+        if (IsHugeEntry(entry))
+            return true;
+
+        /// 2. move the pages of the block which are already mapped to the backing store
+        EvictSubtree(entryAddress,depth,firstPage);
+
+        /// 3. free frames until there is a run of numPages unused frames
+        word_t maxDistanceFrame;
+        uint64_t maxDistanceAddress, maxDistanceParentAddress, maxDistancePages;
+        word_t baseFrame = 0;
+        while (baseFrame == 0)
+        {
+            // empty tables found by the scan are unlinked by it, scan again to see the frame as unused
+            if (ScanTree(firstPage,tableFrame,&maxDistanceFrame,&maxDistanceAddress,
+                         &maxDistanceParentAddress,&maxDistancePages) != 0)
+                continue;
+
+            baseFrame = FindUnusedFrames(numPages);
+            if (baseFrame != 0)
+                break;
+
+            // nothing left to evict - the block does not fit in the physical memory
+            if (maxDistanceFrame == 0)
+                return false;
+            EvictPages(maxDistanceFrame,maxDistanceAddress,maxDistancePages,maxDistanceParentAddress);
+        }
+
+        /// 4. restore the block and link it
+        for (uint64_t j = 0 ; j < numPages ; j++)
+            SwapIn(baseFrame + j,firstPage + j);
+        memory.Write(entryAddress,HUGE_ENTRY_FLAG | baseFrame);
+        return true;
+    }
+
+    /**
+     * Unmap the pages firstPage..lastPage which are mapped under the table entry at entryAddress
+     * (found at the given depth), without writing them back. tables which become empty are unlinked,
+     * so all the frames released can be used right away by FindAvailableFrame.
+     * @param page - the first page mapped by the entry
+     */
+    void FreeEntry(uint64_t entryAddress, int depth, uint64_t page, uint64_t firstPage, uint64_t lastPage)
+    {
+        word_t entry;
+        memory.Read(entryAddress,&entry);
+        if (entry == 0)
+            return;
+
+        /// 1. a single page - drop it
+        if (depth == Geometry::tablesDepth - 1)
+        {
+            ReleasePrefetchedFrame(entry);
+            memory.Write(entryAddress,0);
+            return;
+        }
+
+        /// 2. a huge mapping - pages of the block outside the range are evicted, so they are kept
+        if (IsHugeEntry(entry))
+        {
+            word_t baseFrame = entry & HUGE_FRAME_MASK;
+            for (uint64_t j = 0 ; j < HugeBlockPages(depth) ; j++)
+            {
+                if (page + j < firstPage || page + j > lastPage)
+                    SwapOut(baseFrame + j,page + j);
+            }
+            memory.Write(entryAddress,0);
+            return;
+        }
+
+        /// 3. a table - free the children in range, and unlink the table if nothing is left in it
+        uint64_t childPages = HugeBlockPages(depth + 1);
+        uint64_t firstChild = (firstPage > page) ? (firstPage - page) / childPages : 0;
+        uint64_t lastChild = (lastPage - page) / childPages;
+        if (lastChild > Geometry::pageSize - 1)
+            lastChild = Geometry::pageSize - 1;
+
+        for (uint64_t i = firstChild ; i <= lastChild ; i++)
+        {
+            FreeEntry(entry * Geometry::pageSize + i,depth + 1,page + i * childPages,firstPage,lastPage);
+        }
+        if (CheckFrameEmpty(entry))
+            memory.Write(entryAddress,0);
+    }
+
+    /**
+     * Evict every page mapped under the table entry at entryAddress (found at the given depth) to the backing
+     * store and unlink the entry
+     * @param page - the first page mapped by the entry
+     */
+    void EvictEntry(uint64_t entryAddress, int depth, uint64_t page)
+    {
+        word_t entry;
+        memory.Read(entryAddress,&entry);
+        if (entry == 0)
+            return;
+
+        if (depth == Geometry::tablesDepth - 1)
+        {
+            ReleasePrefetchedFrame(entry);
+            memory.Evict(entry,page);
+        }
+        else if (IsHugeEntry(entry))
+        {
+            word_t baseFrame = entry & HUGE_FRAME_MASK;
+            for (uint64_t j = 0 ; j < HugeBlockPages(depth) ; j++)
+                memory.Evict(baseFrame + j,page + j);
+        }
+        else
+        {
+            for (uint64_t i = 0 ; i < Geometry::pageSize ; i++)
+                EvictEntry(entry * Geometry::pageSize + i,depth + 1,page + i * HugeBlockPages(depth + 1));
+        }
+        memory.Write(entryAddress,0);
+    }
+
+    /**
+     * Translate virtual address while holding the tree lock.
+     * resident pages are translated under the shared lock so translations run in parallel,
+     * only when a fault is needed the shared lock is dropped and the walk is repeated under the exclusive lock.
+     * The lock stays held on return so the caller can access the physical address before it gets evicted.
+     */
+    uint64_t LockAndTranslate(uint64_t virtualAddress)
+    {
+        uint64_t physicalAddress;
+        LockTree(false);
+        if (FindResidentAddress(virtualAddress, &physicalAddress))
+            return physicalAddress;
+        UnlockTree();
+
+        LockTree(true);
+        return FindPhysicalAddress(virtualAddress);
+    }
+
+    Memory memory;
+
+    /// Prefetch State ///
+    bool prefetchEnabled;
+    uint64_t prefetchWindow;
+    uint64_t expectedFaultPage;                // the page a sequential stream is expected to fault on next
+    bool framePrefetched[Geometry::numFrames]; // frames holding a prefetched page which was not used yet
+    PrefetchStats prefetchStats;
+
+    /// Swap Cache State ///
+    uint64_t swapCacheCapacity; // pool size in bytes, 0 when disabled
+    std::unordered_map<uint64_t, SwapCacheEntry> swapCache;
+    std::list<uint64_t> swapCacheOrder;
+    SwapCacheStats swapCacheStats;
+
+    /// Frame Allocation State ///
+    bool frameUsed[Geometry::numFrames]; // filled by TraversTree
+
+    /// Concurrency State ///
+    // translations of resident pages hold the lock shared, faults (which may evict) hold it exclusive.
+    // one lock covers the whole tree on purpose: a fault may take its frame from any subtree (the unused frame
+    // search and the eviction victim search both walk the whole tree) and it updates the engine's state
+    // (frameUsed, the prefetch window, the swap cache), so with per-subtree locks every fault would still have
+    // to lock all of them, while every translation would pay a lock per level instead of one shared lock
+    pthread_rwlock_t vmLock;
+};
+
+template <class Geometry, class Memory> constexpr uint64_t VirtualMemoryEngine<Geometry, Memory>::noPage;
+template <class Geometry, class Memory> constexpr uint64_t VirtualMemoryEngine<Geometry, Memory>::pageBytes;
+
+#endif //VIRTUAL_MEMORY_ENGINE_H
@@ -0,0 +1,86 @@
+#ifndef VIRTUAL_MEMORY_EXT_H
+#define VIRTUAL_MEMORY_EXT_H
+
+#include "MemoryConstants.h"
+
+/// Extensions to the VirtualMemory API ///
+// VMread / VMwrite and every function below are thread safe: translations of resident pages run in
+// parallel, page faults and evictions are serialized.
+
+/**
+ * Read-ahead statistics.
+ * accuracy of the prefetcher is hits / issued
+ */
+typedef struct PrefetchStats {
+    uint64_t issued;           // pages restored ahead of time
+    uint64_t hits;             // prefetched pages that were later accessed
+    uint64_t wasted;           // prefetched pages evicted before being accessed
+    uint64_t sequentialFaults; // faults detected as part of a sequential stream
+    uint64_t window;           // current read-ahead window (in pages)
+} PrefetchStats;
+
+/**
+ * Enable or disable sequential read-ahead on page faults (disabled by default)
+ */
+void VMsetPrefetch(bool enabled);
+
+/**
+ * Copy the prefetch statistics gathered since the last VMinitialize into stats
+ */
+void VMgetPrefetchStats(PrefetchStats* stats);
+
+/**
+ * Compressed swap cache statistics.
+ * hit rate of the cache is hits / (hits + misses)
+ */
+typedef struct SwapCacheStats {
+    uint64_t stored;     // evicted pages kept compressed in the pool
+    uint64_t rejected;   // evicted pages which did not compress below a page (or fit the pool), sent to PMevict
+    uint64_t writebacks; // pooled pages sent to PMevict to make room for newer ones
+    uint64_t hits;       // restores served from the pool
+    uint64_t misses;     // restores which went to PMrestore
+    uint64_t pages;      // pages in the pool now
+    uint64_t bytes;      // compressed bytes in the pool now
+    uint64_t savedBytes; // bytes the pooled pages would take uncompressed, minus bytes
+} SwapCacheStats;
+
+/**
+ * Keep evicted pages compressed in an in-memory pool of up to poolBytes bytes before the backing store
+ * (0, the default, disables it). Restores look in the pool first, and when the pool is full its oldest pages
+ * are written to the backing store. Once disabled, pages already in the pool stay there until restored.
+ */
+void VMsetSwapCache(uint64_t poolBytes);
+
+/**
+ * Copy the swap cache statistics gathered since the last VMinitialize into stats
+ */
+void VMgetSwapCacheStats(SwapCacheStats* stats);
+
+/**
+ * Map the aligned block of PAGE_SIZE^levels pages which contains virtualAddress to consecutive frames.
+ * the walk of every address in the block ends at the table levels levels above the pages, so the block needs
+ * no page tables of its own. pages of the block which were already mapped keep their content.
+ * When the block is evicted every page goes to the backing store separately and is restored as a regular page.
+ * @param levels - 1 <= levels < TABLES_DEPTH
+ * @return 1 on success, 0 if the arguments are invalid or the block does not fit in the physical memory
+ */
+int VMmapHuge(uint64_t virtualAddress, int levels);
+
+/**
+ * Unmap every page which holds an address in [virtualAddress, virtualAddress + length).
+ * resident pages are dropped without PMevict, tables left empty are unlinked, and their frames are
+ * reused by the next page fault. A freed page which is accessed again starts with undefined content
+ * (the backing store has no way to discard pages that were evicted before).
+ * pages of a huge mapping outside the range are evicted and later restored as regular pages.
+ * @return 1 on success, 0 if the range exceeds the virtual memory
+ */
+int VMfree(uint64_t virtualAddress, uint64_t length);
+
+/**
+ * Evict every resident page, and every page of the swap cache, to the backing store and empty the tree.
+ * the backing store then holds the whole virtual memory, so with a persistent backing store
+ * (FilePhysicalMemory.h) a later VMinitialize can carry on from it.
+ */
+void VMsync();
+
+#endif //VIRTUAL_MEMORY_EXT_H
@@ -7,18 +7,56 @@
 #include <wait.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
-#include <fstream>
-#include <iostream>
-#include <string>
 #include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <mntent.h>
+#include <signal.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
 
 /// CONSTANTS ///
-#define STACK_SIZE 8192
+#define STACK_SIZE (1024 * 1024)
 #define DIR_PERMISSIONS 0755
 #define SUCCESS 0
-#define UNMOUNT 0
-#define REMOVE_FILES 1
 #define FAILURE -1
+#define CONTAINER_FLAGS (SIGCHLD | CLONE_NEWUTS | CLONE_NEWPID | CLONE_NEWNS)
+#define OPEN_FD_LIMIT 64
+#define MAX_EVENTS 64
+#define MAX_REQUEST_SIZE (64 * 1024)
+#define LENGTH_SIZE 4
+#define REQUEST_READ_CHUNK 4096
+#define STANDARD_FDS 3
+#define DEFAULT_POOL_SIZE 4
+#define LISTEN_BACKLOG 128
+#define SPEC_ARGUMENTS 4
+#define DEFAULT_CONCURRENCY 4
+#define COMMENT '#'
+#define QUOTES "\"'"
+#define OVERLAY_FLAG "-o"
+#define REPORT_FLAG "-r"
+#define SCRATCH_OPTIONS "mode=0755"
+#define TEMPORARY_SUFFIX ".XXXXXX"
+
+/// MODES ///
+#define ZYGOTE "zygote"
+#define RUN "run"
+#define BENCH "bench"
+#define DIRECT "-"
+#define BATCH "batch"
+#define GAP_FLAG "-g"
 
 /// PATHS ///
 #define PROC_PATH "/proc"
@@ -28,9 +66,17 @@
 #define PID_MAX_FILEPATH "/sys/fs/cgroup/pids/pids.max"
 #define C_GROUP_PROC_FILEPATH "/sys/fs/cgroup/pids/cgroup.procs"
 #define NOTIFY_RELEASE_FILEPATH "/sys/fs/cgroup/pids/notify_on_release"
-
-/// COMMANDS ///
-#define REMOVE_COMMAND "rm -r "
+#define UPPER_PATH "/upper"
+#define WORK_PATH "/work"
+#define MERGED_PATH "/merged"
+#define MOUNTS_PATH "/proc/self/mounts"
+#define CGROUP_FILESYSTEM "cgroup2"
+#define CGROUP_PARENT_PATH "/container"
+#define CGROUP_PROCS_PATH "/cgroup.procs"
+#define SUBTREE_CONTROL_PATH "/cgroup.subtree_control"
+#define CPU_STAT_PATH "/cpu.stat"
+#define MEMORY_STAT_PATH "/memory.stat"
+#define MEMORY_PEAK_PATH "/memory.peak"
 
 /// ERROR MESSAGES ///
 #define SYSTEM_ERROR "system error: "
@@ -39,12 +85,107 @@
 #define HOST_NAME_ERROR_MSG "Change Host Name Failure"
 #define CHDIR_ERROR_MSG "Directory Change Failure"
 #define MOUNT_ERROR_MSG "Mount Failure"
-#define UMOUNT_ERROR_MSG "Umount Failure"
 #define MKDIR_ERROR_MSG "Folder Creation Failure"
+#define REMOVE_ERROR_MSG "Folder Removal Failure"
+#define WRITE_FILE_ERROR_MSG "File Write Failure"
 #define CONTAINER_PROGRAM_ERROR_MSG "Container Program Failure"
 #define CLONE_ERROR_MSG "Clone Failure"
+#define WAIT_ERROR_MSG "Wait Failure"
+#define SOCKET_ERROR_MSG "Socket Failure"
+#define EPOLL_ERROR_MSG "Epoll Failure"
+#define SIGNAL_ERROR_MSG "Signal Failure"
+#define PID_FD_ERROR_MSG "Pid Fd Failure"
+#define REQUEST_ERROR_MSG "Container Request Failure"
+#define CGROUP_ERROR_MSG "Cgroup Failure"
+#define MANIFEST_ERROR_MSG "Manifest Failure"
+#define USAGE_MSG "Usage: container [options] <hostname> <root> <pids max> <program> [args...]\n" \
+                  "       container zygote <socket path> [pool size]\n" \
+                  "       container run <socket path> [options] <hostname> <root> <pids max> <program> [args...]\n" \
+                  "       container bench <count> <socket path|-> [-g <gap ms>] [options] <hostname> <root> <pids max> " \
+                  "<program> [args...]\n" \
+                  "       container batch <manifest> [concurrency]\n" \
+                  "options: -o (overlay root) -r (report usage) -c <cpu.max> -w <cpu.weight> -m <memory.max>\n" \
+                  "         -H <memory.high> -i <io.max> -s <cpuset.cpus>"
+
+
+/// CGROUP LIMITS ///
+// option and cgroup v2 file it sets, the controller is the file name up to the '.'
+const char *LimitOptions[][2] = {{"-c", "cpu.max"}, {"-w", "cpu.weight"}, {"-m", "memory.max"},
+                                 {"-H", "memory.high"}, {"-i", "io.max"}, {"-s", "cpuset.cpus"}};
+const char *MemoryStatKeys[] = {"anon", "file", "kernel", "sock", "pgfault", "pgmajfault"};
+
+
+/**
+ * Everything needed to start one container: the host name, the root directory, the pids limit and the program
+ * to run with its arguments. With Overlay the container sees a private copy-on-write view of the root. With
+ * Limits (cgroup v2 file, value) or Report it runs in its own cgroup v2 group, whose path the launcher sets in
+ * Cgroup, and its usage is reported when it exits.
+ */
+typedef struct ContainerSpec {
+    bool Overlay;
+    bool Report;
+    std::vector<std::pair<std::string, std::string>> Limits;
+    std::string Cgroup;
+    std::string HostName;
+    std::string Root;
+    std::string PidsMax;
+    std::vector<std::string> Program;
+} ContainerSpec;
+
+/**
+ * What a container cloned by the zygote starts with: its end of the request socket and, for a prepared
+ * container, the root it enters before any request arrives (nullptr otherwise)
+ */
+typedef struct ZygoteChildArguments {
+    int RequestFd;
+    const char *Root;
+} ZygoteChildArguments;
+
+/**
+ * A container cloned ahead of time by the zygote, waiting on RequestFd for the spec it should run
+ */
+typedef struct ReadyContainer {
+    pid_t Pid;
+    int PidFd;
+    int RequestFd;
+} ReadyContainer;
 
+/**
+ * The zygote's ready containers by the root they are prepared for, "" for unprepared ones
+ */
+typedef std::map<std::string, std::deque<ReadyContainer>> ZygotePools;
+
+/**
+ * One line of a batch manifest and how it ran
+ */
+typedef struct BatchEntry {
+    int Line;
+    ContainerSpec Spec;
+    pid_t Pid;
+    int PidFd;
+    bool Started;
+    int Status;
+    std::chrono::steady_clock::time_point Start;
+    std::chrono::steady_clock::time_point End;
+} BatchEntry;
+
+/**
+ * A container started by the zygote, the exit status is sent back on ClientFd
+ */
+typedef struct RunningContainer {
+    pid_t Pid;
+    int ClientFd;
+    std::string Cgroup;
+} RunningContainer;
 
+/**
+ * A request the zygote is still reading, its bytes may arrive over several reads
+ */
+typedef struct PartialRequest {
+    std::string Bytes; // the length and as much of the arguments as arrived
+    int Fds[STANDARD_FDS];
+    bool HasFds;
+} PartialRequest;
 
 
 /**
@@ -57,101 +198,339 @@ void CreateErrorMessage(const std::string& msg)
 }
 
 
+/**
+ * nftw callback which removes a single file or (already emptied) folder
+ */
+int RemoveEntry(const char *Path, const struct stat *Stat, int Type, struct FTW *Walk) {
+    return remove(Path);
+}
+
+
 /**
  * This function removes all the files which created in pids folder and removes all the folders that
- * created by the Child function.
- */
-void RemoveManager(const char *BaseFileSystemPath, const char *ExtraPath, int command) {
-    std::string BasePath = BaseFileSystemPath;
-    std::string ExtPath = ExtraPath;
-    std::string AllPath = BasePath + ExtPath;
-    if (command == UNMOUNT) {
-        const char *unmountPath = AllPath.c_str();
-        if (umount(unmountPath) != SUCCESS) {
-            CreateErrorMessage(UMOUNT_ERROR_MSG);
-            exit(1);
-        }
+ * created for the container, walking the tree bottom up instead of spawning a shell for "rm -r"
+ */
+void RemoveManager(const std::string& BaseFileSystemPath, const char *ExtraPath) {
+    std::string AllPath = BaseFileSystemPath + ExtraPath;
+    if (nftw(AllPath.c_str(), RemoveEntry, OPEN_FD_LIMIT, FTW_DEPTH | FTW_PHYS | FTW_MOUNT) != SUCCESS &&
+        errno != ENOENT) {
+        CreateErrorMessage(REMOVE_ERROR_MSG);
+        exit(1);
+    }
+}
+
+
+/**
+ * This function removes the folders and files created for the container. /proc is mounted privately inside
+ * the container's mount namespace, so it is released together with the namespace and needs no umount here.
+ */
+void RemovePath(const ContainerSpec& Spec) {
+    RemoveManager(Spec.Root, FS_PATH);
+}
+
+
+/**
+ * Replace the file at Path with Content, returns false on failure. Containers of one root share its files, so
+ * the content is written to a temporary file which is renamed over Path: a reader never sees it half written.
+ */
+bool WriteFile(const char *Path, const std::string& Content) {
+    std::string Temporary = std::string(Path) + TEMPORARY_SUFFIX;
+    int Fd = mkostemp(&Temporary[0], O_CLOEXEC);
+    if (Fd == FAILURE) {
+        return false;
+    }
+    bool Written = write(Fd, Content.data(), Content.size()) == (ssize_t) Content.size() &&
+                   fchmod(Fd, DIR_PERMISSIONS) == SUCCESS;
+    close(Fd);
+    if (!Written || rename(Temporary.c_str(), Path) != SUCCESS) {
+        unlink(Temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Write the pids folder files which do not depend on the spec, returns false on failure
+ */
+bool WriteProcessFiles() {
+    return WriteFile(C_GROUP_PROC_FILEPATH, std::to_string(getpid())) && WriteFile(NOTIFY_RELEASE_FILEPATH, "1");
+}
+
+
+/**
+ * This function creates three files in the pids folders and writes to the files relevant information
+ */
+
+void CreateFiles(const ContainerSpec& Spec) {
+    if (!WriteFile(PID_MAX_FILEPATH, Spec.PidsMax) || !WriteProcessFiles()) {
+        CreateErrorMessage(WRITE_FILE_ERROR_MSG);
+        exit(1);
+    }
+}
+
+
+/**
+ * Write Value into an existing control file (cgroupfs), returns false on failure
+ */
+bool WriteControl(const std::string& Path, const std::string& Value) {
+    int Fd = open(Path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (Fd == FAILURE) {
+        return false;
+    }
+    bool Written = write(Fd, Value.data(), Value.size()) == (ssize_t) Value.size();
+    close(Fd);
+    return Written;
+}
+
+
+/**
+ * Read a whole (small) file, returns an empty string if it can not be read
+ */
+std::string ReadControl(const std::string& Path) {
+    std::string Content;
+    int Fd = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (Fd == FAILURE) {
+        return Content;
     }
-    if (command == REMOVE_FILES) {
-        std::string removeCommandString = REMOVE_COMMAND + AllPath;
-        const char *removeFilesCommand = removeCommandString.c_str();
-        system(removeFilesCommand);
+    char Buffer[4096];
+    ssize_t Read;
+    while ((Read = read(Fd, Buffer, sizeof(Buffer))) > 0) {
+        Content.append(Buffer, Read);
     }
+    close(Fd);
+    return Content;
+}
 
+
+/**
+ * Where the cgroup v2 hierarchy is mounted, empty if it is not
+ */
+std::string CgroupRoot() {
+    static std::string Root;
+    if (!Root.empty()) {
+        return Root;
+    }
+    FILE *Mounts = setmntent(MOUNTS_PATH, "re");
+    if (Mounts == nullptr) {
+        return Root;
+    }
+    struct mntent *Entry;
+    while ((Entry = getmntent(Mounts)) != nullptr) {
+        if (strcmp(Entry->mnt_type, CGROUP_FILESYSTEM) == 0) {
+            Root = Entry->mnt_dir;
+            break;
+        }
+    }
+    endmntent(Mounts);
+    return Root;
 }
 
 
 /**
- * This function sends relevant directories and flags for the Umount func and the remove of the files and folders
+ * Create the container's cgroup under <cgroup v2 root>/container, enabling the controllers its limits need on
+ * the way down, and write its limits. Sets Spec.Cgroup, returns false on failure.
  */
-void RemovePath(char **argv) {
+bool CreateCgroup(ContainerSpec& Spec) {
+    static unsigned long Created = 0;
+    std::string Root = CgroupRoot();
+    if (Root.empty()) {
+        CreateErrorMessage(CGROUP_ERROR_MSG);
+        return false;
+    }
 
-    // unmount
-    RemoveManager(argv[2], PROC_PATH, UNMOUNT);
+    std::set<std::string> Controllers;
+    for (const auto& Limit : Spec.Limits) {
+        Controllers.insert(Limit.first.substr(0, Limit.first.find('.')));
+    }
+    std::string Parent = Root + CGROUP_PARENT_PATH;
+    if (mkdir(Parent.c_str(), DIR_PERMISSIONS) != SUCCESS && errno != EEXIST) {
+        CreateErrorMessage(CGROUP_ERROR_MSG);
+        return false;
+    }
+    for (const std::string& Controller : Controllers) {
+        if (!WriteControl(Root + SUBTREE_CONTROL_PATH, "+" + Controller) ||
+            !WriteControl(Parent + SUBTREE_CONTROL_PATH, "+" + Controller)) {
+            CreateErrorMessage(std::string(CGROUP_ERROR_MSG) + " (" + Controller + " controller)");
+            return false;
+        }
+    }
 
-    // remove directories and files
-    RemoveManager(argv[2],FS_PATH,REMOVE_FILES);
+    std::string Cgroup = Parent + "/" + Spec.HostName + "." + std::to_string(getpid()) + "." +
+                         std::to_string(Created++);
+    if (mkdir(Cgroup.c_str(), DIR_PERMISSIONS) != SUCCESS) {
+        CreateErrorMessage(CGROUP_ERROR_MSG);
+        return false;
+    }
+    for (const auto& Limit : Spec.Limits) {
+        if (!WriteControl(Cgroup + "/" + Limit.first, Limit.second)) {
+            CreateErrorMessage(std::string(CGROUP_ERROR_MSG) + " (" + Limit.first + ")");
+            rmdir(Cgroup.c_str());
+            return false;
+        }
+    }
+    Spec.Cgroup = Cgroup;
+    return true;
 }
 
 
+/**
+ * Move a process (0 for the caller) into a cgroup
+ */
+bool JoinCgroup(const std::string& Cgroup, pid_t Pid) {
+    return WriteControl(Cgroup + CGROUP_PROCS_PATH, std::to_string(Pid));
+}
+
 
 /**
- * This function creates three files in the pids folders and writes to the files relevant information
+ * Append the "key value" lines of a stat file to Report as key=value, all of them or only Keys
+ */
+void AppendStat(std::string& Report, const std::string& Content, const std::set<std::string>& Keys) {
+    size_t Start = 0;
+    while (Start < Content.size()) {
+        size_t End = std::min(Content.find('\n', Start), Content.size());
+        size_t Space = Content.find(' ', Start);
+        if (Space < End) {
+            std::string Key = Content.substr(Start, Space - Start);
+            if (Keys.empty() || Keys.count(Key) != 0) {
+                Report += " " + Key + "=" + Content.substr(Space + 1, End - Space - 1);
+            }
+        }
+        Start = End + 1;
+    }
+}
+
+
+/**
+ * Usage of a finished container: all of cpu.stat, the main memory.stat counters and memory.peak, as far as the
+ * enabled controllers provide them
  */
+std::string CgroupReport(const std::string& Cgroup) {
+    std::string Report = "cgroup " + Cgroup.substr(Cgroup.rfind('/') + 1) + "\ncpu.stat:";
+    AppendStat(Report, ReadControl(Cgroup + CPU_STAT_PATH), {});
+
+    std::string MemoryStat = ReadControl(Cgroup + MEMORY_STAT_PATH);
+    if (!MemoryStat.empty()) {
+        Report += "\nmemory.stat:";
+        AppendStat(Report, MemoryStat, std::set<std::string>(std::begin(MemoryStatKeys), std::end(MemoryStatKeys)));
+    }
 
-void CreateFiles(char **argv) {
-    std::ofstream PidMax(PID_MAX_FILEPATH, std::ofstream::out);
-    PidMax << argv[3];
-    PidMax.close();
-    chmod(PID_MAX_FILEPATH, DIR_PERMISSIONS);
+    std::string Peak = ReadControl(Cgroup + MEMORY_PEAK_PATH);
+    if (!Peak.empty()) {
+        Report += "\nmemory.peak: " + Peak.substr(0, Peak.find('\n'));
+    }
+    return Report + "\n";
+}
 
-    std::ofstream CGroup(C_GROUP_PROC_FILEPATH, std::ofstream::out);
-    int Pid = getpid();
-    auto PidStr = std::to_string(Pid);
-    CGroup << PidStr.c_str();
-    CGroup.close();
-    chmod(C_GROUP_PROC_FILEPATH, DIR_PERMISSIONS);
 
-    std::ofstream Release(NOTIFY_RELEASE_FILEPATH, std::ofstream::out);
-    Release << '1';
-    Release.close();
-    chmod(NOTIFY_RELEASE_FILEPATH, DIR_PERMISSIONS);
+/**
+ * Remove the cgroup of a finished container. The pid namespace is gone by the time its init is reaped, so the
+ * group is empty.
+ */
+void RemoveCgroup(const std::string& Cgroup) {
+    if (rmdir(Cgroup.c_str()) != SUCCESS) {
+        CreateErrorMessage(CGROUP_ERROR_MSG);
+    }
 }
 
 
 /**
- * This function creates new folders in the new file system
+ * This function creates the cgroup folders under the container root. A zygote prepares each root once and
+ * reuses it (Cached), so folders that already exist are fine there. Returns false on failure.
  */
 
-void CreateDirectories(char **argv) {
-    // creates all the folders
-    if (mkdir(FS_PATH, DIR_PERMISSIONS) != SUCCESS ||
-        mkdir(C_GROUP_PATH, DIR_PERMISSIONS) != SUCCESS  ||
-        mkdir(P_IDS_PATH, DIR_PERMISSIONS) != SUCCESS ) {
+bool CreateDirectories(const std::string& Root, bool Cached) {
+    const char *Paths[] = {FS_PATH, C_GROUP_PATH, P_IDS_PATH};
+    for (const char *Path : Paths) {
+        std::string AllPath = Root + Path;
+        if (mkdir(AllPath.c_str(), DIR_PERMISSIONS) != SUCCESS && !(Cached && errno == EEXIST)) {
             CreateErrorMessage(MKDIR_ERROR_MSG);
-            exit(1);
+            return false;
+        }
     }
+    return true;
 }
 
 /**
- * This is the main function for creating the Container. the function changes the host name, the file system
- * and creates new process by calling execvp function
+ * Mount a copy-on-write view of Root for a container and return its path. The writable upper layer lives on a
+ * tmpfs mounted over Root/proc, so it costs nothing to create, never touches Root (which may be read-only) and
+ * is discarded with the container's mount namespace. /proc of the merged view is still Root's own, empty, /proc.
  */
+std::string MountOverlay(const std::string& Root) {
+    std::string Scratch = Root + PROC_PATH;
+    if (mount("tmpfs", Scratch.c_str(), "tmpfs", 0, SCRATCH_OPTIONS) != SUCCESS) {
+        CreateErrorMessage(MOUNT_ERROR_MSG);
+        exit(1);
+    }
 
-int Child(void *arguments) {
-    // cast the arguments
-    char **ChildArguments = (char **) arguments;
-    const char *NewHostName = ChildArguments[1];
-    char *root = ChildArguments[2];
+    const char *Paths[] = {UPPER_PATH, WORK_PATH, MERGED_PATH};
+    for (const char *Path : Paths) {
+        if (mkdir((Scratch + Path).c_str(), DIR_PERMISSIONS) != SUCCESS) {
+            CreateErrorMessage(MKDIR_ERROR_MSG);
+            exit(1);
+        }
+    }
+
+    std::string Merged = Scratch + MERGED_PATH;
+    std::string Options = "lowerdir=" + Root + ",upperdir=" + Scratch + UPPER_PATH + ",workdir=" + Scratch + WORK_PATH;
+    if (mount("overlay", Merged.c_str(), "overlay", 0, Options.c_str()) != SUCCESS) {
+        CreateErrorMessage(MOUNT_ERROR_MSG);
+        exit(1);
+    }
+    return Merged;
+}
 
-    // assign new host name
-    if (sethostname(NewHostName, strlen(NewHostName)) != SUCCESS) {
+/**
+ * Assign the container's host name
+ */
+void SetHostName(const ContainerSpec& Spec) {
+    if (sethostname(Spec.HostName.c_str(), Spec.HostName.size()) != SUCCESS) {
         CreateErrorMessage(HOST_NAME_ERROR_MSG);
         exit(1);
     }
+}
+
+
+/**
+ * Make Root the root mount of the mount namespace and detach every host mount from it. The namespace is then
+ * only Root and what the container mounts, so tearing it down when the container exits is cheap; the detach
+ * itself costs about as much, so only containers prepared ahead of a request pivot.
+ */
+void PivotRoot(const std::string& Root) {
+    // pivot_root needs the new root to be a mount point
+    if (mount(Root.c_str(), Root.c_str(), nullptr, MS_BIND, nullptr) != SUCCESS) {
+        CreateErrorMessage(MOUNT_ERROR_MSG);
+        exit(1);
+    }
+    if (chdir(Root.c_str()) != SUCCESS) {
+        CreateErrorMessage(CHDIR_ERROR_MSG);
+        exit(1);
+    }
+    // stack the old root under the new one, then detach it
+    if (syscall(SYS_pivot_root, ".", ".") != SUCCESS || umount2(".", MNT_DETACH) != SUCCESS) {
+        CreateErrorMessage(CHROOT_ERROR_MSG);
+        exit(1);
+    }
+}
+
+
+/**
+ * Make Spec's root (or an overlay of it) the root of the container, with a /proc of the container's pid
+ * namespace. With Pivot the host's mounts are detached from the container's mount namespace instead of only
+ * hidden by chroot.
+ */
+void EnterRoot(const ContainerSpec& Spec, bool Pivot) {
+    // keep our mounts from propagating back to the parent's namespace
+    if (mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) != SUCCESS) {
+        CreateErrorMessage(MOUNT_ERROR_MSG);
+        exit(1);
+    }
 
     // change the file system root
-    if (chroot(root) != SUCCESS) {
+    std::string Root = Spec.Overlay ? MountOverlay(Spec.Root) : Spec.Root;
+    if (Pivot) {
+        PivotRoot(Root);
+    } else if (chroot(Root.c_str()) != SUCCESS) {
         CreateErrorMessage(CHROOT_ERROR_MSG);
         exit(1);
     }
@@ -163,21 +542,29 @@ int Child(void *arguments) {
     }
 
     // mount
-    if (mount("proc", "/proc", "proc", 0, nullptr) != SUCCESS) {
+    if (mount("proc", PROC_PATH, "proc", 0, nullptr) != SUCCESS) {
         CreateErrorMessage(MOUNT_ERROR_MSG);
         exit(1);
     }
 
-    // create new directories for CGroup
-    CreateDirectories(ChildArguments);
+    // an overlay container makes its cgroup folders in its own upper layer
+    if (Spec.Overlay && !CreateDirectories("", true)) {
+        exit(1);
+    }
+}
 
-    // creates and writes into files
-    CreateFiles(ChildArguments);
 
-    // run the program
-    char * arr[] = {ChildArguments[4],*(ChildArguments + 5), nullptr};
+/**
+ * Replace the container's init with its program
+ */
+int RunProgram(const ContainerSpec& Spec) {
+    std::vector<char *> Arguments;
+    for (const std::string& Argument : Spec.Program) {
+        Arguments.push_back((char *) Argument.c_str());
+    }
+    Arguments.push_back(nullptr);
 
-    if (execvp(ChildArguments[4], arr) != SUCCESS)
+    if (execvp(Arguments[0], Arguments.data()) != SUCCESS)
     {
         CreateErrorMessage(CONTAINER_PROGRAM_ERROR_MSG);
         exit(1);
@@ -186,26 +573,1102 @@ int Child(void *arguments) {
 }
 
 
+/**
+ * This is the main function for creating the Container. the function changes the host name, the file system
+ * and creates new process by calling execvp function
+ */
+
+int Child(void *arguments) {
+    // cast the arguments
+    const ContainerSpec& Spec = *(ContainerSpec *) arguments;
+
+    SetHostName(Spec);
+
+    // join the container's cgroup while the host's cgroup hierarchy is still reachable
+    if (!Spec.Cgroup.empty() && !JoinCgroup(Spec.Cgroup, 0)) {
+        CreateErrorMessage(CGROUP_ERROR_MSG);
+        exit(1);
+    }
+
+    EnterRoot(Spec, false);
+
+    // creates and writes into files
+    CreateFiles(Spec);
+
+    return RunProgram(Spec);
+}
+
+
+/**
+ * Build a spec from [options] <hostname> <root> <pids max> <program> [args...], returns false if arguments are
+ * missing or an option is unknown
+ */
+bool ParseSpec(const std::vector<std::string>& Arguments, ContainerSpec& Spec) {
+    size_t First = 0;
+    Spec.Overlay = false;
+    Spec.Report = false;
+    Spec.Limits.clear();
+    while (First < Arguments.size() && Arguments[First][0] == '-') {
+        const std::string& Option = Arguments[First++];
+        if (Option == OVERLAY_FLAG) {
+            Spec.Overlay = true;
+            continue;
+        }
+        if (Option == REPORT_FLAG) {
+            Spec.Report = true;
+            continue;
+        }
+        bool Known = false;
+        for (const auto& Limit : LimitOptions) {
+            if (Option == Limit[0] && First < Arguments.size()) {
+                Spec.Limits.emplace_back(Limit[1], Arguments[First++]);
+                Known = true;
+                break;
+            }
+        }
+        if (!Known) {
+            return false;
+        }
+    }
+    if (Arguments.size() < First + SPEC_ARGUMENTS) {
+        return false;
+    }
+    Spec.HostName = Arguments[First];
+    Spec.Root = Arguments[First + 1];
+    Spec.PidsMax = Arguments[First + 2];
+    Spec.Program.assign(Arguments.begin() + First + 3, Arguments.end());
+    return true;
+}
+
 
-int main(int argc, char *argv[]) {
-    void *stack = malloc(STACK_SIZE);
-    if (stack == nullptr) {
+/**
+ * Allocate a clone stack. Without CLONE_VM every child gets its own copy of it, so one stack serves all clones.
+ */
+char *AllocateStack() {
+    void *Stack = mmap(nullptr, STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+                       FAILURE, 0);
+    if (Stack == MAP_FAILED) {
         CreateErrorMessage(ALLOCATION_ERROR_MSG);
         exit(1);
     }
-    int CloneRetVal = clone(Child, (char *) stack + STACK_SIZE, SIGCHLD | CLONE_NEWUTS | CLONE_NEWPID | CLONE_NEWNS, argv);
+    return (char *) Stack;
+}
+
+
+/**
+ * Whether the container needs a cgroup of its own
+ */
+bool UsesCgroup(const ContainerSpec& Spec) {
+    return Spec.Report || !Spec.Limits.empty();
+}
+
+
+/**
+ * Clone a container for Spec, in a cgroup of its own if it needs one. The cgroup folders of its root must be
+ * ready. Returns its pid, or FAILURE if it could not be started.
+ */
+pid_t StartContainer(ContainerSpec& Spec, char *Stack) {
+    if (UsesCgroup(Spec) && !CreateCgroup(Spec)) {
+        return FAILURE;
+    }
+    pid_t Pid = clone(Child, Stack + STACK_SIZE, CONTAINER_FLAGS, &Spec);
+    if (Pid == FAILURE) {
+        CreateErrorMessage(CLONE_ERROR_MSG);
+        if (UsesCgroup(Spec)) {
+            RemoveCgroup(Spec.Cgroup);
+        }
+    }
+    return Pid;
+}
+
+
+/**
+ * Report the usage of a reaped container and remove its cgroup, if it had one
+ */
+void ReleaseCgroup(const ContainerSpec& Spec) {
+    if (UsesCgroup(Spec)) {
+        std::cerr << CgroupReport(Spec.Cgroup);
+        RemoveCgroup(Spec.Cgroup);
+    }
+}
+
+
+/**
+ * Start a single container, wait for it and clean up after it. Returns its wait status.
+ */
+int RunContainer(ContainerSpec& Spec, char *Stack) {
+    if (!Spec.Overlay && !CreateDirectories(Spec.Root, false)) {
+        exit(1);
+    }
+
+    int CloneRetVal = StartContainer(Spec, Stack);
     if (CloneRetVal == FAILURE)
     {
-        CreateErrorMessage(CLONE_ERROR_MSG);
+        if (!Spec.Overlay) {
+            RemovePath(Spec);
+        }
         exit(1);
     }
 
-    wait(nullptr);
+    int Status;
+    if (waitpid(CloneRetVal, &Status, 0) == FAILURE) {
+        CreateErrorMessage(WAIT_ERROR_MSG);
+        exit(1);
+    }
 
-    RemovePath(argv);
+    if (!Spec.Overlay) {
+        RemovePath(Spec);
+    }
+    ReleaseCgroup(Spec);
+    return Status;
+}
 
-    free(stack);
 
-    return SUCCESS;
+/**
+ * Open a close-on-exec pidfd for a child, which becomes readable when it exits
+ */
+int OpenPidFd(pid_t Pid) {
+    int PidFd = syscall(SYS_pidfd_open, Pid, 0);
+    if (PidFd == FAILURE) {
+        CreateErrorMessage(PID_FD_ERROR_MSG);
+        exit(1);
+    }
+    fcntl(PidFd, F_SETFD, FD_CLOEXEC);
+    return PidFd;
+}
+
+
+/// ZYGOTE PROTOCOL ///
+// A request is a 4 byte length followed by the spec arguments separated by '\0'. The requester's stdin, stdout
+// and stderr travel with the first bytes as SCM_RIGHTS, so the container writes straight to the requester.
+// The reply is the container's 4 byte wait status, followed by its usage report when it had a cgroup.
+
+/**
+ * Pack arguments into '\0' separated form
+ */
+std::string EncodeArguments(const std::vector<std::string>& Arguments) {
+    std::string Encoded;
+    for (const std::string& Argument : Arguments) {
+        Encoded += Argument;
+        Encoded += '\0';
+    }
+    return Encoded;
+}
+
+
+/**
+ * Unpack '\0' separated arguments
+ */
+std::vector<std::string> DecodeArguments(const std::string& Encoded) {
+    std::vector<std::string> Arguments;
+    size_t Start = 0;
+    while (Start < Encoded.size()) {
+        size_t End = Encoded.find('\0', Start);
+        if (End == std::string::npos) {
+            End = Encoded.size();
+        }
+        Arguments.push_back(Encoded.substr(Start, End - Start));
+        Start = End + 1;
+    }
+    return Arguments;
+}
+
+
+/**
+ * Read exactly Count bytes, returns false on error or end of file
+ */
+bool ReadFully(int Fd, char *Buffer, size_t Count) {
+    while (Count > 0) {
+        ssize_t Read = read(Fd, Buffer, Count);
+        if (Read == FAILURE && errno == EINTR) {
+            continue;
+        }
+        if (Read <= 0) {
+            return false;
+        }
+        Buffer += Read;
+        Count -= Read;
+    }
+    return true;
 }
 
+
+/**
+ * Write exactly Count bytes, returns false on error
+ */
+bool WriteFully(int Fd, const char *Buffer, size_t Count) {
+    while (Count > 0) {
+        ssize_t Written = write(Fd, Buffer, Count);
+        if (Written == FAILURE && errno == EINTR) {
+            continue;
+        }
+        if (Written <= 0) {
+            return false;
+        }
+        Buffer += Written;
+        Count -= Written;
+    }
+    return true;
+}
+
+
+/**
+ * Send exactly Count bytes on a socket, returns false on error. A peer which went away fails with EPIPE
+ * instead of raising SIGPIPE, the zygote must outlive any one requester.
+ */
+bool SendFully(int Fd, const char *Buffer, size_t Count) {
+    while (Count > 0) {
+        ssize_t Sent = send(Fd, Buffer, Count, MSG_NOSIGNAL);
+        if (Sent == FAILURE && errno == EINTR) {
+            continue;
+        }
+        if (Sent <= 0) {
+            return false;
+        }
+        Buffer += Sent;
+        Count -= Sent;
+    }
+    return true;
+}
+
+
+/**
+ * Send a request with the three standard fds attached
+ */
+bool SendRequest(int Fd, const std::string& Encoded, const int *Fds) {
+    uint32_t Length = Encoded.size();
+    std::string Message((const char *) &Length, LENGTH_SIZE);
+    Message += Encoded;
+
+    char Control[CMSG_SPACE(sizeof(int) * STANDARD_FDS)];
+    memset(Control, 0, sizeof(Control));
+    struct iovec Vector = {(void *) Message.data(), Message.size()};
+    struct msghdr Header = {};
+    Header.msg_iov = &Vector;
+    Header.msg_iovlen = 1;
+    Header.msg_control = Control;
+    Header.msg_controllen = sizeof(Control);
+    struct cmsghdr *Rights = CMSG_FIRSTHDR(&Header);
+    Rights->cmsg_level = SOL_SOCKET;
+    Rights->cmsg_type = SCM_RIGHTS;
+    Rights->cmsg_len = CMSG_LEN(sizeof(int) * STANDARD_FDS);
+    memcpy(CMSG_DATA(Rights), Fds, sizeof(int) * STANDARD_FDS);
+
+    ssize_t Sent = sendmsg(Fd, &Header, MSG_NOSIGNAL);
+    if (Sent <= 0) {
+        return false;
+    }
+    return SendFully(Fd, Message.data() + Sent, Message.size() - Sent);
+}
+
+
+/**
+ * Receive a request and the three standard fds sent with it. Fds are received close-on-exec.
+ */
+bool ReceiveRequest(int Fd, std::string& Encoded, int *Fds) {
+    char LengthBuffer[LENGTH_SIZE];
+    char Control[CMSG_SPACE(sizeof(int) * STANDARD_FDS)];
+    struct iovec Vector = {LengthBuffer, LENGTH_SIZE};
+    struct msghdr Header = {};
+    Header.msg_iov = &Vector;
+    Header.msg_iovlen = 1;
+    Header.msg_control = Control;
+    Header.msg_controllen = sizeof(Control);
+
+    ssize_t Received = recvmsg(Fd, &Header, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *Rights = CMSG_FIRSTHDR(&Header);
+    if (Received <= 0 || Rights == nullptr || Rights->cmsg_type != SCM_RIGHTS ||
+        Rights->cmsg_len != CMSG_LEN(sizeof(int) * STANDARD_FDS)) {
+        return false;
+    }
+    memcpy(Fds, CMSG_DATA(Rights), sizeof(int) * STANDARD_FDS);
+
+    uint32_t Length;
+    if (!ReadFully(Fd, LengthBuffer + Received, LENGTH_SIZE - Received)) {
+        return false;
+    }
+    memcpy(&Length, LengthBuffer, LENGTH_SIZE);
+    if (Length > MAX_REQUEST_SIZE) {
+        return false;
+    }
+    Encoded.resize(Length);
+    return ReadFully(Fd, &Encoded[0], Length);
+}
+
+
+/**
+ * Read what arrived of a request on a non-blocking socket, without waiting for the rest. Returns 1 once the
+ * request is complete, 0 if more of it has to arrive, and FAILURE if the requester failed or broke the protocol
+ */
+int ReadRequestPart(int Fd, PartialRequest& Request) {
+    while (true) {
+        char Buffer[REQUEST_READ_CHUNK];
+        char Control[CMSG_SPACE(sizeof(int) * STANDARD_FDS)];
+        struct iovec Vector = {Buffer, sizeof(Buffer)};
+        struct msghdr Header = {};
+        Header.msg_iov = &Vector;
+        Header.msg_iovlen = 1;
+        Header.msg_control = Control;
+        Header.msg_controllen = sizeof(Control);
+
+        ssize_t Received = recvmsg(Fd, &Header, MSG_CMSG_CLOEXEC);
+        if (Received == FAILURE && errno == EINTR) {
+            continue;
+        }
+        if (Received == FAILURE && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (Received <= 0) {
+            return FAILURE;
+        }
+
+        // the fds travel with the first bytes
+        struct cmsghdr *Rights = CMSG_FIRSTHDR(&Header);
+        if (!Request.HasFds) {
+            if (Rights == nullptr || Rights->cmsg_type != SCM_RIGHTS ||
+                Rights->cmsg_len != CMSG_LEN(sizeof(int) * STANDARD_FDS)) {
+                return FAILURE;
+            }
+            memcpy(Request.Fds, CMSG_DATA(Rights), sizeof(int) * STANDARD_FDS);
+            Request.HasFds = true;
+        } else if (Rights != nullptr) {
+            return FAILURE;
+        }
+
+        Request.Bytes.append(Buffer, Received);
+        if (Request.Bytes.size() >= LENGTH_SIZE) {
+            uint32_t Length;
+            memcpy(&Length, Request.Bytes.data(), LENGTH_SIZE);
+            if (Length > MAX_REQUEST_SIZE) {
+                return FAILURE;
+            }
+            if (Request.Bytes.size() >= LENGTH_SIZE + Length) {
+                Request.Bytes = Request.Bytes.substr(LENGTH_SIZE, Length);
+                return 1;
+            }
+        }
+    }
+}
+
+
+/**
+ * Close the standard fds received with a request
+ */
+void CloseFds(const int *Fds) {
+    for (int Index = 0; Index < STANDARD_FDS; Index++) {
+        close(Fds[Index]);
+    }
+}
+
+
+/// ZYGOTE ///
+
+/**
+ * Entry point of a pre-cloned container. It already lives in its own namespaces and blocks until the zygote
+ * hands it a spec, then takes over the requester's standard fds and continues as a normal container. A prepared
+ * container has already entered its root (mounts, chroot, /proc and the fixed pids files) and only sets the
+ * host name and the pids limit of the spec before it runs the program.
+ */
+int ZygoteChild(void *arguments) {
+    const ZygoteChildArguments& Arguments = *(ZygoteChildArguments *) arguments;
+    // keep nothing of the zygote but the request socket, and die with the zygote
+    int RequestFd = STANDARD_FDS;
+    if (dup2(Arguments.RequestFd, RequestFd) == FAILURE ||
+        close_range(RequestFd + 1, ~0U, 0) != SUCCESS || prctl(PR_SET_PDEATHSIG, SIGKILL) != SUCCESS) {
+        exit(1);
+    }
+
+    ContainerSpec Prepared = {};
+    if (Arguments.Root != nullptr) {
+        Prepared.Root = Arguments.Root;
+        EnterRoot(Prepared, true);
+        if (!WriteProcessFiles()) {
+            CreateErrorMessage(WRITE_FILE_ERROR_MSG);
+            exit(1);
+        }
+    }
+
+    std::string Encoded;
+    int Fds[STANDARD_FDS];
+    ContainerSpec Spec;
+    if (!ReceiveRequest(RequestFd, Encoded, Fds) || !ParseSpec(DecodeArguments(Encoded), Spec)) {
+        exit(1);
+    }
+    if (Arguments.Root != nullptr && (Spec.Overlay || Spec.Root != Prepared.Root)) {
+        exit(1);
+    }
+    close(RequestFd);
+    // the zygote blocks SIGINT and SIGTERM for its signalfd, the container program should not inherit that
+    sigset_t Signals;
+    sigemptyset(&Signals);
+    sigprocmask(SIG_SETMASK, &Signals, nullptr);
+    for (int Index = 0; Index < STANDARD_FDS; Index++) {
+        if (dup2(Fds[Index], Index) == FAILURE) {
+            exit(1);
+        }
+    }
+    if (Arguments.Root == nullptr) {
+        return Child(&Spec);
+    }
+
+    // the zygote already moved us into the spec's cgroup
+    SetHostName(Spec);
+    if (!WriteFile(PID_MAX_FILEPATH, Spec.PidsMax)) {
+        CreateErrorMessage(WRITE_FILE_ERROR_MSG);
+        exit(1);
+    }
+    return RunProgram(Spec);
+}
+
+
+/**
+ * Clone a container ahead of any request: the clone and the new namespaces, and with a Root the mount setup
+ * of that root, are paid while the zygote is idle. An empty Root leaves the container unprepared, for any spec.
+ */
+ReadyContainer PreClone(char *Stack, const std::string& Root) {
+    int Pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, Pair) != SUCCESS) {
+        CreateErrorMessage(SOCKET_ERROR_MSG);
+        exit(1);
+    }
+    // the child gets a copy of our memory, so it may keep pointing at Arguments and Root
+    ZygoteChildArguments Arguments = {Pair[1], Root.empty() ? nullptr : Root.c_str()};
+    pid_t Pid = clone(ZygoteChild, Stack + STACK_SIZE, CONTAINER_FLAGS, &Arguments);
+    if (Pid == FAILURE) {
+        CreateErrorMessage(CLONE_ERROR_MSG);
+        exit(1);
+    }
+    close(Pair[1]);
+    return {Pid, OpenPidFd(Pid), Pair[0]};
+}
+
+
+/**
+ * Kill and reap a container that was never started
+ */
+void DiscardReady(const ReadyContainer& Ready) {
+    kill(Ready.Pid, SIGKILL);
+    waitpid(Ready.Pid, nullptr, 0);
+    close(Ready.PidFd);
+    close(Ready.RequestFd);
+}
+
+
+/**
+ * Create the zygote's listening unix socket
+ */
+int ZygoteSocket(const char *Path) {
+    struct sockaddr_un Address = {};
+    Address.sun_family = AF_UNIX;
+    if (strlen(Path) >= sizeof(Address.sun_path)) {
+        CreateErrorMessage(SOCKET_ERROR_MSG);
+        exit(1);
+    }
+    strcpy(Address.sun_path, Path);
+    unlink(Path);
+
+    int ListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ListenFd == FAILURE || bind(ListenFd, (struct sockaddr *) &Address, sizeof(Address)) != SUCCESS ||
+        listen(ListenFd, LISTEN_BACKLOG) != SUCCESS) {
+        CreateErrorMessage(SOCKET_ERROR_MSG);
+        exit(1);
+    }
+    return ListenFd;
+}
+
+
+/**
+ * Connect to a zygote's socket
+ */
+int ZygoteConnect(const char *Path) {
+    struct sockaddr_un Address = {};
+    Address.sun_family = AF_UNIX;
+    strncpy(Address.sun_path, Path, sizeof(Address.sun_path) - 1);
+
+    int Fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (Fd == FAILURE || connect(Fd, (struct sockaddr *) &Address, sizeof(Address)) != SUCCESS) {
+        CreateErrorMessage(SOCKET_ERROR_MSG);
+        exit(1);
+    }
+    return Fd;
+}
+
+
+/**
+ * Kill and reap every container of a pool
+ */
+void DiscardPool(std::deque<ReadyContainer>& Pool) {
+    for (const ReadyContainer& Ready : Pool) {
+        DiscardReady(Ready);
+    }
+    Pool.clear();
+}
+
+
+/**
+ * Hand one request, read from ClientFd, to a ready container: one prepared for its root if there is one,
+ * otherwise an unprepared one (Pools[""]). Returns false if it could not be started. The request's fds are
+ * closed either way. The first request of a root creates its cgroup folders and its pool, filled while idle.
+ */
+bool StartRequest(int ClientFd, const std::string& Encoded, const int *Fds, ZygotePools& Pools,
+                  std::set<std::string>& PreparedRoots, std::unordered_map<int, RunningContainer>& Running,
+                  int EpollFd, char *Stack) {
+    ContainerSpec Spec;
+    if (!ParseSpec(DecodeArguments(Encoded), Spec)) {
+        CloseFds(Fds);
+        return false;
+    }
+
+    // the cgroup folders of a root are created once and kept until the zygote exits
+    if (!Spec.Overlay && PreparedRoots.count(Spec.Root) == 0) {
+        if (!CreateDirectories(Spec.Root, true)) {
+            CloseFds(Fds);
+            return false;
+        }
+        PreparedRoots.insert(Spec.Root);
+        Pools[Spec.Root];
+    }
+    if (UsesCgroup(Spec) && !CreateCgroup(Spec)) {
+        CloseFds(Fds);
+        return false;
+    }
+
+    // a pool member can only be missing if it died, so retry with a fresh clone. A prepared container which
+    // died could not enter its root, so the root is not prepared ahead any more.
+    bool Sent = false;
+    while (!Sent) {
+        auto Prepared = Spec.Overlay ? Pools.end() : Pools.find(Spec.Root);
+        bool UsePrepared = Prepared != Pools.end() && !Prepared->second.empty();
+        std::deque<ReadyContainer>& Pool = UsePrepared ? Prepared->second : Pools[""];
+        if (Pool.empty()) {
+            Pool.push_back(PreClone(Stack, ""));
+        }
+        ReadyContainer Ready = Pool.front();
+        Pool.pop_front();
+        // the container is still waiting for its spec, so it is in its cgroup before it runs anything
+        if (!Spec.Cgroup.empty() && !JoinCgroup(Spec.Cgroup, Ready.Pid)) {
+            CreateErrorMessage(CGROUP_ERROR_MSG);
+            DiscardReady(Ready);
+            RemoveCgroup(Spec.Cgroup);
+            CloseFds(Fds);
+            return false;
+        }
+        Sent = SendRequest(Ready.RequestFd, Encoded, Fds);
+        if (!Sent) {
+            DiscardReady(Ready);
+            if (UsePrepared) {
+                DiscardPool(Prepared->second);
+                Pools.erase(Prepared);
+            }
+            continue;
+        }
+        close(Ready.RequestFd);
+
+        struct epoll_event Event = {};
+        Event.events = EPOLLIN;
+        Event.data.fd = Ready.PidFd;
+        if (epoll_ctl(EpollFd, EPOLL_CTL_ADD, Ready.PidFd, &Event) != SUCCESS) {
+            CreateErrorMessage(EPOLL_ERROR_MSG);
+            exit(1);
+        }
+        Running[Ready.PidFd] = {Ready.Pid, ClientFd, Spec.Cgroup};
+    }
+    CloseFds(Fds);
+    return true;
+}
+
+
+/**
+ * Reap a finished container and send its wait status, and its usage report if it had a cgroup, to whoever
+ * requested it. A requester which is gone (EPIPE) is just skipped. A container cloned meanwhile may still hold a
+ * copy of the pidfd, so it leaves the epoll set explicitly before it is closed.
+ */
+void FinishRequest(int PidFd, std::unordered_map<int, RunningContainer>& Running, int EpollFd) {
+    RunningContainer Container = Running[PidFd];
+    Running.erase(PidFd);
+    int Status;
+    if (waitpid(Container.Pid, &Status, 0) == FAILURE) {
+        CreateErrorMessage(WAIT_ERROR_MSG);
+        exit(1);
+    }
+    bool Connected = SendFully(Container.ClientFd, (const char *) &Status, sizeof(Status));
+    if (!Container.Cgroup.empty()) {
+        if (Connected) {
+            std::string Report = CgroupReport(Container.Cgroup);
+            SendFully(Container.ClientFd, Report.data(), Report.size());
+        }
+        RemoveCgroup(Container.Cgroup);
+    }
+    close(Container.ClientFd);
+    epoll_ctl(EpollFd, EPOLL_CTL_DEL, PidFd, nullptr);
+    close(PidFd);
+}
+
+
+/**
+ * Run a zygote: keep up to PoolSize containers cloned into fresh namespaces and waiting, and as many more for
+ * every root it has served, already inside that root, and hand each request on the socket to one of them. Runs
+ * until SIGINT or SIGTERM.
+ */
+int ZygoteManager(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << USAGE_MSG << std::endl;
+        exit(1);
+    }
+    const char *SocketPath = argv[2];
+    size_t PoolSize = argc > 3 ? std::stoul(argv[3]) : DEFAULT_POOL_SIZE;
+    long Cpus = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    char *Stack = AllocateStack();
+
+    sigset_t Signals;
+    sigemptyset(&Signals);
+    sigaddset(&Signals, SIGINT);
+    sigaddset(&Signals, SIGTERM);
+    int SignalFd = FAILURE;
+    if (sigprocmask(SIG_BLOCK, &Signals, nullptr) != SUCCESS ||
+        (SignalFd = signalfd(FAILURE, &Signals, SFD_CLOEXEC)) == FAILURE) {
+        CreateErrorMessage(SIGNAL_ERROR_MSG);
+        exit(1);
+    }
+
+    int ListenFd = ZygoteSocket(SocketPath);
+    int EpollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event Event = {};
+    Event.events = EPOLLIN;
+    Event.data.fd = ListenFd;
+    bool Added = EpollFd != FAILURE && epoll_ctl(EpollFd, EPOLL_CTL_ADD, ListenFd, &Event) == SUCCESS;
+    Event.data.fd = SignalFd;
+    if (!Added || epoll_ctl(EpollFd, EPOLL_CTL_ADD, SignalFd, &Event) != SUCCESS) {
+        CreateErrorMessage(EPOLL_ERROR_MSG);
+        exit(1);
+    }
+
+    ZygotePools Pools;
+    Pools[""];
+
+    std::set<std::string> PreparedRoots;
+    std::unordered_map<int, PartialRequest> Reading; // requesters whose request did not fully arrive yet
+    std::unordered_map<int, RunningContainer> Running;
+    struct epoll_event Events[MAX_EVENTS];
+    bool Stopped = false;
+    while (!Stopped) {
+        // replacements are cloned only when there is nothing else to do, keeping clone off the request path,
+        // and only on a CPU no running container needs. Unprepared containers come first ("" sorts first), then
+        // each root's prepared ones
+        auto Short = std::find_if(Pools.begin(), Pools.end(), [PoolSize](const ZygotePools::value_type& Pool) {
+            return Pool.second.size() < PoolSize;
+        });
+        int Timeout = Short != Pools.end() && (long) Running.size() < Cpus ? 0 : FAILURE;
+        int Ready = epoll_wait(EpollFd, Events, MAX_EVENTS, Timeout);
+        if (Ready == FAILURE && errno == EINTR) {
+            continue;
+        }
+        if (Ready == FAILURE) {
+            CreateErrorMessage(EPOLL_ERROR_MSG);
+            exit(1);
+        }
+        if (Ready == 0) {
+            Short->second.push_back(PreClone(Stack, Short->first));
+            continue;
+        }
+        for (int Index = 0; Index < Ready; Index++) {
+            int Fd = Events[Index].data.fd;
+            if (Fd == SignalFd) {
+                Stopped = true;
+            } else if (Fd == ListenFd) {
+                // requests are read as they arrive, so a requester which sends nothing holds up nobody else
+                int ClientFd = accept4(ListenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+                if (ClientFd == FAILURE) {
+                    continue;
+                }
+                Event.events = EPOLLIN;
+                Event.data.fd = ClientFd;
+                if (epoll_ctl(EpollFd, EPOLL_CTL_ADD, ClientFd, &Event) != SUCCESS) {
+                    CreateErrorMessage(EPOLL_ERROR_MSG);
+                    close(ClientFd);
+                    continue;
+                }
+                Reading[ClientFd] = PartialRequest();
+            } else if (Reading.count(Fd)) {
+                PartialRequest& Request = Reading[Fd];
+                int Result = ReadRequestPart(Fd, Request);
+                if (Result == 0) {
+                    continue;
+                }
+                // the reply is a few bytes written once the container exits, the socket is blocking again for it
+                epoll_ctl(EpollFd, EPOLL_CTL_DEL, Fd, nullptr);
+                bool Started = false;
+                if (Result == FAILURE || fcntl(Fd, F_SETFL, 0) == FAILURE) {
+                    if (Request.HasFds) {
+                        CloseFds(Request.Fds);
+                    }
+                } else {
+                    Started = StartRequest(Fd, Request.Bytes, Request.Fds, Pools, PreparedRoots, Running, EpollFd,
+                                           Stack);
+                }
+                if (!Started) {
+                    CreateErrorMessage(REQUEST_ERROR_MSG);
+                    close(Fd);
+                }
+                Reading.erase(Fd);
+            } else {
+                FinishRequest(Fd, Running, EpollFd);
+            }
+        }
+    }
+
+    for (auto& Pool : Pools) {
+        DiscardPool(Pool.second);
+    }
+    for (const auto& Request : Reading) {
+        if (Request.second.HasFds) {
+            CloseFds(Request.second.Fds);
+        }
+        close(Request.first);
+    }
+    while (!Running.empty()) {
+        int PidFd = Running.begin()->first;
+        kill(Running.begin()->second.Pid, SIGKILL);
+        FinishRequest(PidFd, Running, EpollFd);
+    }
+    for (const std::string& Root : PreparedRoots) {
+        RemoveManager(Root, FS_PATH);
+    }
+    unlink(SocketPath);
+    return SUCCESS;
+}
+
+
+/**
+ * Ask the zygote at SocketPath to run a container with our standard fds, returns its wait status
+ */
+int RunThroughZygote(const char *SocketPath, const std::vector<std::string>& Arguments) {
+    int Fd = ZygoteConnect(SocketPath);
+    const int Fds[STANDARD_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    int Status;
+    if (!SendRequest(Fd, EncodeArguments(Arguments), Fds) ||
+        !ReadFully(Fd, (char *) &Status, sizeof(Status))) {
+        CreateErrorMessage(REQUEST_ERROR_MSG);
+        exit(1);
+    }
+
+    // whatever follows the status is the container's usage report
+    char Buffer[4096];
+    ssize_t Read;
+    while ((Read = read(Fd, Buffer, sizeof(Buffer))) > 0) {
+        WriteFully(STDERR_FILENO, Buffer, Read);
+    }
+    close(Fd);
+    return Status;
+}
+
+
+/**
+ * Translate a wait status into a shell style exit code
+ */
+int ExitCode(int Status) {
+    if (WIFSIGNALED(Status)) {
+        return 128 + WTERMSIG(Status);
+    }
+    return WEXITSTATUS(Status);
+}
+
+
+/**
+ * Run one container through a zygote and exit with the container's exit code
+ */
+int RunManager(int argc, char *argv[]) {
+    std::vector<std::string> Arguments(argv + 3, argv + argc);
+    ContainerSpec Spec;
+    if (argc < 3 || !ParseSpec(Arguments, Spec)) {
+        std::cerr << USAGE_MSG << std::endl;
+        exit(1);
+    }
+    return ExitCode(RunThroughZygote(argv[2], Arguments));
+}
+
+
+/**
+ * Start Count containers one after the other, either directly or through a zygote, and report how many
+ * containers were started per second
+ */
+int BenchManager(int argc, char *argv[]) {
+    // an idle gap between containers lets a zygote refill its pool, so the latency is that of a warm pool
+    int First = 4;
+    long GapMillis = 0;
+    if (argc > First + 1 && strcmp(argv[First], GAP_FLAG) == 0) {
+        GapMillis = std::stol(argv[First + 1]);
+        First += 2;
+    }
+    std::vector<std::string> Arguments(argv + std::min(argc, First), argv + argc);
+    ContainerSpec Spec;
+    if (argc < 4 || !ParseSpec(Arguments, Spec)) {
+        std::cerr << USAGE_MSG << std::endl;
+        exit(1);
+    }
+    long Count = std::stol(argv[2]);
+    bool Direct = strcmp(argv[3], DIRECT) == 0;
+    char *Stack = Direct ? AllocateStack() : nullptr;
+
+    long Failures = 0;
+    std::vector<double> Latencies;
+    auto Start = std::chrono::steady_clock::now();
+    for (long Index = 0; Index < Count; Index++) {
+        if (GapMillis > 0 && Index > 0) {
+            usleep(GapMillis * 1000);
+        }
+        auto Started = std::chrono::steady_clock::now();
+        int Status = Direct ? RunContainer(Spec, Stack) : RunThroughZygote(argv[3], Arguments);
+        Latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                                      Started).count());
+        if (ExitCode(Status) != SUCCESS) {
+            Failures++;
+        }
+    }
+    double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+    // the latency of a container is from its request until its exit status is back
+    std::sort(Latencies.begin(), Latencies.end());
+    double Mean = 0;
+    for (double Latency : Latencies) {
+        Mean += Latency / Latencies.size();
+    }
+    double Median = Latencies.empty() ? 0 : Latencies[Latencies.size() / 2];
+    std::cout << "mode=" << (Direct ? "direct" : ZYGOTE) << " containers=" << Count << " failures=" << Failures
+              << " gap_ms=" << GapMillis << " seconds=" << Seconds << " containers_per_sec=" << Count / Seconds
+              << " latency_us_mean=" << Mean << " latency_us_p50=" << Median << std::endl;
+    return SUCCESS;
+}
+
+
+/// BATCH ///
+
+/**
+ * Split a manifest line on whitespace, single or double quotes keep a value with spaces (e.g. -c "50000 100000")
+ * together
+ */
+std::vector<std::string> SplitLine(const std::string& Line) {
+    std::vector<std::string> Words;
+    std::string Word;
+    bool InWord = false;
+    char Quote = '\0';
+    for (char Character : Line) {
+        if (Quote == '\0' && Character != '\0' && strchr(QUOTES, Character) != nullptr) {
+            Quote = Character;
+            InWord = true;
+        } else if (Character == Quote) {
+            Quote = '\0';
+        } else if (Quote == '\0' && isspace((unsigned char) Character)) {
+            if (InWord) {
+                Words.push_back(Word);
+            }
+            Word.clear();
+            InWord = false;
+        } else {
+            Word += Character;
+            InWord = true;
+        }
+    }
+    if (InWord) {
+        Words.push_back(Word);
+    }
+    return Words;
+}
+
+
+/**
+ * Read a manifest: one container per line, in the same form as on the command line
+ * ([options] <hostname> <root> <pids max> <program> [args...]). Blank lines and # comments are skipped.
+ */
+std::vector<BatchEntry> ReadManifest(const char *Path) {
+    FILE *Manifest = fopen(Path, "re");
+    if (Manifest == nullptr) {
+        CreateErrorMessage(MANIFEST_ERROR_MSG);
+        exit(1);
+    }
+    std::vector<BatchEntry> Entries;
+    char *Line = nullptr;
+    size_t Capacity = 0;
+    int Number = 0;
+    while (getline(&Line, &Capacity, Manifest) != FAILURE) {
+        Number++;
+        std::string Text = Line;
+        Text = Text.substr(0, Text.find(COMMENT));
+        std::vector<std::string> Words = SplitLine(Text);
+        if (Words.empty()) {
+            continue;
+        }
+        BatchEntry Entry = {};
+        Entry.Line = Number;
+        if (!ParseSpec(Words, Entry.Spec)) {
+            CreateErrorMessage(std::string(MANIFEST_ERROR_MSG) + " (line " + std::to_string(Number) + ")");
+            exit(1);
+        }
+        Entries.push_back(Entry);
+    }
+    free(Line);
+    fclose(Manifest);
+    return Entries;
+}
+
+
+/**
+ * Start one batch entry, preparing its root the first time it is used. Returns false if it could not start.
+ */
+bool LaunchEntry(std::vector<BatchEntry>& Entries, size_t Index, std::set<std::string>& PreparedRoots,
+                 int EpollFd, char *Stack) {
+    BatchEntry& Entry = Entries[Index];
+    Entry.Start = std::chrono::steady_clock::now();
+    if (!Entry.Spec.Overlay && PreparedRoots.count(Entry.Spec.Root) == 0) {
+        if (!CreateDirectories(Entry.Spec.Root, true)) {
+            return false;
+        }
+        PreparedRoots.insert(Entry.Spec.Root);
+    }
+
+    Entry.Pid = StartContainer(Entry.Spec, Stack);
+    if (Entry.Pid == FAILURE) {
+        return false;
+    }
+    Entry.PidFd = OpenPidFd(Entry.Pid);
+    struct epoll_event Event = {};
+    Event.events = EPOLLIN;
+    Event.data.u64 = Index;
+    if (epoll_ctl(EpollFd, EPOLL_CTL_ADD, Entry.PidFd, &Event) != SUCCESS) {
+        CreateErrorMessage(EPOLL_ERROR_MSG);
+        exit(1);
+    }
+    Entry.Started = true;
+    return true;
+}
+
+
+/**
+ * An entry is done: remove its root's cgroup folders once no remaining entry uses that root
+ */
+void ReleaseRoot(const BatchEntry& Entry, std::unordered_map<std::string, size_t>& RootUsers,
+                 std::set<std::string>& PreparedRoots) {
+    if (Entry.Spec.Overlay || --RootUsers[Entry.Spec.Root] > 0) {
+        return;
+    }
+    if (PreparedRoots.erase(Entry.Spec.Root) != 0) {
+        RemovePath(Entry.Spec);
+    }
+}
+
+
+/**
+ * Run every container of a manifest, at most Concurrency at a time. Exited containers are reaped through their
+ * pidfds as they finish and cleaned up right away, then the exit code and run time of every entry is printed in
+ * manifest order followed by the totals.
+ */
+int BatchManager(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << USAGE_MSG << std::endl;
+        exit(1);
+    }
+    std::vector<BatchEntry> Entries = ReadManifest(argv[2]);
+    size_t Concurrency = std::max(argc > 3 ? std::stoul(argv[3]) : DEFAULT_CONCURRENCY, 1UL);
+    char *Stack = AllocateStack();
+    int EpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (EpollFd == FAILURE) {
+        CreateErrorMessage(EPOLL_ERROR_MSG);
+        exit(1);
+    }
+
+    std::unordered_map<std::string, size_t> RootUsers;
+    for (const BatchEntry& Entry : Entries) {
+        if (!Entry.Spec.Overlay) {
+            RootUsers[Entry.Spec.Root]++;
+        }
+    }
+    std::set<std::string> PreparedRoots;
+
+    auto BatchStart = std::chrono::steady_clock::now();
+    struct epoll_event Events[MAX_EVENTS];
+    size_t Next = 0;
+    size_t Running = 0;
+    while (Next < Entries.size() || Running > 0) {
+        while (Running < Concurrency && Next < Entries.size()) {
+            if (LaunchEntry(Entries, Next, PreparedRoots, EpollFd, Stack)) {
+                Running++;
+            } else {
+                Entries[Next].End = std::chrono::steady_clock::now();
+                ReleaseRoot(Entries[Next], RootUsers, PreparedRoots);
+            }
+            Next++;
+        }
+        if (Running == 0) {
+            continue;
+        }
+
+        int Ready = epoll_wait(EpollFd, Events, MAX_EVENTS, FAILURE);
+        if (Ready == FAILURE && errno == EINTR) {
+            continue;
+        }
+        if (Ready == FAILURE) {
+            CreateErrorMessage(EPOLL_ERROR_MSG);
+            exit(1);
+        }
+        for (int Index = 0; Index < Ready; Index++) {
+            BatchEntry& Entry = Entries[Events[Index].data.u64];
+            if (waitpid(Entry.Pid, &Entry.Status, 0) == FAILURE) {
+                CreateErrorMessage(WAIT_ERROR_MSG);
+                exit(1);
+            }
+            Entry.End = std::chrono::steady_clock::now();
+            epoll_ctl(EpollFd, EPOLL_CTL_DEL, Entry.PidFd, nullptr);
+            close(Entry.PidFd);
+            ReleaseCgroup(Entry.Spec);
+            ReleaseRoot(Entry, RootUsers, PreparedRoots);
+            Running--;
+        }
+    }
+    double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - BatchStart).count();
+
+    size_t Failures = 0;
+    for (const BatchEntry& Entry : Entries) {
+        std::cout << "line=" << Entry.Line << " hostname=" << Entry.Spec.HostName;
+        if (Entry.Started) {
+            std::cout << " exit=" << ExitCode(Entry.Status);
+        } else {
+            std::cout << " exit=not_started";
+        }
+        std::cout << " seconds=" << std::chrono::duration<double>(Entry.End - Entry.Start).count() << std::endl;
+        if (!Entry.Started || ExitCode(Entry.Status) != SUCCESS) {
+            Failures++;
+        }
+    }
+    std::cout << "entries=" << Entries.size() << " failures=" << Failures << " concurrency=" << Concurrency
+              << " seconds=" << Seconds << " containers_per_sec=" << Entries.size() / Seconds << std::endl;
+    close(EpollFd);
+    munmap(Stack, STACK_SIZE);
+    return Failures == 0 ? SUCCESS : 1;
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], ZYGOTE) == 0) {
+        return ZygoteManager(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], RUN) == 0) {
+        return RunManager(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], BENCH) == 0) {
+        return BenchManager(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], BATCH) == 0) {
+        return BatchManager(argc, argv);
+    }
+
+    ContainerSpec Spec;
+    if (!ParseSpec(std::vector<std::string>(argv + 1, argv + argc), Spec)) {
+        std::cerr << USAGE_MSG << std::endl;
+        exit(1);
+    }
+    char *Stack = AllocateStack();
+    RunContainer(Spec, Stack);
+    munmap(Stack, STACK_SIZE);
+
+    return SUCCESS;
+}
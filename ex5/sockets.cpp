@@ -1,17 +1,86 @@
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <unistd.h>
 #include <cstring>
+#include <cerrno>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <spawn.h>
+#include <signal.h>
+#include <time.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <vector>
 
 
 /// CONSTANTS ///
 #define BUFFER 256
 #define SERVER "server"
 #define CLIENT "client"
-#define Five 5
+#define STREAM "stream"
+#define BENCH "bench"
+#define CONNECT_BENCH "connbench"
+#define GET "get"
+#define PUT "put"
+#define STATS "stats"
+#define LISTEN_BACKLOG 4096
+#define MAX_EVENTS 256
+#define READ_CHUNK 4096
+#define HEADER_SIZE 4
+#define FIELD_SIZE 4
+#define MAX_MESSAGE_SIZE (64 * 1024)
+#define DEFAULT_MAX_CHILDREN 64
+#define PENDING_QUEUE_CAPACITY 1024
+#define SHELL_PATH "/bin/sh"
+#define SHELL_CHARACTERS "|&;<>()$`\\\"'*?[]#~=%{}\n"
+#define DEFAULT_PIPELINE_WINDOW 64
+#define DEFAULT_BENCH_CONNECTIONS 100
+#define DEFAULT_BENCH_MESSAGES 100
+#define DEFAULT_BENCH_THREADS 1
+#define DEFAULT_BENCH_SECONDS 5
+#define TRANSFER_CHUNK (1024 * 1024)    // file data in one STATUS_DATA response
+#define TRANSFER_BUFFER (64 * 1024)     // user space buffer of a TRANSFER_COPY transfer
+#define SPLICE_PIPE_SIZE (1024 * 1024)  // capacity asked for the pipes splice moves data through
+#define PROGRESS_INTERVAL (1024 * 1024) // bytes of an upload between STATUS_PROGRESS responses
+#define OUTPUT_HIGH_WATER (1024 * 1024) // queued response bytes above which command output is not read
+#define FILE_PERMISSIONS 0644
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/// REQUEST TYPES ///
+#define REQUEST_COMMAND 0 // run the command in the request body
+#define REQUEST_GET 1     // send a range of a Server file
+#define REQUEST_PUT 2     // write the file data which follows the request into a Server file
+#define REQUEST_STATS 3   // the Server counters and latency histograms, as text
+
+/// TRANSFER FLAGS ///
+#define TRANSFER_COPY 1 // move the data through a user space buffer (read/write) instead of sendfile/splice
+
+/// RESPONSE STATUS ///
+// a non negative status is the exit status of the command (128 + signal if it was killed)
+#define STATUS_REJECTED (-1)       // the Server command queue was full
+#define STATUS_SYSTEM_FAILURE (-2) // the Server could not run the command
+#define STATUS_BAD_REQUEST (-3)    // the request could not be parsed
+#define STATUS_OUTPUT (-4)         // a chunk of the command output, more responses for the request follow
+#define STATUS_DATA (-5)           // a chunk of file data of a get request
+#define STATUS_SIZE (-6)           // the number of bytes a get request will send (8 bytes output)
+#define STATUS_PROGRESS (-7)       // the number of bytes a put request has written so far (8 bytes output)
+#define STATUS_FILE_FAILURE (-8)   // the transfer failed, the output holds the reason
 
 /// ERROR MESSAGES ///
 #define HOST_NAME_FAILURE "system error: gethostname function failure"
@@ -21,8 +90,175 @@
 #define CONNECT_FAILURE "system error: Client connect function failure"
 #define WRITE_FAILURE "system error: Client write function failure"
 #define READ_FAILURE "system error: Server read function failure"
-#define SYSTEM_FAILURE "system error: Server system function failure"
+#define RESPONSE_FAILURE "system error: Client read function failure"
+#define SPAWN_FAILURE "system error: Server posix_spawn function failure"
+#define PIPE_FAILURE "system error: Server pipe function failure"
+#define PIDFD_FAILURE "system error: Server pidfd_open function failure"
+#define EPOLL_FAILURE "system error: Server epoll function failure"
+#define FCNTL_FAILURE "system error: fcntl function failure"
+#define SETSOCKOPT_FAILURE "system error: setsockopt function failure"
+#define PTHREAD_FAILURE "system error: pthread function failure"
+#define FILE_FAILURE "error: could not open the commands file"
+#define OPEN_FAILURE "system error: open function failure"
+#define TRANSFER_FAILURE "system error: file transfer failure"
+#define MESSAGE_SIZE_FAILURE "error: message larger than the maximal message size"
+#define USAGE "usage: sockets server <port> [-c max running commands] [-t threads] [-b backlog] [-n] " \
+              "[-d defer accept seconds]\n" \
+              "       sockets client <port> <command>\n" \
+              "       sockets stream <port> <commands file> [pipeline window]\n" \
+              "       sockets bench <port> [connections] [messages per connection] [command]\n" \
+              "       sockets connbench <port> [threads] [seconds]\n" \
+              "       sockets get <port> <server file> <local file> [-o offset] [-l length] [-u]\n" \
+              "       sockets put <port> <local file> <server file> [-o offset] [-u]\n" \
+              "       sockets stats <port>"
+
+
+/// MESSAGES ///
+// every message is a HEADER_SIZE bytes length (network byte order) followed by the payload.
+// a request payload is a FIELD_SIZE bytes request id, a FIELD_SIZE bytes request type and the request body,
+// a response payload is the request id, a FIELD_SIZE bytes status and the command output.
+// the output of a command arrives in STATUS_OUTPUT responses while it runs, the last response of a request
+// holds its final status. responses may arrive in a different order than the requests, the id matches them.
+// the body of a file transfer is its flags, an 8 bytes offset, an 8 bytes length and the Server path. a get is
+// answered with STATUS_SIZE and the data in STATUS_DATA responses, the data of a put follows its request
+// directly (not in messages) and the Server reports STATUS_PROGRESS while it is written
+
+/**
+ * Returns the message holding payload, with its length header
+ */
+std::string EncodeMessage(const std::string& payload)
+{
+    uint32_t length = htonl((uint32_t) payload.size());
+    std::string message((const char*) &length, HEADER_SIZE);
+    return message + payload;
+}
+
+/**
+ * Take the first complete message out of buffer.
+ * Returns 1 if a message was found, 0 if more bytes are needed, -1 if the message is too large
+ */
+int DecodeMessage(std::string& buffer, std::string& payload)
+{
+    if (buffer.size() < HEADER_SIZE)
+        return 0;
+
+    uint32_t length;
+    memcpy(&length, buffer.data(), HEADER_SIZE);
+    length = ntohl(length);
+    if (length > MAX_MESSAGE_SIZE)
+        return -1;
+    if (buffer.size() < HEADER_SIZE + length)
+        return 0;
+
+    payload = buffer.substr(HEADER_SIZE, length);
+    buffer.erase(0, HEADER_SIZE + length);
+    return 1;
+}
+
+void AppendField(std::string& buffer, uint32_t value)
+{
+    value = htonl(value);
+    buffer.append((const char*) &value, FIELD_SIZE);
+}
+
+uint32_t ReadField(const std::string& buffer, size_t offset)
+{
+    uint32_t value;
+    memcpy(&value, buffer.data() + offset, FIELD_SIZE);
+    return ntohl(value);
+}
+
+void AppendField64(std::string& buffer, uint64_t value)
+{
+    AppendField(buffer, (uint32_t) (value >> 32));
+    AppendField(buffer, (uint32_t) value);
+}
+
+uint64_t ReadField64(const std::string& buffer, size_t offset)
+{
+    return ((uint64_t) ReadField(buffer, offset) << 32) | ReadField(buffer, offset + FIELD_SIZE);
+}
+
+std::string EncodeRequest(uint32_t id, uint32_t type, const std::string& body)
+{
+    std::string payload;
+    AppendField(payload, id);
+    AppendField(payload, type);
+    return EncodeMessage(payload + body);
+}
+
+/**
+ * Returns the header of a response whose output (length bytes) is written separately
+ */
+std::string EncodeResponseHeader(uint32_t id, int32_t status, uint32_t length)
+{
+    std::string header;
+    AppendField(header, 2 * FIELD_SIZE + length);
+    AppendField(header, id);
+    AppendField(header, (uint32_t) status);
+    return header;
+}
+
+std::string EncodeResponse(uint32_t id, int32_t status, const std::string& output)
+{
+    return EncodeResponseHeader(id, status, (uint32_t) output.size()) + output;
+}
+
+std::string EncodeCount(uint64_t count)
+{
+    std::string output;
+    AppendField64(output, count);
+    return output;
+}
+
+std::string EncodeTransfer(uint32_t flags, uint64_t offset, uint64_t length, const std::string& path)
+{
+    std::string body;
+    AppendField(body, flags);
+    AppendField64(body, offset);
+    AppendField64(body, length);
+    return body + path;
+}
+
+/**
+ * Split a request payload, returns false if it is too short to hold an id and a type
+ */
+bool ParseRequest(const std::string& payload, uint32_t& id, uint32_t& type, std::string& body)
+{
+    if (payload.size() < 2 * FIELD_SIZE)
+        return false;
+    id = ReadField(payload, 0);
+    type = ReadField(payload, FIELD_SIZE);
+    body = payload.substr(2 * FIELD_SIZE);
+    return true;
+}
+
+/**
+ * Split a file transfer body, returns false if it is too short
+ */
+bool ParseTransfer(const std::string& body, uint32_t& flags, uint64_t& offset, uint64_t& length, std::string& path)
+{
+    if (body.size() < 5 * FIELD_SIZE)
+        return false;
+    flags = ReadField(body, 0);
+    offset = ReadField64(body, FIELD_SIZE);
+    length = ReadField64(body, 3 * FIELD_SIZE);
+    path = body.substr(5 * FIELD_SIZE);
+    return true;
+}
 
+/**
+ * Split a response payload, returns false if it is too short to hold an id and a status
+ */
+bool ParseResponse(const std::string& payload, uint32_t& id, int32_t& status, std::string& output)
+{
+    if (payload.size() < 2 * FIELD_SIZE)
+        return false;
+    id = ReadField(payload, 0);
+    status = (int32_t) ReadField(payload, FIELD_SIZE);
+    output = payload.substr(2 * FIELD_SIZE);
+    return true;
+}
 
 
 /**
@@ -32,7 +268,7 @@
 int read_data (int SocketFd, char*Buf,size_t n)
 {
     size_t BytesCounter = 0;
-    size_t BytesRead = 0;
+    ssize_t BytesRead = 0;
 
     while (BytesCounter < n)
     {
@@ -52,6 +288,109 @@ int read_data (int SocketFd, char*Buf,size_t n)
     return (int) BytesCounter;
 }
 
+/**
+ * Write all n bytes of Buf, returns -1 on failure
+ */
+
+int write_data (int SocketFd, const char* Buf, size_t n)
+{
+    size_t BytesCounter = 0;
+    while (BytesCounter < n)
+    {
+        ssize_t BytesWritten = write(SocketFd, Buf + BytesCounter, n - BytesCounter);
+        if (BytesWritten < 1)
+        {
+            return -1;
+        }
+        BytesCounter += BytesWritten;
+    }
+    return (int) BytesCounter;
+}
+
+/**
+ * Blocking read of one whole message from SocketFd, returns -1 on failure
+ */
+
+int read_message (int SocketFd, std::string& Payload)
+{
+    uint32_t Length;
+    if (read_data(SocketFd, (char*) &Length, HEADER_SIZE) == -1)
+    {
+        return -1;
+    }
+    Length = ntohl(Length);
+    if (Length > MAX_MESSAGE_SIZE)
+    {
+        std::cerr << MESSAGE_SIZE_FAILURE << std::endl;
+        return -1;
+    }
+    Payload.resize(Length);
+    if (Length > 0 && read_data(SocketFd, &Payload[0], Length) == -1)
+    {
+        return -1;
+    }
+    return (int) Length;
+}
+
+/**
+ * Move up to Count bytes from the socket SocketFd into FileFd at Offset through Pipe, without copying them
+ * to user space. Returns the number of bytes moved (less than Count only if a non-blocking socket had no more),
+ * or -1 on failure or if the peer closed the connection first
+ */
+
+ssize_t splice_to_file (int SocketFd, int FileFd, off_t& Offset, uint64_t Count, int Pipe[2])
+{
+    uint64_t Moved = 0;
+    while (Moved < Count)
+    {
+        size_t Piece = (size_t) std::min<uint64_t>(Count - Moved, SPLICE_PIPE_SIZE);
+        ssize_t In = splice(SocketFd, nullptr, Pipe[1], nullptr, Piece, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (In == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (In == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        if (In < 1)
+        {
+            return -1;
+        }
+        // the pipe is always emptied into the file, so it is empty again for the next call
+        ssize_t Out = 0;
+        while (Out < In)
+        {
+            ssize_t Written = splice(Pipe[0], nullptr, FileFd, &Offset, In - Out, SPLICE_F_MOVE);
+            if (Written == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (Written < 1)
+            {
+                return -1;
+            }
+            Out += Written;
+        }
+        Moved += In;
+    }
+    return (ssize_t) Moved;
+}
+
+/**
+ * Create the close-on-exec pipe splice_to_file moves data through, returns -1 on failure
+ */
+
+int splice_pipe (int Pipe[2])
+{
+    if (pipe2(Pipe, O_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+    fcntl(Pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE); // a smaller pipe only means more splice calls
+    return 0;
+}
+
 /**
  * This function waits for a connection of a Client to the Server
  */
@@ -61,7 +400,7 @@ int GetConnection ( int SockFd)
 {
     int ClientFd;
 
-    ClientFd = accept(SockFd,nullptr,nullptr);
+    ClientFd = accept4(SockFd,nullptr,nullptr,SOCK_NONBLOCK | SOCK_CLOEXEC);
     if ( ClientFd < 0)
     {
         return -1;
@@ -71,29 +410,59 @@ int GetConnection ( int SockFd)
 }
 
 /**
- * The socket initializer function according to Server/Client
+ * Set the O_NONBLOCK flag of Fd, returns -1 on failure
+ */
+
+int SetNonBlocking (int Fd)
+{
+    int Flags = fcntl(Fd, F_GETFL, 0);
+    if (Flags == -1 || fcntl(Fd, F_SETFL, Flags | O_NONBLOCK) == -1)
+    {
+        std::cerr << FCNTL_FAILURE << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Fill MyAddr with the address of this host and the port in the arguments, returns false on failure
  */
 
-int SocketInitializer (char ** Arguments, int mode)
+bool ServerAddress (char ** Arguments, struct sockaddr_in& MyAddr)
 {
     char buffer[BUFFER];
-    struct sockaddr_in MyAddr{};
     struct hostent *hp;
     gethostname( buffer,BUFFER);
     hp = gethostbyname( buffer);
     if( hp == nullptr)
     {
         std::cerr << HOST_NAME_FAILURE << std::endl;
-        return (-1);
+        return false;
     }
 
     memset(&(MyAddr),0, sizeof(MyAddr)); // Set all My_addr values to zero value
     memcpy( (char *)&MyAddr.sin_addr,hp->h_addr,hp->h_length);     // Initialize the socket address
     MyAddr.sin_family = hp->h_addrtype;     // Initialize to AF_INET
     MyAddr.sin_port = htons( (u_short)strtol(Arguments[2], nullptr,10));     // Set the port number
+    return true;
+}
+
+/**
+ * The socket initializer function according to Server/Client.
+ * a Server socket listens with Backlog, and with ReusePort several sockets share the port (the kernel spreads the
+ * incoming connections between them)
+ */
+
+int SocketInitializer (char ** Arguments, int mode, int Backlog = LISTEN_BACKLOG, bool ReusePort = false)
+{
+    struct sockaddr_in MyAddr{};
+    if (!ServerAddress(Arguments, MyAddr))
+    {
+        return (-1);
+    }
 
     // Creating  the socket and the port
-    int SockFd = socket(hp->h_addrtype,SOCK_STREAM,0);
+    int SockFd = socket(MyAddr.sin_family,SOCK_STREAM | SOCK_CLOEXEC,0);
     if (SockFd == -1 )
     {
         std::cerr << SOCKET_FAILURE << std::endl;
@@ -103,13 +472,21 @@ int SocketInitializer (char ** Arguments, int mode)
     if (mode == 0)
     {
         // Specific actions for Server
+        int Reuse = 1;
+        setsockopt(SockFd, SOL_SOCKET, SO_REUSEADDR, &Reuse, sizeof(Reuse));
+        if (ReusePort && setsockopt(SockFd, SOL_SOCKET, SO_REUSEPORT, &Reuse, sizeof(Reuse)) < 0)
+        {
+            close(SockFd);
+            std::cerr << SETSOCKOPT_FAILURE << std::endl;
+            return (-1);
+        }
         if(bind(SockFd, (struct sockaddr *)&MyAddr,sizeof(MyAddr)) < 0)
         {
             close(SockFd);
             std::cerr << BIND_FAILURE << std::endl;
             return (-1);
         }
-        if (listen(SockFd,Five) < 0 )
+        if (listen(SockFd,Backlog) < 0 )
         {
             std::cerr << LISTEN_FAILURE << std::endl;
 
@@ -131,78 +508,1973 @@ int SocketInitializer (char ** Arguments, int mode)
 }
 
 
+/// CLIENT ///
+
+/**
+ * Read one response from SockFd, returns false if the connection failed or the response is malformed
+ */
+
+bool ReadResponse (int SockFd, uint32_t& Id, int32_t& Status, std::string& Output)
+{
+    std::string Payload;
+    if (read_message(SockFd, Payload) == -1 || !ParseResponse(Payload, Id, Status, Output))
+    {
+        std::cerr << RESPONSE_FAILURE << std::endl;
+        return false;
+    }
+    return true;
+}
+
 /**
- * This function creates a socket for the Client and writes to the Server
+ * This function creates a socket for the Client, sends the command to the Server and waits for its status.
+ * Returns the exit status of the command, or 1 if it could not be run
  */
 
 
-void ClientManager(char ** argv)
+int ClientManager(char ** argv)
 {
   int SockFd = SocketInitializer(argv,1);
   if (SockFd == -1)
   {
       exit(1);
   }
-  if (write(SockFd,argv[3],BUFFER) == -1)
+  std::string Message = EncodeRequest(1, REQUEST_COMMAND, argv[3]);
+  if (write_data(SockFd,Message.data(),Message.size()) == -1)
   {
       std::cerr << WRITE_FAILURE << std::endl;
       close(SockFd);
       exit(1);
   }
-}
 
+  uint32_t Id;
+  int32_t Status = STATUS_OUTPUT;
+  std::string Output;
+  while (Status == STATUS_OUTPUT)
+  {
+      if (!ReadResponse(SockFd, Id, Status, Output))
+      {
+          close(SockFd);
+          exit(1);
+      }
+      std::cout << Output << std::flush;
+  }
+  close(SockFd);
+  return Status < 0 ? 1 : Status;
+}
 
 /**
- * This function creates a socket for the Server and wait for a connection of clients.
- * when a connection occurs the Server read data from the Client and execute the command
+ * Print the counters and latency percentiles of the Server
  */
 
+int StatsManager (char ** argv)
+{
+    int SockFd = SocketInitializer(argv,1);
+    if (SockFd == -1)
+    {
+        exit(1);
+    }
+    std::string Message = EncodeRequest(1, REQUEST_STATS, std::string());
+    uint32_t Id;
+    int32_t Status;
+    std::string Output;
+    if (write_data(SockFd, Message.data(), Message.size()) == -1)
+    {
+        std::cerr << WRITE_FAILURE << std::endl;
+        exit(1);
+    }
+    if (!ReadResponse(SockFd, Id, Status, Output))
+    {
+        exit(1);
+    }
+    close(SockFd);
+    std::cout << Output;
+    return Status == 0 ? 0 : 1;
+}
+
+/**
+ * Send every line of the commands file over one persistent connection.
+ * up to Window requests are in flight at once, so the Server can run them while the Client still sends.
+ * Returns 0 if every command succeeded, 1 otherwise
+ */
 
-void ServerManager (char ** argv)
+int StreamManager (int argc, char ** argv)
 {
-    char* buffer[BUFFER];
-    int SockFd = SocketInitializer(argv,0);
+    std::ifstream Commands(argv[3]);
+    if (!Commands.is_open())
+    {
+        std::cerr << FILE_FAILURE << std::endl;
+        exit(1);
+    }
+    size_t Window = (argc > 4) ? strtoul(argv[4], nullptr, 10) : DEFAULT_PIPELINE_WINDOW;
+    if (Window == 0)
+    {
+        Window = 1;
+    }
+
+    int SockFd = SocketInitializer(argv,1);
     if (SockFd == -1)
     {
         exit(1);
     }
 
-    while (true)
+    auto Start = std::chrono::steady_clock::now();
+    std::unordered_map<uint32_t, std::string> InFlight;
+    uint32_t NextId = 0;
+    size_t Completed = 0, Failed = 0;
+    std::string Line;
+    bool MoreCommands = true;
+
+    while (MoreCommands || !InFlight.empty())
     {
-        int ClientFd = GetConnection(SockFd);
-        if (ClientFd == - 1)
+        // fill the window with all the commands that can be sent without waiting
+        std::string Batch;
+        while (MoreCommands && InFlight.size() < Window)
+        {
+            if (!std::getline(Commands, Line))
+            {
+                MoreCommands = false;
+                break;
+            }
+            if (Line.empty())
+            {
+                continue;
+            }
+            InFlight[NextId] = Line;
+            Batch += EncodeRequest(NextId++, REQUEST_COMMAND, Line);
+        }
+        if (!Batch.empty() && write_data(SockFd, Batch.data(), Batch.size()) == -1)
+        {
+            std::cerr << WRITE_FAILURE << std::endl;
+            close(SockFd);
+            exit(1);
+        }
+        if (InFlight.empty())
         {
             continue;
         }
 
-        if (read_data(ClientFd,*buffer,BUFFER)  == - 1 )
+        uint32_t Id;
+        int32_t Status;
+        std::string Output;
+        if (!ReadResponse(SockFd, Id, Status, Output))
         {
             close(SockFd);
-            std::cerr << READ_FAILURE << std::endl;
             exit(1);
         }
-        system(*buffer) ;
-
+        auto Request = InFlight.find(Id);
+        if (Request == InFlight.end())
+        {
+            continue;
+        }
+        std::cout << Output << std::flush;
+        if (Status == STATUS_OUTPUT)
+        {
+            continue;
+        }
+        if (Status != 0)
+        {
+            std::cerr << "command \"" << Request->second << "\" failed with status " << Status << std::endl;
+            Failed++;
+        }
+        InFlight.erase(Request);
+        Completed++;
     }
+    close(SockFd);
+
+    double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    std::cerr << "commands=" << Completed << " failed=" << Failed
+              << " commands_per_sec=" << (Seconds > 0 ? Completed / Seconds : 0) << std::endl;
+    return Failed ? 1 : 0;
+}
+
 
+/**
+ * Print the progress of a transfer when it passed another percent
+ */
+
+void ShowProgress (uint64_t Done, uint64_t Total, int& LastPercent)
+{
+    int Percent = Total ? (int) (Done * 100 / Total) : 100;
+    if (Percent != LastPercent)
+    {
+        LastPercent = Percent;
+        std::cerr << "\r" << Done << " / " << Total << " bytes (" << Percent << "%)" << std::flush;
+    }
+}
 
+void PrintTransferRate (uint64_t Bytes, std::chrono::steady_clock::time_point Start, uint32_t Flags)
+{
+    double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    std::cerr << std::endl;
+    std::cout << "bytes=" << Bytes << " seconds=" << Seconds
+              << " mb_per_sec=" << (Seconds > 0 ? Bytes / Seconds / (1024 * 1024) : 0)
+              << " mode=" << ((Flags & TRANSFER_COPY) ? "copy" : "zero-copy") << std::endl;
 }
 
+/**
+ * Parse the [-o offset] [-l length] [-u] options of get and put
+ */
 
-int main(int argc, char* argv[])
+void ParseTransferOptions (int argc, char ** argv, uint64_t& Offset, uint64_t& Length, uint32_t& Flags)
 {
+    int Option;
+    optind = 5;
+    while ((Option = getopt(argc, argv, "o:l:u")) != -1)
+    {
+        switch (Option)
+        {
+            case 'o': Offset = strtoull(optarg, nullptr, 10); break;
+            case 'l': Length = strtoull(optarg, nullptr, 10); break;
+            case 'u': Flags |= TRANSFER_COPY; break;
+            default:
+                std::cerr << USAGE << std::endl;
+                exit(1);
+        }
+    }
+}
 
+/**
+ * Read the id and status of a response, and the length of its output which is left in the socket
+ */
 
-    if (strcmp(argv[1],SERVER) == 0 )
+bool ReadResponseHeader (int SockFd, uint32_t& Length, uint32_t& Id, int32_t& Status)
+{
+    std::string Header(HEADER_SIZE + 2 * FIELD_SIZE, '\0');
+    if (read_data(SockFd, &Header[0], Header.size()) == -1 || ReadField(Header, 0) < 2 * FIELD_SIZE)
     {
-        ServerManager(argv);
+        std::cerr << RESPONSE_FAILURE << std::endl;
+        return false;
+    }
+    Length = ReadField(Header, 0) - 2 * FIELD_SIZE;
+    Id = ReadField(Header, HEADER_SIZE);
+    Status = (int32_t) ReadField(Header, HEADER_SIZE + FIELD_SIZE);
+    return true;
+}
 
-    } else
+/**
+ * Write the Length bytes of file data waiting in the socket to FileFd at Offset
+ */
+
+bool ReceiveFileData (int SockFd, int FileFd, off_t& Offset, uint32_t Length, uint32_t Flags, int Pipe[2])
+{
+    if (!(Flags & TRANSFER_COPY))
     {
-        ClientManager(argv);
+        ssize_t Moved = 0;
+        while (Moved < Length)
+        {
+            ssize_t Piece = splice_to_file(SockFd, FileFd, Offset, Length - Moved, Pipe);
+            if (Piece == -1)
+            {
+                return false;
+            }
+            Moved += Piece;
+        }
+        return true;
     }
-    return 0 ;
 
+    std::vector<char> Buffer(Length);
+    if (Length > 0 && (read_data(SockFd, Buffer.data(), Length) == -1 ||
+                       pwrite(FileFd, Buffer.data(), Length, Offset) != (ssize_t) Length))
+    {
+        return false;
+    }
+    Offset += Length;
+    return true;
 }
 
+/**
+ * Fetch a range of a Server file into a local file, the Server sends it with sendfile and the Client
+ * writes it with splice (or both use read/write loops with -u)
+ */
+
+int GetManager (int argc, char ** argv)
+{
+    uint64_t Offset = 0, Length = 0;
+    uint32_t Flags = 0;
+    ParseTransferOptions(argc, argv, Offset, Length, Flags);
+
+    int FileFd = open(argv[4], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, FILE_PERMISSIONS);
+    int Pipe[2];
+    if (FileFd == -1 || splice_pipe(Pipe) == -1)
+    {
+        std::cerr << OPEN_FAILURE << std::endl;
+        exit(1);
+    }
+    int SockFd = SocketInitializer(argv,1);
+    if (SockFd == -1)
+    {
+        exit(1);
+    }
+
+    auto Start = std::chrono::steady_clock::now();
+    std::string Request = EncodeRequest(1, REQUEST_GET, EncodeTransfer(Flags, Offset, Length, argv[3]));
+    if (write_data(SockFd, Request.data(), Request.size()) == -1)
+    {
+        std::cerr << WRITE_FAILURE << std::endl;
+        exit(1);
+    }
+
+    uint64_t Total = 0, Received = 0;
+    off_t FileOffset = 0;
+    int LastPercent = -1;
+    while (true)
+    {
+        uint32_t Size, Id;
+        int32_t Status;
+        if (!ReadResponseHeader(SockFd, Size, Id, Status))
+        {
+            exit(1);
+        }
+        if (Status == STATUS_DATA)
+        {
+            if (!ReceiveFileData(SockFd, FileFd, FileOffset, Size, Flags, Pipe))
+            {
+                std::cerr << TRANSFER_FAILURE << std::endl;
+                exit(1);
+            }
+            Received += Size;
+            ShowProgress(Received, Total, LastPercent);
+            continue;
+        }
 
+        std::string Output(Size, '\0');
+        if (Size > 0 && read_data(SockFd, &Output[0], Size) == -1)
+        {
+            std::cerr << RESPONSE_FAILURE << std::endl;
+            exit(1);
+        }
+        if (Status == STATUS_SIZE)
+        {
+            Total = ReadField64(Output, 0);
+            continue;
+        }
+        if (Status != 0)
+        {
+            std::cerr << TRANSFER_FAILURE << ": " << Output << std::endl;
+            close(SockFd);
+            return 1;
+        }
+        break;
+    }
+    close(SockFd);
+    close(FileFd);
+    PrintTransferRate(Received, Start, Flags);
+    return 0;
+}
+
+typedef struct PutReader {
+    int SockFd;
+    uint64_t Total;
+    int32_t Status;
+    std::string Error;
+} PutReader;
+
+/**
+ * Read the progress and the final response of a put while the data is still being sent
+ */
+
+void* PutReaderRoutine (void* Arg)
+{
+    auto Reader = (PutReader*) Arg;
+    int LastPercent = -1;
+    Reader->Status = STATUS_SYSTEM_FAILURE;
+    while (true)
+    {
+        uint32_t Id;
+        int32_t Status;
+        std::string Output;
+        if (!ReadResponse(Reader->SockFd, Id, Status, Output))
+        {
+            return nullptr;
+        }
+        if (Status == STATUS_PROGRESS)
+        {
+            ShowProgress(ReadField64(Output, 0), Reader->Total, LastPercent);
+            continue;
+        }
+        Reader->Status = Status;
+        Reader->Error = Output;
+        return nullptr;
+    }
+}
+
+/**
+ * Store a local file (from Offset of the Server file on), the Client sends it with sendfile and the Server
+ * writes it with splice (or both use read/write loops with -u)
+ */
+
+int PutManager (int argc, char ** argv)
+{
+    uint64_t Offset = 0, Length = 0;
+    uint32_t Flags = 0;
+    ParseTransferOptions(argc, argv, Offset, Length, Flags);
+
+    int FileFd = open(argv[3], O_RDONLY | O_CLOEXEC);
+    struct stat FileStat{};
+    if (FileFd == -1 || fstat(FileFd, &FileStat) == -1)
+    {
+        std::cerr << OPEN_FAILURE << std::endl;
+        exit(1);
+    }
+    int SockFd = SocketInitializer(argv,1);
+    if (SockFd == -1)
+    {
+        exit(1);
+    }
+
+    auto Start = std::chrono::steady_clock::now();
+    uint64_t Total = (uint64_t) FileStat.st_size;
+    std::string Request = EncodeRequest(1, REQUEST_PUT, EncodeTransfer(Flags, Offset, Total, argv[4]));
+    if (write_data(SockFd, Request.data(), Request.size()) == -1)
+    {
+        std::cerr << WRITE_FAILURE << std::endl;
+        exit(1);
+    }
+
+    PutReader Reader{SockFd, Total, 0, std::string()};
+    pthread_t ReaderThread;
+    if (pthread_create(&ReaderThread, nullptr, PutReaderRoutine, &Reader))
+    {
+        std::cerr << PTHREAD_FAILURE << std::endl;
+        exit(1);
+    }
+
+    off_t FileOffset = 0;
+    std::vector<char> Buffer(TRANSFER_BUFFER);
+    while ((uint64_t) FileOffset < Total)
+    {
+        ssize_t Sent;
+        if (Flags & TRANSFER_COPY)
+        {
+            ssize_t Read = pread(FileFd, Buffer.data(), Buffer.size(), FileOffset);
+            Sent = (Read < 1 || write_data(SockFd, Buffer.data(), Read) == -1) ? -1 : Read;
+            FileOffset += (Sent > 0) ? Sent : 0;
+        }
+        else
+        {
+            Sent = sendfile(SockFd, FileFd, &FileOffset, Total - FileOffset);
+        }
+        if (Sent == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (Sent < 1)
+        {
+            std::cerr << TRANSFER_FAILURE << std::endl;
+            exit(1);
+        }
+    }
+    pthread_join(ReaderThread, nullptr);
+    close(SockFd);
+    close(FileFd);
+
+    if (Reader.Status != 0)
+    {
+        std::cerr << std::endl << TRANSFER_FAILURE << ": " << Reader.Error << std::endl;
+        return 1;
+    }
+    PrintTransferRate(Total, Start, Flags);
+    return 0;
+}
+
+
+/// EXECUTION ENGINE ///
+// commands run as children of the event loop itself: posix_spawn (a vfork-like clone in glibc) does not copy the
+// Server memory, a command without shell syntax is executed directly without starting /bin/sh, and the child
+// stdout/stderr go through a pipe which the event loop streams back to the Client. every child has a pidfd in the
+// epoll instance of its loop which becomes readable when it exits, so nothing ever blocks waiting for a command
+// and every loop reaps only its own children
+
+typedef struct Job {
+    int Fd;          // the connection which sent the request
+    uint64_t Serial; // tells a reused fd from the connection which sent the request
+    uint32_t Id;
+    std::string Command;
+    uint64_t Arrival; // NowNanos() when the request was parsed
+} Job;
+
+typedef struct Child {
+    Job Request;
+    int OutputFd;    // read end of the child stdout/stderr pipe, -1 once it reached EOF
+    int PidFd;       // readable once the child exited
+    bool Exited;
+    int32_t Status;
+    uint64_t Started;
+} Child;
+
+/**
+ * Returns true if Command uses shell syntax, and has to be run by /bin/sh
+ */
+
+bool NeedsShell (const std::string& Command)
+{
+    return Command.find_first_of(SHELL_CHARACTERS) != std::string::npos;
+}
+
+/**
+ * Split Command on white spaces
+ */
+
+std::vector<std::string> SplitArguments (const std::string& Command)
+{
+    std::vector<std::string> Arguments;
+    size_t Start = Command.find_first_not_of(" \t");
+    while (Start != std::string::npos)
+    {
+        size_t End = Command.find_first_of(" \t", Start);
+        Arguments.push_back(Command.substr(Start, End - Start));
+        Start = Command.find_first_not_of(" \t", End);
+    }
+    return Arguments;
+}
+
+/**
+ * Spawn Arguments with stdin from /dev/null and stdout/stderr to OutputFd.
+ * Returns 0 or the posix_spawn error number
+ */
+
+int SpawnArguments (const std::vector<std::string>& Arguments, int OutputFd, pid_t& Pid)
+{
+    std::vector<char*> Argv;
+    for (const std::string& Argument : Arguments)
+    {
+        Argv.push_back((char*) Argument.c_str());
+    }
+    Argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t Actions;
+    posix_spawn_file_actions_init(&Actions);
+    posix_spawn_file_actions_addopen(&Actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&Actions, OutputFd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&Actions, OutputFd, STDERR_FILENO);
+
+    // the Server ignores SIGPIPE, and an ignored signal would stay ignored in the command
+    posix_spawnattr_t Attributes;
+    posix_spawnattr_init(&Attributes);
+    sigset_t Default;
+    sigemptyset(&Default);
+    sigaddset(&Default, SIGPIPE);
+    posix_spawnattr_setsigdefault(&Attributes, &Default);
+    posix_spawnattr_setflags(&Attributes, POSIX_SPAWN_SETSIGDEF);
+
+    int Error = posix_spawnp(&Pid, Argv[0], &Actions, &Attributes, Argv.data(), environ);
+    posix_spawnattr_destroy(&Attributes);
+    posix_spawn_file_actions_destroy(&Actions);
+    return Error;
+}
+
+/**
+ * Start Command. a command which is not found as a program (a shell builtin like exit or cd) is retried by the shell.
+ * Returns 0 or the posix_spawn error number
+ */
+
+int SpawnCommand (const std::string& Command, int OutputFd, pid_t& Pid)
+{
+    std::vector<std::string> Arguments = SplitArguments(Command);
+    if (!NeedsShell(Command) && !Arguments.empty())
+    {
+        int Error = SpawnArguments(Arguments, OutputFd, Pid);
+        if (Error != ENOENT)
+        {
+            return Error;
+        }
+    }
+    return SpawnArguments({SHELL_PATH, "-c", Command}, OutputFd, Pid);
+}
+
+/**
+ * Returns a close-on-exec pidfd of the child Pid, -1 on failure
+ */
+
+int OpenPidFd (pid_t Pid)
+{
+    int PidFd = (int) syscall(SYS_pidfd_open, Pid, 0);
+    if (PidFd != -1)
+    {
+        fcntl(PidFd, F_SETFD, FD_CLOEXEC);
+    }
+    return PidFd;
+}
+
+/**
+ * Returns the response status of a waitpid status
+ */
+
+int32_t CommandStatus (int WaitStatus)
+{
+    if (WIFEXITED(WaitStatus))
+    {
+        return WEXITSTATUS(WaitStatus);
+    }
+    return 128 + WTERMSIG(WaitStatus);
+}
+
+
+/// STATISTICS ///
+// every loop updates only its own counters and histograms, with relaxed atomic stores and no locks, and a stats
+// request (answered by whichever loop got it) reads the ones of all the loops
+
+/**
+ * Returns the time of a monotonic clock in nanoseconds
+ */
+
+uint64_t NowNanos ()
+{
+    struct timespec Time{};
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return (uint64_t) Time.tv_sec * 1000000000ULL + (uint64_t) Time.tv_nsec;
+}
+
+/**
+ * Add Count to a counter which only one thread writes, while other threads may read it at any time
+ */
+
+inline void Increment (std::atomic<uint64_t>& Counter, uint64_t Count = 1)
+{
+    Counter.store(Counter.load(std::memory_order_relaxed) + Count, std::memory_order_relaxed);
+}
+
+/**
+ * A log-linear (HDR style) histogram of nanosecond latencies. the values are grouped by their highest bit and every
+ * group is split to HISTOGRAM_SUB_BUCKETS linear buckets, so a bucket is within 1/HISTOGRAM_SUB_BUCKETS of its values
+ * over the whole 64 bit range. one thread records, any thread may read
+ */
+class LatencyHistogram {
+public:
+    void Record(uint64_t Nanos)
+    {
+        Increment(Buckets[BucketOf(Nanos)]);
+        if (Nanos > Max.load(std::memory_order_relaxed))
+            Max.store(Nanos, std::memory_order_relaxed);
+    }
+
+    /**
+     * Add the bucket counts of this histogram to Counts, and its maximum to MaxNanos
+     */
+    void AddTo(std::vector<uint64_t>& Counts, uint64_t& MaxNanos) const
+    {
+        Counts.resize(HISTOGRAM_BUCKETS);
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+            Counts[i] += Buckets[i].load(std::memory_order_relaxed);
+        MaxNanos = std::max(MaxNanos, Max.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * The highest value which falls in Bucket
+     */
+    static uint64_t BucketValue(size_t Bucket)
+    {
+        if (Bucket < HISTOGRAM_SUB_BUCKETS)
+            return Bucket;
+        size_t Shift = Bucket / HISTOGRAM_SUB_BUCKETS - 1;
+        uint64_t Lowest = (uint64_t) (HISTOGRAM_SUB_BUCKETS + Bucket % HISTOGRAM_SUB_BUCKETS) << Shift;
+        return Lowest + ((uint64_t) 1 << Shift) - 1;
+    }
+
+private:
+    static size_t BucketOf(uint64_t Value)
+    {
+        if (Value < HISTOGRAM_SUB_BUCKETS)
+            return (size_t) Value;
+        size_t Shift = 63 - __builtin_clzll(Value) - HISTOGRAM_SUB_BITS;
+        return (Shift + 1) * HISTOGRAM_SUB_BUCKETS + (size_t) ((Value >> Shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+    }
+
+    std::atomic<uint64_t> Buckets[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> Max;
+};
+
+typedef struct LoopStats {
+    std::atomic<uint64_t> Accepted, AcceptErrors, Closed, ConnectionErrors;
+    std::atomic<uint64_t> Requests, Rejected, BadRequests, Commands, Downloads, Uploads;
+    std::atomic<uint64_t> BytesReceived, BytesSent;
+    LatencyHistogram Accept;   // accepting and registering one connection
+    LatencyHistogram Read;     // handling one readable event of a connection
+    LatencyHistogram Command;  // a command from its spawn until it was reaped and its output was read
+    LatencyHistogram Response; // a request from its arrival until its final response was queued
+} LoopStats;
+
+std::vector<LoopStats*> AllStats; // filled before the loops start, never changed after
+
+/**
+ * One line of percentiles of the histograms of all the loops, Select picks the histogram of a loop
+ */
+
+std::string HistogramReport (const char* Name, const LatencyHistogram& (*Select)(const LoopStats&))
+{
+    std::vector<uint64_t> Counts;
+    uint64_t MaxNanos = 0, Total = 0;
+    for (const LoopStats* Stats : AllStats)
+        Select(*Stats).AddTo(Counts, MaxNanos);
+    for (uint64_t Count : Counts)
+        Total += Count;
+
+    std::string Line = std::string(Name) + "_ns count=" + std::to_string(Total);
+    const double Percentiles[] = {50, 90, 99, 99.9};
+    const char* Names[] = {"p50", "p90", "p99", "p999"};
+    for (size_t p = 0; p < sizeof(Percentiles) / sizeof(Percentiles[0]); p++)
+    {
+        // the smallest bucket which holds at least the percentile of the values
+        uint64_t Target = (uint64_t) (Percentiles[p] / 100 * Total + 0.5), Seen = 0;
+        size_t Bucket = 0;
+        while (Total && Bucket < Counts.size() && (Seen += Counts[Bucket]) < std::max<uint64_t>(Target, 1))
+            Bucket++;
+        // a bucket's value is its upper bound, which may lie above every value recorded
+        uint64_t Value = Total ? std::min(LatencyHistogram::BucketValue(Bucket), MaxNanos) : 0;
+        Line += std::string(" ") + Names[p] + "=" + std::to_string(Value);
+    }
+    return Line + " max=" + std::to_string(MaxNanos) + "\n";
+}
+
+/**
+ * The text of a stats response: the counters of every loop, and the latency percentiles of all of them together
+ */
+
+std::string StatsReport ()
+{
+    std::string Report;
+    for (size_t i = 0; i < AllStats.size(); i++)
+    {
+        const LoopStats& Stats = *AllStats[i];
+        uint64_t Accepted = Stats.Accepted.load(std::memory_order_relaxed);
+        uint64_t Closed = Stats.Closed.load(std::memory_order_relaxed);
+        Report += "loop=" + std::to_string(i) +
+                  " accepted=" + std::to_string(Accepted) +
+                  " open=" + std::to_string(Accepted >= Closed ? Accepted - Closed : 0) +
+                  " accept_errors=" + std::to_string(Stats.AcceptErrors.load(std::memory_order_relaxed)) +
+                  " connection_errors=" + std::to_string(Stats.ConnectionErrors.load(std::memory_order_relaxed)) +
+                  " requests=" + std::to_string(Stats.Requests.load(std::memory_order_relaxed)) +
+                  " rejected=" + std::to_string(Stats.Rejected.load(std::memory_order_relaxed)) +
+                  " bad_requests=" + std::to_string(Stats.BadRequests.load(std::memory_order_relaxed)) +
+                  " commands=" + std::to_string(Stats.Commands.load(std::memory_order_relaxed)) +
+                  " downloads=" + std::to_string(Stats.Downloads.load(std::memory_order_relaxed)) +
+                  " uploads=" + std::to_string(Stats.Uploads.load(std::memory_order_relaxed)) +
+                  " bytes_received=" + std::to_string(Stats.BytesReceived.load(std::memory_order_relaxed)) +
+                  " bytes_sent=" + std::to_string(Stats.BytesSent.load(std::memory_order_relaxed)) + "\n";
+    }
+    Report += HistogramReport("accept", [](const LoopStats& Stats) -> const LatencyHistogram& { return Stats.Accept; });
+    Report += HistogramReport("read", [](const LoopStats& Stats) -> const LatencyHistogram& { return Stats.Read; });
+    Report += HistogramReport("command", [](const LoopStats& Stats) -> const LatencyHistogram& { return Stats.Command; });
+    Report += HistogramReport("response", [](const LoopStats& Stats) -> const LatencyHistogram& { return Stats.Response; });
+    return Report;
+}
+
+
+/// SERVER ///
+
+typedef struct Transfer {
+    uint32_t Id;
+    int FileFd;         // -1 if the file could not be used, the data of an upload is then read and dropped
+    off_t Offset;       // the next position in the file
+    uint64_t Remaining; // bytes left to send or receive
+    uint64_t Total;
+    bool Copy;          // TRANSFER_COPY: move the data through a user space buffer
+    std::string Error;
+    uint64_t Arrival;
+} Transfer;
+
+typedef struct Connection {
+    int Fd;
+    uint64_t Serial;
+    std::string Input;  // bytes received which are not a complete message yet
+    std::string Output; // responses which were not written yet
+    size_t InFlight;    // requests running or waiting to run, which were not answered yet
+    bool ReadClosed;    // the Client closed its side, the connection ends once it is answered
+    LoopStats* Stats;   // of the loop which owns the connection
+    std::deque<Transfer> Downloads; // get requests, the first one is being sent
+    std::string ChunkHeader;        // header of the file chunk which is sent next, not written yet
+    size_t ChunkLeft;               // bytes of the current file chunk which were not sent yet
+    bool Uploading;                 // the bytes which arrive are the data of Upload, not requests
+    Transfer Upload;
+    std::vector<int> PausedOutputs; // child output pipes which are not read while Output is above the high water
+} Connection;
+
+typedef struct Server {
+    int EpollFd;
+    int ListenFd;
+    int SpareFd;                                   // given up at the fd limit to accept and close a connection
+    bool AcceptStalled;                            // the listener was not drained, re-armed when a connection closes
+    size_t MaxChildren;                            // commands running at once
+    bool NoDelay;                                  // TCP_NODELAY on the accepted connections
+    int SplicePipe[2];                             // moves upload data from the sockets into files
+    LoopStats* Stats;
+    uint64_t NextSerial;
+    std::unordered_map<int, Connection> Connections;
+    std::unordered_map<pid_t, Child> Children;
+    std::unordered_map<int, pid_t> Outputs;        // child output pipe -> child pid
+    std::unordered_map<int, pid_t> PidFds;         // child pidfd -> child pid
+    std::deque<Job> Pending;                       // requests waiting for a free child slot
+} Server;
+
+/**
+ * Register Fd in the epoll instance (edge triggered), returns -1 on failure
+ */
+
+int EpollAdd (int EpollFd, int Fd, uint32_t Events)
+{
+    struct epoll_event Event{};
+    Event.events = Events | EPOLLET;
+    Event.data.fd = Fd;
+    if (epoll_ctl(EpollFd, EPOLL_CTL_ADD, Fd, &Event) == -1)
+    {
+        std::cerr << EPOLL_FAILURE << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Register Fd again, so epoll reports it once more if it is still ready (it is edge triggered)
+ */
+
+int EpollRearm (int EpollFd, int Fd, uint32_t Events)
+{
+    struct epoll_event Event{};
+    Event.events = Events | EPOLLET;
+    Event.data.fd = Fd;
+    if (epoll_ctl(EpollFd, EPOLL_CTL_MOD, Fd, &Event) == -1)
+    {
+        std::cerr << EPOLL_FAILURE << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Read the child output pipes which were paused for Conn again, the loop gets their pending output as events
+ */
+
+void ResumeOutputs (Server& Srv, Connection& Conn)
+{
+    for (int OutputFd : Conn.PausedOutputs)
+    {
+        EpollRearm(Srv.EpollFd, OutputFd, EPOLLIN);
+    }
+    Conn.PausedOutputs.clear();
+}
+
+void CloseConnection (Server& Srv, int Fd)
+{
+    Connection& Conn = Srv.Connections[Fd];
+    ResumeOutputs(Srv, Conn); // their output is dropped from now on
+    for (Transfer& Download : Conn.Downloads)
+    {
+        close(Download.FileFd);
+    }
+    if (Conn.Uploading && Conn.Upload.FileFd != -1)
+    {
+        close(Conn.Upload.FileFd);
+    }
+    close(Fd); // closing the fd also removes it from the epoll instance
+    Srv.Connections.erase(Fd);
+    Increment(Srv.Stats->Closed);
+    if (Srv.AcceptStalled)
+    {
+        // an fd is free again, epoll reports the listener once more if connections still wait on it
+        Srv.AcceptStalled = false;
+        EpollRearm(Srv.EpollFd, Srv.ListenFd, EPOLLIN);
+    }
+}
+
+/**
+ * Returns the connection which sent Request, or nullptr if it was closed since
+ */
+
+Connection* FindConnection (Server& Srv, const Job& Request)
+{
+    auto Conn = Srv.Connections.find(Request.Fd);
+    if (Conn == Srv.Connections.end() || Conn->second.Serial != Request.Serial)
+    {
+        return nullptr;
+    }
+    return &Conn->second;
+}
+
+/**
+ * Accept every pending connection (the listening socket is edge triggered, so it must be drained: a connection
+ * left on it is never reported again). At the fd limit the spare fd is given up to accept the connection and close
+ * it at once, and if even that fails the listener is re-armed when a connection closes
+ */
+
+void AcceptConnections (Server& Srv)
+{
+    while (true)
+    {
+        uint64_t Start = NowNanos();
+        int ClientFd = GetConnection(Srv.ListenFd);
+        if (ClientFd == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return;
+            }
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            Increment(Srv.Stats->AcceptErrors); // only this connection is lost
+            if ((errno == EMFILE || errno == ENFILE) && Srv.SpareFd != -1)
+            {
+                close(Srv.SpareFd);
+                int Dropped = GetConnection(Srv.ListenFd);
+                if (Dropped != -1)
+                {
+                    close(Dropped);
+                }
+                Srv.SpareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                if (Dropped != -1)
+                {
+                    continue;
+                }
+            }
+            Srv.AcceptStalled = true;
+            return;
+        }
+        // the connection is always registered for writing too, edge triggered it only wakes when the
+        // socket buffer drains, and that is exactly when pending responses can be flushed
+        if (EpollAdd(Srv.EpollFd, ClientFd, EPOLLIN | EPOLLOUT | EPOLLRDHUP) == -1)
+        {
+            close(ClientFd);
+            continue;
+        }
+        int NoDelay = 1;
+        if (Srv.NoDelay && setsockopt(ClientFd, IPPROTO_TCP, TCP_NODELAY, &NoDelay, sizeof(NoDelay)) == -1)
+        {
+            std::cerr << SETSOCKOPT_FAILURE << std::endl;
+        }
+        Connection& Conn = Srv.Connections[ClientFd];
+        Conn.Fd = ClientFd;
+        Conn.Serial = Srv.NextSerial++;
+        Conn.Stats = Srv.Stats;
+        Increment(Srv.Stats->Accepted);
+        Srv.Stats->Accept.Record(NowNanos() - Start);
+    }
+}
+
+/**
+ * Write as much of Buffer as the socket takes, and erase what was written.
+ * Returns 1 if all of it was written, 0 if the socket is full, -1 if the connection failed
+ */
+
+int WriteBuffer (int Fd, std::string& Buffer)
+{
+    size_t Written = 0;
+    int Status = 1;
+    while (Written < Buffer.size())
+    {
+        ssize_t BytesWritten = write(Fd, Buffer.data() + Written, Buffer.size() - Written);
+        if (BytesWritten > 0)
+        {
+            Written += BytesWritten;
+            continue;
+        }
+        if (BytesWritten == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (BytesWritten == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            Status = 0;
+            break;
+        }
+        return -1;
+    }
+    Buffer.erase(0, Written);
+    return Status;
+}
+
+
+/// FILE TRANSFER ///
+// a get is sent in chunks of TRANSFER_CHUNK bytes, every chunk is a STATUS_DATA response whose header is written
+// from ChunkHeader and whose data goes from the file to the socket with sendfile. responses of other requests
+// wait in Output while a chunk is sent, and are written between the chunks.
+// the data of a put goes from the socket to the file with splice through the SplicePipe of the loop
+
+/**
+ * Open the file of a get request and queue it on the connection, or answer with STATUS_FILE_FAILURE
+ */
+
+void StartDownload (Connection& Conn, uint32_t Id, const std::string& Body)
+{
+    uint32_t Flags;
+    uint64_t Offset, Length;
+    std::string Path;
+    if (!ParseTransfer(Body, Flags, Offset, Length, Path))
+    {
+        Conn.Output += EncodeResponse(Id, STATUS_BAD_REQUEST, std::string());
+        return;
+    }
+
+    int FileFd = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat FileStat{};
+    if (FileFd == -1 || fstat(FileFd, &FileStat) == -1)
+    {
+        Conn.Output += EncodeResponse(Id, STATUS_FILE_FAILURE, strerror(errno));
+        if (FileFd != -1)
+        {
+            close(FileFd);
+        }
+        return;
+    }
+
+    // the range is clipped to the file, a zero length means up to the end of the file
+    uint64_t Size = (uint64_t) FileStat.st_size;
+    uint64_t Start = std::min(Offset, Size);
+    uint64_t Count = (Length == 0 || Length > Size - Start) ? Size - Start : Length;
+    Conn.Output += EncodeResponse(Id, STATUS_SIZE, EncodeCount(Count));
+    Conn.Downloads.push_back(Transfer{Id, FileFd, (off_t) Start, Count, Count, (Flags & TRANSFER_COPY) != 0,
+                                      std::string(), NowNanos()});
+}
+
+/**
+ * Queue the header of the next chunk of the current download, or its final response once all of it was sent
+ */
+
+void NextChunk (Connection& Conn)
+{
+    Transfer& Download = Conn.Downloads.front();
+    if (Download.Remaining == 0)
+    {
+        close(Download.FileFd);
+        Conn.Output += EncodeResponse(Download.Id, 0, std::string());
+        Increment(Conn.Stats->Downloads);
+        Conn.Stats->Response.Record(NowNanos() - Download.Arrival);
+        Conn.Downloads.pop_front();
+        return;
+    }
+    Conn.ChunkLeft = (size_t) std::min<uint64_t>(Download.Remaining, TRANSFER_CHUNK);
+    Conn.ChunkHeader = EncodeResponseHeader(Download.Id, STATUS_DATA, (uint32_t) Conn.ChunkLeft);
+}
+
+/**
+ * Send as much of the current chunk as the socket takes, with sendfile (pread and write for TRANSFER_COPY).
+ * Returns 1 if the chunk was sent, 0 if the socket is full, -1 if the connection failed
+ */
+
+int SendChunk (Connection& Conn)
+{
+    Transfer& Download = Conn.Downloads.front();
+    while (Conn.ChunkLeft > 0)
+    {
+        ssize_t Sent;
+        if (Download.Copy)
+        {
+            char Buffer[TRANSFER_BUFFER];
+            ssize_t Read = pread(Download.FileFd, Buffer, std::min<size_t>(Conn.ChunkLeft, TRANSFER_BUFFER),
+                                 Download.Offset);
+            if (Read < 1)
+            {
+                return -1;
+            }
+            Sent = write(Conn.Fd, Buffer, Read);
+            Download.Offset += (Sent > 0) ? Sent : 0;
+        }
+        else
+        {
+            Sent = sendfile(Conn.Fd, Download.FileFd, &Download.Offset, Conn.ChunkLeft);
+        }
+        if (Sent == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (Sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return 0;
+        }
+        if (Sent < 1)
+        {
+            // the file shrank below the size which was announced, the chunk can not be completed
+            std::cerr << TRANSFER_FAILURE << std::endl;
+            return -1;
+        }
+        Conn.ChunkLeft -= Sent;
+        Download.Remaining -= Sent;
+        Increment(Conn.Stats->BytesSent, Sent);
+    }
+    return 1;
+}
+
+/**
+ * Open the file of a put request and switch the connection to receive its data.
+ * if the file can not be opened the data is still read (and dropped), the failure is the final response.
+ * Returns false if the request is malformed, the length of the data which follows it is unknown then
+ */
+
+bool StartUpload (Connection& Conn, uint32_t Id, const std::string& Body)
+{
+    uint32_t Flags;
+    uint64_t Offset, Length;
+    std::string Path;
+    if (!ParseTransfer(Body, Flags, Offset, Length, Path))
+    {
+        return false;
+    }
+
+    // a put from the start replaces the file, a put at an offset writes over that range only
+    int FileFd = open(Path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (Offset == 0 ? O_TRUNC : 0), FILE_PERMISSIONS);
+    Conn.Upload = Transfer{Id, FileFd, (off_t) Offset, Length, Length, (Flags & TRANSFER_COPY) != 0,
+                           FileFd == -1 ? strerror(errno) : std::string(), NowNanos()};
+    Conn.Uploading = true;
+    return true;
+}
+
+/**
+ * Account Count more received bytes of the upload, and report the progress every PROGRESS_INTERVAL bytes
+ */
+
+void UploadProgress (Connection& Conn, uint64_t Count)
+{
+    Transfer& Upload = Conn.Upload;
+    uint64_t Before = Upload.Total - Upload.Remaining;
+    Upload.Remaining -= Count;
+    Increment(Conn.Stats->BytesReceived, Count);
+    if ((Before + Count) / PROGRESS_INTERVAL != Before / PROGRESS_INTERVAL)
+    {
+        Conn.Output += EncodeResponse(Upload.Id, STATUS_PROGRESS, EncodeCount(Before + Count));
+    }
+}
+
+/**
+ * Write upload data which was read to user space, a write failure fails the upload but its data is still consumed
+ */
+
+void StoreUpload (Connection& Conn, const char* Data, size_t Count)
+{
+    Transfer& Upload = Conn.Upload;
+    if (Upload.FileFd != -1)
+    {
+        if (pwrite(Upload.FileFd, Data, Count, Upload.Offset) != (ssize_t) Count)
+        {
+            Upload.Error = strerror(errno);
+            close(Upload.FileFd);
+            Upload.FileFd = -1;
+        }
+        Upload.Offset += Count;
+    }
+    UploadProgress(Conn, Count);
+}
+
+/**
+ * Receive as much of the upload data as is available.
+ * Returns 1 once all of it arrived (and the final response is queued), 0 if more is needed, -1 on failure
+ */
+
+int ReceiveUpload (Server& Srv, Connection& Conn)
+{
+    Transfer& Upload = Conn.Upload;
+
+    // data which was read together with the request is already in the input buffer
+    if (!Conn.Input.empty() && Upload.Remaining > 0)
+    {
+        size_t Count = (size_t) std::min<uint64_t>(Conn.Input.size(), Upload.Remaining);
+        StoreUpload(Conn, Conn.Input.data(), Count);
+        Conn.Input.erase(0, Count);
+    }
+
+    while (Upload.Remaining > 0)
+    {
+        if (Upload.Copy || Upload.FileFd == -1)
+        {
+            char Buffer[TRANSFER_BUFFER];
+            ssize_t Read = read(Conn.Fd, Buffer, std::min<uint64_t>(Upload.Remaining, TRANSFER_BUFFER));
+            if (Read == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (Read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return 0;
+            }
+            if (Read < 1)
+            {
+                return -1;
+            }
+            StoreUpload(Conn, Buffer, Read);
+            continue;
+        }
+
+        ssize_t Moved = splice_to_file(Conn.Fd, Upload.FileFd, Upload.Offset, Upload.Remaining, Srv.SplicePipe);
+        if (Moved == -1)
+        {
+            std::cerr << TRANSFER_FAILURE << std::endl;
+            return -1;
+        }
+        if (Moved == 0)
+        {
+            return 0;
+        }
+        UploadProgress(Conn, Moved);
+    }
+
+    if (Upload.FileFd != -1)
+    {
+        close(Upload.FileFd);
+        Conn.Output += EncodeResponse(Upload.Id, 0, std::string());
+    }
+    else
+    {
+        Conn.Output += EncodeResponse(Upload.Id, STATUS_FILE_FAILURE, Upload.Error);
+    }
+    Increment(Conn.Stats->Uploads);
+    Conn.Stats->Response.Record(NowNanos() - Upload.Arrival);
+    Conn.Uploading = false;
+    return 1;
+}
+
+
+/**
+ * Write as much of the pending responses and file chunks as the socket takes.
+ * Returns false if the connection failed
+ */
+
+bool FlushOutput (Connection& Conn)
+{
+    // a file chunk is sent right after its header, responses queued meanwhile wait in Output until it is done
+    while (true)
+    {
+        int Status;
+        size_t Pending = Conn.ChunkHeader.size() + Conn.Output.size();
+        if (!Conn.ChunkHeader.empty())
+        {
+            Status = WriteBuffer(Conn.Fd, Conn.ChunkHeader);
+        }
+        else if (Conn.ChunkLeft > 0)
+        {
+            Status = SendChunk(Conn);
+        }
+        else if (!Conn.Output.empty())
+        {
+            Status = WriteBuffer(Conn.Fd, Conn.Output);
+        }
+        else if (!Conn.Downloads.empty())
+        {
+            NextChunk(Conn);
+            continue;
+        }
+        else
+        {
+            return true;
+        }
+        Increment(Conn.Stats->BytesSent, Pending - Conn.ChunkHeader.size() - Conn.Output.size());
+
+        if (Status == -1)
+        {
+            return false;
+        }
+        if (Status == 0)
+        {
+            return true;
+        }
+    }
+}
+
+/**
+ * Returns true if the connection is done: the Client closed its side and all its requests were answered
+ */
+
+bool ConnectionFinished (const Connection& Conn)
+{
+    return Conn.ReadClosed && Conn.InFlight == 0 && Conn.Output.empty() && Conn.Downloads.empty() &&
+           !Conn.Uploading && Conn.ChunkHeader.empty();
+}
+
+/**
+ * Flush the connection, and close it if it failed or is done. Paused command output is read again once the
+ * responses drain below the high water
+ */
+
+void UpdateConnection (Server& Srv, Connection& Conn)
+{
+    bool Failed = !FlushOutput(Conn);
+    if (Failed)
+    {
+        Increment(Srv.Stats->ConnectionErrors);
+    }
+    else if (Conn.Output.size() < OUTPUT_HIGH_WATER)
+    {
+        ResumeOutputs(Srv, Conn);
+    }
+    if (Failed || ConnectionFinished(Conn))
+    {
+        CloseConnection(Srv, Conn.Fd);
+    }
+}
+
+/**
+ * Answer Request with its final Status, the connection may have been closed already
+ */
+
+void FinishRequest (Server& Srv, const Job& Request, int32_t Status)
+{
+    Srv.Stats->Response.Record(NowNanos() - Request.Arrival);
+    Connection* Conn = FindConnection(Srv, Request);
+    if (Conn == nullptr)
+    {
+        return;
+    }
+    Conn->InFlight--;
+    Conn->Output += EncodeResponse(Request.Id, Status, std::string());
+    UpdateConnection(Srv, *Conn);
+}
+
+/**
+ * Start Request as a child process, a request which can not be started is answered right away
+ */
+
+void StartChild (Server& Srv, const Job& Request)
+{
+    // only the Server end is non-blocking, the command writes its output as usual
+    int Pipe[2];
+    if (pipe2(Pipe, O_CLOEXEC) == -1)
+    {
+        std::cerr << PIPE_FAILURE << std::endl;
+        FinishRequest(Srv, Request, STATUS_SYSTEM_FAILURE);
+        return;
+    }
+    if (SetNonBlocking(Pipe[0]) == -1)
+    {
+        close(Pipe[0]);
+        close(Pipe[1]);
+        FinishRequest(Srv, Request, STATUS_SYSTEM_FAILURE);
+        return;
+    }
+
+    pid_t Pid;
+    int Error = SpawnCommand(Request.Command, Pipe[1], Pid);
+    close(Pipe[1]);
+    if (Error != 0)
+    {
+        close(Pipe[0]);
+        std::cerr << SPAWN_FAILURE << std::endl;
+        FinishRequest(Srv, Request, STATUS_SYSTEM_FAILURE);
+        return;
+    }
+    int PidFd = OpenPidFd(Pid);
+    if (PidFd == -1 || EpollAdd(Srv.EpollFd, PidFd, EPOLLIN) == -1)
+    {
+        // without a pidfd the loop would never learn that the child exited
+        std::cerr << PIDFD_FAILURE << std::endl;
+        kill(Pid, SIGKILL);
+        waitpid(Pid, nullptr, 0);
+        if (PidFd != -1)
+        {
+            close(PidFd);
+        }
+        close(Pipe[0]);
+        FinishRequest(Srv, Request, STATUS_SYSTEM_FAILURE);
+        return;
+    }
+    Srv.PidFds[PidFd] = Pid;
+
+    if (EpollAdd(Srv.EpollFd, Pipe[0], EPOLLIN) == -1)
+    {
+        close(Pipe[0]);
+        Pipe[0] = -1; // the command still runs and is answered when it exits, without its output
+    }
+    else
+    {
+        Srv.Outputs[Pipe[0]] = Pid;
+    }
+    Srv.Children[Pid] = Child{Request, Pipe[0], PidFd, false, 0, NowNanos()};
+}
+
+/**
+ * Run the requests waiting for a free child slot
+ */
+
+void StartPending (Server& Srv)
+{
+    while (!Srv.Pending.empty() && Srv.Children.size() < Srv.MaxChildren)
+    {
+        Job Request = Srv.Pending.front();
+        Srv.Pending.pop_front();
+        if (FindConnection(Srv, Request) == nullptr)
+        {
+            continue; // nobody waits for the answer anymore
+        }
+        StartChild(Srv, Request);
+    }
+}
+
+/**
+ * A child is done once it exited and its output was read to the end
+ */
+
+void CompleteChild (Server& Srv, pid_t Pid)
+{
+    auto Entry = Srv.Children.find(Pid);
+    if (Entry == Srv.Children.end() || !Entry->second.Exited || Entry->second.OutputFd != -1)
+    {
+        return;
+    }
+    Job Request = Entry->second.Request;
+    int32_t Status = Entry->second.Status;
+    Increment(Srv.Stats->Commands);
+    Srv.Stats->Command.Record(NowNanos() - Entry->second.Started);
+    Srv.Children.erase(Entry);
+    FinishRequest(Srv, Request, Status);
+    StartPending(Srv);
+}
+
+/**
+ * Read everything available on a child output pipe and stream it to the Client. While the Client does not read
+ * its responses fast enough (more than OUTPUT_HIGH_WATER bytes wait) the pipe is paused: it is not read until
+ * the responses drain, so it fills up and the command blocks on its writes instead of the Server buffering them
+ */
+
+void HandleChildOutput (Server& Srv, int OutputFd)
+{
+    auto Output = Srv.Outputs.find(OutputFd);
+    if (Output == Srv.Outputs.end())
+    {
+        return;
+    }
+    pid_t Pid = Output->second;
+    Child& Proc = Srv.Children[Pid];
+    Connection* Conn = FindConnection(Srv, Proc.Request);
+
+    char Chunk[READ_CHUNK];
+    while (true)
+    {
+        if (Conn != nullptr && Conn->Output.size() >= OUTPUT_HIGH_WATER)
+        {
+            if (std::find(Conn->PausedOutputs.begin(), Conn->PausedOutputs.end(), OutputFd) ==
+                Conn->PausedOutputs.end())
+            {
+                Conn->PausedOutputs.push_back(OutputFd);
+            }
+            break;
+        }
+        ssize_t BytesRead = read(OutputFd, Chunk, READ_CHUNK);
+        if (BytesRead > 0)
+        {
+            if (Conn != nullptr)
+            {
+                Conn->Output += EncodeResponse(Proc.Request.Id, STATUS_OUTPUT, std::string(Chunk, BytesRead));
+            }
+            continue;
+        }
+        if (BytesRead == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (BytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        // end of the output (every copy of the write end was closed), or a broken pipe
+        close(OutputFd);
+        Srv.Outputs.erase(Output);
+        Proc.OutputFd = -1;
+        break;
+    }
+
+    if (Conn != nullptr)
+    {
+        UpdateConnection(Srv, *Conn);
+    }
+    CompleteChild(Srv, Pid);
+}
+
+/**
+ * Reap the child whose pidfd became readable
+ */
+
+void ReapChild (Server& Srv, int PidFd)
+{
+    auto Entry = Srv.PidFds.find(PidFd);
+    if (Entry == Srv.PidFds.end())
+    {
+        return;
+    }
+    pid_t Pid = Entry->second;
+    int WaitStatus;
+    if (waitpid(Pid, &WaitStatus, WNOHANG) != Pid)
+    {
+        return;
+    }
+    close(PidFd);
+    Srv.PidFds.erase(Entry);
+
+    Child& Proc = Srv.Children[Pid];
+    Proc.PidFd = -1;
+    Proc.Exited = true;
+    Proc.Status = CommandStatus(WaitStatus);
+    CompleteChild(Srv, Pid);
+}
+
+/**
+ * Handle every complete request in the input buffer: a command is queued to run when a child slot is free (or
+ * answered with STATUS_REJECTED if the queue is full), a get is queued on the connection, and a put stops the
+ * parsing since the bytes after it are its data. Returns false if a message is too large
+ */
+
+bool ProcessInput (Server& Srv, Connection& Conn)
+{
+    std::string Payload;
+    int Status = 0;
+    while (!Conn.Uploading && (Status = DecodeMessage(Conn.Input, Payload)) == 1)
+    {
+        Job Request{Conn.Fd, Conn.Serial, 0, std::string(), NowNanos()};
+        uint32_t Type;
+        Increment(Srv.Stats->Requests);
+        if (!ParseRequest(Payload, Request.Id, Type, Request.Command))
+        {
+            Increment(Srv.Stats->BadRequests);
+            Conn.Output += EncodeResponse(0, STATUS_BAD_REQUEST, std::string());
+            continue;
+        }
+        if (Type == REQUEST_STATS)
+        {
+            Conn.Output += EncodeResponse(Request.Id, 0, StatsReport());
+            continue;
+        }
+        if (Type == REQUEST_GET)
+        {
+            StartDownload(Conn, Request.Id, Request.Command);
+            continue;
+        }
+        if (Type == REQUEST_PUT)
+        {
+            if (!StartUpload(Conn, Request.Id, Request.Command))
+            {
+                return false;
+            }
+            continue;
+        }
+        if (Type != REQUEST_COMMAND)
+        {
+            Increment(Srv.Stats->BadRequests);
+            Conn.Output += EncodeResponse(Request.Id, STATUS_BAD_REQUEST, std::string());
+            continue;
+        }
+        if (Srv.Pending.size() >= PENDING_QUEUE_CAPACITY)
+        {
+            Increment(Srv.Stats->Rejected);
+            Conn.Output += EncodeResponse(Request.Id, STATUS_REJECTED, std::string());
+            continue;
+        }
+        Conn.InFlight++;
+        Srv.Pending.push_back(Request);
+    }
+    if (!Conn.Uploading && Status == -1)
+    {
+        std::cerr << MESSAGE_SIZE_FAILURE << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read everything available on the connection and handle the requests in it.
+ * requests which arrived completely are handled even if the Client already closed its side.
+ * Returns false if the connection should be closed (error, or malformed message)
+ */
+
+bool HandleReadable (Server& Srv, Connection& Conn)
+{
+    char Chunk[READ_CHUNK];
+    while (true)
+    {
+        if (!ProcessInput(Srv, Conn))
+        {
+            return false;
+        }
+        if (Conn.Uploading)
+        {
+            int Status = ReceiveUpload(Srv, Conn);
+            if (Status != 1)
+            {
+                return Status == 0;
+            }
+            continue; // requests may follow the uploaded data
+        }
+        if (Conn.ReadClosed)
+        {
+            return true;
+        }
+
+        ssize_t BytesRead = read(Conn.Fd, Chunk, READ_CHUNK);
+        if (BytesRead > 0)
+        {
+            Conn.Input.append(Chunk, BytesRead);
+            Increment(Srv.Stats->BytesReceived, BytesRead);
+            continue;
+        }
+        if (BytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return true;
+        }
+        if (BytesRead == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (BytesRead == -1)
+        {
+            std::cerr << READ_FAILURE << std::endl;
+            return false;
+        }
+        Conn.ReadClosed = true;
+    }
+}
+
+/**
+ * One event loop of the Server: accepts persistent connections on its own listening socket, reads length prefixed
+ * requests from partial reads, runs up to MaxChildren commands at once, streams their output back and answers
+ * every request with the exit status of its command
+ */
+
+void* ServerLoop (void* Arg)
+{
+    Server& Srv = *(Server*) Arg;
+    struct epoll_event Events[MAX_EVENTS];
+
+    while (true)
+    {
+        int NumEvents = epoll_wait(Srv.EpollFd, Events, MAX_EVENTS, -1);
+        if (NumEvents == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cerr << EPOLL_FAILURE << std::endl;
+            close(Srv.ListenFd);
+            exit(1);
+        }
+
+        for (int i = 0; i < NumEvents; i++)
+        {
+            int Fd = Events[i].data.fd;
+            if (Fd == Srv.ListenFd)
+            {
+                AcceptConnections(Srv);
+                continue;
+            }
+            if (Srv.PidFds.count(Fd))
+            {
+                ReapChild(Srv, Fd);
+                continue;
+            }
+            if (Srv.Outputs.count(Fd))
+            {
+                HandleChildOutput(Srv, Fd);
+                continue;
+            }
+
+            auto Conn = Srv.Connections.find(Fd);
+            if (Conn == Srv.Connections.end())
+            {
+                continue;
+            }
+            // a failure of one connection only closes that connection
+            uint64_t Start = NowNanos();
+            bool Failed = (Events[i].events & EPOLLERR) || !HandleReadable(Srv, Conn->second);
+            Srv.Stats->Read.Record(NowNanos() - Start);
+            if (Failed)
+            {
+                Increment(Srv.Stats->ConnectionErrors);
+                CloseConnection(Srv, Fd);
+                continue;
+            }
+            UpdateConnection(Srv, Conn->second);
+        }
+        StartPending(Srv);
+    }
+}
+
+
+/**
+ * This function creates a socket for the Server and wait for a connection of clients.
+ * with -t threads every thread binds its own SO_REUSEPORT listening socket and runs its own event loop, so accepts
+ * are not serialized on one socket and one core. the limit of running commands is split between the loops
+ */
+
+
+void ServerManager (int argc, char ** argv)
+{
+    size_t MaxChildren = DEFAULT_MAX_CHILDREN;
+    int Threads = 1, Backlog = LISTEN_BACKLOG, DeferAccept = 0;
+    bool NoDelay = false;
+    int Option;
+    optind = 3;
+    while ((Option = getopt(argc, argv, "c:t:b:nd:")) != -1)
+    {
+        switch (Option)
+        {
+            case 'c': MaxChildren = strtoul(optarg, nullptr, 10); break;
+            case 't': Threads = (int) strtol(optarg, nullptr, 10); break;
+            case 'b': Backlog = (int) strtol(optarg, nullptr, 10); break;
+            case 'n': NoDelay = true; break;
+            case 'd': DeferAccept = (int) strtol(optarg, nullptr, 10); break;
+            default:
+                std::cerr << USAGE << std::endl;
+                exit(1);
+        }
+    }
+    if (Threads < 1)
+    {
+        Threads = 1;
+    }
+    // a Client which goes away while a response is written must not kill the Server, the write fails instead
+    signal(SIGPIPE, SIG_IGN);
+
+    // all the listening sockets are bound before any loop starts, so a taken port fails at once
+    std::vector<Server> Loops(Threads);
+    for (int i = 0; i < Threads; i++)
+    {
+        Server& Srv = Loops[i];
+        Srv.MaxChildren = std::max<size_t>(1, MaxChildren / Threads);
+        Srv.NoDelay = NoDelay;
+        Srv.SpareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        Srv.AcceptStalled = false;
+        Srv.Stats = new LoopStats();
+        AllStats.push_back(Srv.Stats);
+        Srv.ListenFd = SocketInitializer(argv, 0, Backlog, Threads > 1);
+        if (Srv.ListenFd == -1)
+        {
+            exit(1);
+        }
+        // with TCP_DEFER_ACCEPT a connection is only accepted once its first request arrived
+        if (DeferAccept > 0 &&
+            setsockopt(Srv.ListenFd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &DeferAccept, sizeof(DeferAccept)) == -1)
+        {
+            std::cerr << SETSOCKOPT_FAILURE << std::endl;
+        }
+
+        if (splice_pipe(Srv.SplicePipe) == -1)
+        {
+            std::cerr << PIPE_FAILURE << std::endl;
+            exit(1);
+        }
+
+        Srv.EpollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (Srv.EpollFd == -1 || SetNonBlocking(Srv.ListenFd) == -1 ||
+            EpollAdd(Srv.EpollFd, Srv.ListenFd, EPOLLIN) == -1)
+        {
+            std::cerr << EPOLL_FAILURE << std::endl;
+            close(Srv.ListenFd);
+            exit(1);
+        }
+    }
+
+    for (int i = 1; i < Threads; i++)
+    {
+        pthread_t Thread;
+        if (pthread_create(&Thread, nullptr, ServerLoop, &Loops[i]))
+        {
+            std::cerr << PTHREAD_FAILURE << std::endl;
+            exit(1);
+        }
+    }
+    ServerLoop(&Loops[0]);
+}
+
+
+/// BENCHMARK ///
+
+/**
+ * Load generator: open Connections persistent connections to the Server at once, pipeline Messages requests
+ * of Command on every one of them, wait for all the responses and report the connection and request rates
+ */
+
+void BenchManager (int argc, char ** argv)
+{
+    size_t NumConnections = (argc > 3) ? strtoul(argv[3], nullptr, 10) : DEFAULT_BENCH_CONNECTIONS;
+    size_t NumMessages = (argc > 4) ? strtoul(argv[4], nullptr, 10) : DEFAULT_BENCH_MESSAGES;
+    std::string Command = (argc > 5) ? argv[5] : "true";
+
+    auto Start = std::chrono::steady_clock::now();
+    std::vector<int> Fds;
+    for (size_t i = 0; i < NumConnections; i++)
+    {
+        int SockFd = SocketInitializer(argv,1);
+        if (SockFd == -1)
+        {
+            break;
+        }
+        Fds.push_back(SockFd);
+    }
+    auto Connected = std::chrono::steady_clock::now();
+
+    // all the requests of a connection are written together, so the Server sees them in few reads
+    std::string Batch;
+    for (size_t i = 0; i < NumMessages; i++)
+    {
+        Batch += EncodeRequest((uint32_t) i, REQUEST_COMMAND, Command);
+    }
+    std::vector<int> Sending;
+    for (int SockFd : Fds)
+    {
+        if (write_data(SockFd, Batch.data(), Batch.size()) == -1)
+        {
+            std::cerr << WRITE_FAILURE << std::endl;
+            continue;
+        }
+        Sending.push_back(SockFd);
+    }
+
+    size_t Answered = 0, Rejected = 0, Failed = 0;
+    for (int SockFd : Sending)
+    {
+        for (size_t i = 0; i < NumMessages;)
+        {
+            uint32_t Id;
+            int32_t Status;
+            std::string Output;
+            if (!ReadResponse(SockFd, Id, Status, Output))
+            {
+                break;
+            }
+            if (Status == STATUS_OUTPUT)
+            {
+                continue;
+            }
+            i++;
+            Answered++;
+            if (Status == STATUS_REJECTED)
+            {
+                Rejected++;
+            } else if (Status != 0)
+            {
+                Failed++;
+            }
+        }
+    }
+    for (int SockFd : Fds)
+    {
+        close(SockFd);
+    }
+    auto End = std::chrono::steady_clock::now();
+
+    double ConnectSeconds = std::chrono::duration<double>(Connected - Start).count();
+    double TotalSeconds = std::chrono::duration<double>(End - Start).count();
+    std::cout << "connections=" << Fds.size() << " requests=" << Answered
+              << " rejected=" << Rejected << " failed=" << Failed
+              << " connections_per_sec=" << (ConnectSeconds > 0 ? Fds.size() / ConnectSeconds : 0)
+              << " requests_per_sec=" << (TotalSeconds > 0 ? Answered / TotalSeconds : 0) << std::endl;
+}
+
+
+typedef struct ConnectBenchThread {
+    struct sockaddr_in Addr;
+    double Seconds;
+    size_t Connections;
+    size_t Failures;
+} ConnectBenchThread;
+
+/**
+ * Open and close connections until the time is over: connect, close the sending side and wait for the Server
+ * to close the connection, so every connection is a full accept and close in the Server
+ */
+
+void* ConnectBenchRoutine (void* Arg)
+{
+    auto Bench = (ConnectBenchThread*) Arg;
+    auto End = std::chrono::steady_clock::now() + std::chrono::duration<double>(Bench->Seconds);
+    char Byte;
+    while (std::chrono::steady_clock::now() < End)
+    {
+        int SockFd = socket(Bench->Addr.sin_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (SockFd == -1)
+        {
+            Bench->Failures++;
+            continue;
+        }
+        if (connect(SockFd, (struct sockaddr*) &Bench->Addr, sizeof(Bench->Addr)) < 0 ||
+            shutdown(SockFd, SHUT_WR) < 0 || read(SockFd, &Byte, 1) != 0)
+        {
+            Bench->Failures++;
+        }
+        else
+        {
+            Bench->Connections++;
+        }
+        close(SockFd);
+    }
+    return nullptr;
+}
+
+/**
+ * Connection rate benchmark: Threads threads open connections to the Server for Seconds seconds.
+ * run it against servers with different -t to see how accepting scales across cores
+ */
+
+void ConnectBenchManager (int argc, char ** argv)
+{
+    int Threads = (argc > 3) ? (int) strtol(argv[3], nullptr, 10) : DEFAULT_BENCH_THREADS;
+    double Seconds = (argc > 4) ? strtod(argv[4], nullptr) : DEFAULT_BENCH_SECONDS;
+    if (Threads < 1)
+    {
+        Threads = 1;
+    }
+
+    struct sockaddr_in Addr{};
+    if (!ServerAddress(argv, Addr))
+    {
+        exit(1);
+    }
+
+    std::vector<ConnectBenchThread> Benches(Threads, ConnectBenchThread{Addr, Seconds, 0, 0});
+    std::vector<pthread_t> Ids(Threads);
+    auto Start = std::chrono::steady_clock::now();
+    for (int i = 0; i < Threads; i++)
+    {
+        if (pthread_create(&Ids[i], nullptr, ConnectBenchRoutine, &Benches[i]))
+        {
+            std::cerr << PTHREAD_FAILURE << std::endl;
+            exit(1);
+        }
+    }
+    size_t Connections = 0, Failures = 0;
+    for (int i = 0; i < Threads; i++)
+    {
+        pthread_join(Ids[i], nullptr);
+        Connections += Benches[i].Connections;
+        Failures += Benches[i].Failures;
+    }
+    double Elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+    std::cout << "threads=" << Threads << " connections=" << Connections << " failures=" << Failures
+              << " connections_per_sec=" << (Elapsed > 0 ? Connections / Elapsed : 0) << std::endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3 || ((strcmp(argv[1],CLIENT) == 0 || strcmp(argv[1],STREAM) == 0) && argc < 4) ||
+        ((strcmp(argv[1],GET) == 0 || strcmp(argv[1],PUT) == 0) && argc < 5))
+    {
+        std::cerr << USAGE << std::endl;
+        return 1;
+    }
+
+    if (strcmp(argv[1],SERVER) == 0 )
+    {
+        ServerManager(argc, argv);
+
+    } else if (strcmp(argv[1],BENCH) == 0)
+    {
+        BenchManager(argc, argv);
+    } else if (strcmp(argv[1],CONNECT_BENCH) == 0)
+    {
+        ConnectBenchManager(argc, argv);
+    } else if (strcmp(argv[1],GET) == 0)
+    {
+        return GetManager(argc, argv);
+    } else if (strcmp(argv[1],PUT) == 0)
+    {
+        return PutManager(argc, argv);
+    } else if (strcmp(argv[1],STATS) == 0)
+    {
+        return StatsManager(argv);
+    } else if (strcmp(argv[1],STREAM) == 0)
+    {
+        return StreamManager(argc, argv);
+    } else
+    {
+        return ClientManager(argv);
+    }
+    return 0 ;
+
+}